@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <chrono>
+#include "head.h"
+
+// 对比开关追加缓存时，对一个文件反复小追加(test_maxlength 的负载)的耗时和写回量。
+// 负载：一个文件追加 4MB，每次 27 字节。
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(int size, const char *name) {
+  constexpr char buf[] = "abcdefghijklmnopqrstuvwxyz";
+  FormatFileSystem(root_path);
+  LogIn("root", "root");
+  SetAppendCache(size, DEFAULT_APPEND_DELAY);
+  CreateFile("log");
+  int index = Open("log");
+
+  bufferStat before = *GetBufferStat();
+  double t0 = now_ms();
+  int len = 0;
+  while (len < (4 << 20)) {
+    len += Append(index, sizeof(buf), buf);
+  }
+  CloseFile("log");
+  FlushBuffer();
+  double t1 = now_ms();
+  bufferStat after = *GetBufferStat();
+
+  printf("[%s] %d 次追加 %.3f ms, 缓冲池 Put %lld 次, 写回 %lld KB\n", name, len / (int)sizeof(buf),
+         t1 - t0, (after.hits + after.misses) - (before.hits + before.misses),
+         (after.bytes_written - before.bytes_written) / 1024);
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  run(0, "直接写");
+  run(DEFAULT_APPEND_SIZE, "追加缓存");
+  return 0;
+}
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "head.h"
+
+// 对比三种写回后端写一个大文件并落盘的耗时和系统调用次数。
+// 负载：128MB 文件一次写入，之后 SyncBuffer，缓冲池放不下，大部分块在淘汰时写回。
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(io_backend_type type) {
+  io_backend = type;
+  geometry geo{512 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  CreateFile("big");
+  int index = Open("big");
+  std::vector<char> buf(128 << 20, 'x');
+
+  ioStat before = *GetIoStat();
+  double t0 = now_ms();
+  Write(index, 0, buf.size(), buf.data());
+  SyncBuffer();
+  double t1 = now_ms();
+  ioStat after = *GetIoStat();
+
+  long long requests = after.requests - before.requests;
+  long long writes = after.writes - before.writes;
+  printf("[%s] %.3f ms, %lld 次写合并成 %lld 次(%.1f:1) %lld 批, 系统调用 %lld 次\n",
+         IoBackendName(), t1 - t0, requests, writes, writes ? (double)requests / writes : 0.0,
+         after.batches - before.batches, after.syscalls - before.syscalls);
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  run(IO_BACKEND_SYNC);
+  run(IO_BACKEND_THREADS);
+  run(IO_BACKEND_URING);
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include "head.h"
+
+// 小文件容量：默认 50MB 镜像里不停地建文件，每个目录 1000 个，直到建不出来或者写不进去。
+// 统计能放下的文件数、存进去的字节数，以及用掉的 inode 和数据块。
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(const char *name, int size) {
+  FormatFileSystem(root_path);
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+  const int free_inodes = super->free_inodes;
+  const int free_blocks = super->free_blocks;
+  std::string content(size, 'x');
+
+  double t0 = now_ms();
+  int files = 0;
+  bool full = false;
+  for (int d = 0; !full; ++d) {
+    std::string dir = "d" + std::to_string(d);
+    if (CreateDir(dir.c_str()) == false) {
+      break;
+    }
+    NextDir(dir.c_str());
+    for (int i = 0; i < 1000; ++i) {
+      std::string s = std::to_string(i);
+      if (CreateFile(s.c_str()) == false ||
+          (size > 0 && Append(Open(s.c_str()), size, content.data()) != size)) {
+        full = true;
+        break;
+      }
+      ++files;
+    }
+    LastDir();
+  }
+  double t1 = now_ms();
+
+  printf("[%s] files %d, stored %lld KB, inodes used %d/%d, blocks used %d/%d, %.1f ms\n", name,
+         files, (long long)files * size / 1024, free_inodes - super->free_inodes,
+         super->inode_count, free_blocks - super->free_blocks, super->block_count, t1 - t0);
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  run("空文件", 0);
+  run("100B", 100);
+  run("4KB", 4096);
+  return 0;
+}
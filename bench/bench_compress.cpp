@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 压缩存储的省空间和读写吞吐。负载：仓库自带的四个文本各导入一份，整个读回来，
+// 再按 4KB 随机读一遍，对比不压缩和压缩，同时记下实际写到镜像的字节数。
+// 用法：bench_compress [文本所在目录]，默认当前目录。
+constexpr const char *CORPORA[] = {"西游记", "三国演义", "史记", "过秦论"};
+constexpr int RANDOM_READS = 4096;
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<std::string> load(const std::string &dir) {
+  std::vector<std::string> ret;
+  for (const char *name : CORPORA) {
+    std::ifstream in(dir + "/" + name, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    ret.push_back(ss.str());
+    if (ret.back().empty()) {
+      fprintf(stderr, "读不到 %s/%s\n", dir.c_str(), name);
+    }
+  }
+  return ret;
+}
+
+static void run(const std::vector<std::string> &texts, bool compress) {
+  geometry geo{256 << 20, 4096, 0, 0, ALLOC_BITMAP, compress};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  const ioStat io = *GetIoStat();
+
+  long long bytes = 0;
+  double t0 = now_ms();
+  for (size_t i = 0; i < texts.size(); ++i) {
+    CreateFile(CORPORA[i]);
+    bytes += Write(Open(CORPORA[i]), 0, texts[i].size(), texts[i].data());
+  }
+  FlushBuffer();
+  double t1 = now_ms();
+  const int used = free_blocks - super->free_blocks;
+
+  std::string buf;
+  for (size_t i = 0; i < texts.size(); ++i) {
+    buf.resize(texts[i].size());
+    Read(Open(CORPORA[i]), 0, buf.size(), buf.data());
+    if (buf != texts[i]) {
+      fprintf(stderr, "%s 读出来不一样\n", CORPORA[i]);
+    }
+  }
+  double t2 = now_ms();
+
+  char block[4096];
+  unsigned int x = 1;
+  for (int k = 0; k < RANDOM_READS; ++k) {
+    x = x * 1103515245 + 12345;
+    const std::string &s = texts[k % texts.size()];
+    const int pos = (x >> 8) % std::max<int>(s.size() - sizeof(block), 1);
+    Read(Open(CORPORA[k % texts.size()]), pos, sizeof(block), block);
+  }
+  double t3 = now_ms();
+
+  const ioStat *now = GetIoStat();
+  const long long data_blocks = (bytes + 4095) / 4096;
+  printf("[%s] 写 %lld KB 用 %.1f ms (%.1f MB/s)，顺序读 %.1f MB/s，4KB 随机读 %.0f 次/s\n",
+         compress ? "压缩" : "不压缩", bytes >> 10, t1 - t0,
+         bytes / 1048576.0 / ((t1 - t0) / 1000), bytes / 1048576.0 / ((t2 - t1) / 1000),
+         RANDOM_READS / ((t3 - t2) / 1000));
+  printf("    占用 %d 块，数据 %lld 块，省 %.1f%%，写镜像 %lld KB\n", used, data_blocks,
+         100.0 * (data_blocks - used) / data_blocks, (now->bytes - io.bytes) >> 10);
+  CloseFileSystem();
+}
+
+int main(int argc, char **argv) {
+  need_log = false;
+  const std::vector<std::string> texts = load(argc > 1 ? argv[1] : ".");
+  run(texts, false);
+  run(texts, true);
+  const compressStat *stat = GetCompressStat();
+  printf("压缩 %lld 簇，原样 %lld 簇，%lld 字节压到 %lld 字节 (%.2f)\n", stat->compressed,
+         stat->raw, stat->bytes_in, stat->bytes_out,
+         stat->bytes_out > 0 ? (double)stat->bytes_in / stat->bytes_out : 0.0);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 反复查同一批名字的耗时。目录里有 n 个文件，反复打开其中 100 个，再夹杂 20% 不存在的名字
+// (相当于建文件前查重名)，对比打开和关掉目录项缓存。目录分带散列索引的和老的目录项两种，
+// 后者每次没命中都要顺序扫目录、读每个文件的 inode。
+constexpr int ROUNDS = 100000;
+constexpr int HOT = 100;
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(int n, bool old, bool cache) {
+  geometry geo{128 << 20, 4096, n + 100, 0, ALLOC_BITMAP};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  use_dir_names = !old;
+  use_dir_index = !old;
+  CreateDir("d");
+  NextDir("d");
+  for (int i = 0; i < n; ++i) {
+    CreateFile(("f" + std::to_string(i)).c_str());
+  }
+  std::vector<std::string> names;
+  for (int i = 0; i < HOT; ++i) {
+    names.push_back("f" + std::to_string(i * (n / HOT)));
+    if (i % 5 == 0) {
+      names.push_back("missing" + std::to_string(i));
+    }
+  }
+
+  use_dentry_cache = cache;
+  const dentryStat before = *GetDentryStat();
+  int found = 0;
+  double t0 = now_ms();
+  for (int i = 0; i < ROUNDS; ++i) {
+    found += Open(names[i % names.size()].c_str()) > 0;
+  }
+  double t1 = now_ms();
+  const dentryStat *stat = GetDentryStat();
+  printf("[%s%s] %5d 项：%d 次查找 %9.2f ms (%7.3f us/次)，找到 %d，命中 %lld，命中没有 %lld，"
+         "没命中 %lld\n",
+         old ? "老的目录项" : "散列索引", cache ? "+缓存" : "", n, ROUNDS, t1 - t0,
+         (t1 - t0) * 1000 / ROUNDS, found, stat->hits - before.hits,
+         stat->negatives - before.negatives, stat->misses - before.misses);
+  use_dentry_cache = true;
+  use_dir_names = true;
+  use_dir_index = true;
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  for (int n : {1000, 10000}) {
+    run(n, false, false);
+    run(n, false, true);
+  }
+  // 老的目录项不用缓存时一万项要跑好几分钟，只跑一千项
+  run(1000, true, false);
+  run(1000, true, true);
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 去重的省空间和写吞吐。负载：仓库自带的四个文本各导入 8 份，
+// 对比不去重、写时去重，以及不去重写完后跑一遍离线去重。
+// 用法：bench_dedup [文本所在目录]，默认当前目录。
+constexpr int COPIES = 8;
+constexpr const char *CORPORA[] = {"西游记", "三国演义", "史记", "过秦论"};
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static std::vector<std::string> load(const std::string &dir) {
+  std::vector<std::string> ret;
+  for (const char *name : CORPORA) {
+    std::ifstream in(dir + "/" + name, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    ret.push_back(ss.str());
+    if (ret.back().empty()) {
+      fprintf(stderr, "读不到 %s/%s\n", dir.c_str(), name);
+    }
+  }
+  return ret;
+}
+
+static void run(const std::vector<std::string> &texts, bool online, bool offline) {
+  geometry geo{256 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  dedup_blocks = online;
+
+  long long bytes = 0;
+  double t0 = now_ms();
+  for (int c = 0; c < COPIES; ++c) {
+    for (size_t i = 0; i < texts.size(); ++i) {
+      const std::string name = std::string(CORPORA[i]) + std::to_string(c);
+      CreateFile(name.c_str());
+      bytes += Write(Open(name.c_str()), 0, texts[i].size(), texts[i].data());
+    }
+  }
+  FlushBuffer();
+  double t1 = now_ms();
+  const int written = free_blocks - super->free_blocks;
+
+  int saved = 0;
+  double t2 = t1;
+  if (offline) {
+    saved = DedupAll();
+    FlushBuffer();
+    t2 = now_ms();
+  }
+  const int used = free_blocks - super->free_blocks;
+  const long long data_blocks = (bytes + 4095) / 4096;
+  printf("[%s] 写 %lld KB 用 %.1f ms (%.1f MB/s)，占用 %d 块，数据 %lld 块，省 %.1f%%",
+         online ? "写时去重" : (offline ? "离线去重" : "不去重"), bytes >> 10, t1 - t0,
+         bytes / 1048576.0 / ((t1 - t0) / 1000), used, data_blocks,
+         100.0 * (data_blocks - used) / data_blocks);
+  if (offline) {
+    printf("，离线去重前占用 %d 块，省下 %d 块用 %.1f ms", written, saved, t2 - t1);
+  }
+  printf("\n");
+  dedup_blocks = false;
+  CloseFileSystem();
+}
+
+int main(int argc, char **argv) {
+  need_log = false;
+  const std::vector<std::string> texts = load(argc > 1 ? argv[1] : ".");
+  run(texts, false, false);
+  run(texts, true, false);
+  run(texts, false, true);
+  const dedupStat *stat = GetDedupStat();
+  printf("指纹 %lld 块，命中 %lld 次，进索引 %lld 块\n", stat->hashed, stat->matched,
+         stat->indexed);
+  return 0;
+}
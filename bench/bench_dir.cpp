@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include "head.h"
+
+// 大目录的建文件和查找耗时。一个目录里建 n 个文件，再按名字各打开一次，对比有散列索引、
+// 按顺序找带名字的目录项(use_dir_index = false)和按顺序找老的目录项(还要读每个文件的 inode)。
+// 建文件要先查重名，所以也和查找一样受益。
+constexpr int SIZES[] = {100, 1000, 10000};
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(int n, bool names, bool index) {
+  geometry geo{128 << 20, 4096, 2 * n + 100, 0, ALLOC_BITMAP};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  use_dir_index = index;
+  use_dir_names = names;
+  CreateDir("d");
+  NextDir("d");
+
+  double t0 = now_ms();
+  for (int i = 0; i < n; ++i) {
+    CreateFile(("f" + std::to_string(i)).c_str());
+  }
+  double t1 = now_ms();
+  int found = 0;
+  for (int i = 0; i < n; ++i) {
+    found += Open(("f" + std::to_string(i)).c_str()) > 0;
+  }
+  double t2 = now_ms();
+
+  printf("[%s] %5d 项：建文件 %9.3f ms (%6.2f us/个)，查找 %9.3f ms (%6.2f us/次)，找到 %d\n",
+         index ? "散列索引" : (names ? "目录项带名字" : "老的目录项"), n, t1 - t0, (t1 - t0) * 1000 / n, t2 - t1,
+         (t2 - t1) * 1000 / n, found);
+  use_dir_index = true;
+  use_dir_names = true;
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  for (int n : SIZES) {
+    run(n, false, false);
+    run(n, true, false);
+    run(n, true, true);
+  }
+  const dirIndexStat *stat = GetDirIndexStat();
+  printf("索引查找 %lld 次，命中 %lld 次，建索引 %lld 次，分裂 %lld 次\n", stat->lookups, stat->hits,
+         stat->builds, stat->splits);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include "head.h"
+
+// 目录反复删了又建：目录里一直有 N 个文件，每一轮删掉九成再建同样多的新名字，
+// 对比复用空位加压缩和只追加。之后关掉索引和缓存，按顺序找不存在的名字，看要扫多少项。
+// 老的目录项按老镜像的方式映射块，最多 11 块，只追加时几轮之后就建不出文件了。
+constexpr int N = 1000;
+constexpr int ROUNDS = 20;
+constexpr int MISSES = 1000;
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string name(int round, int i) {
+  return std::to_string(round) + "_" + std::to_string(i);
+}
+
+static void run(bool old, bool slots) {
+  geometry geo{128 << 20, 4096, 2 * N + 100, 0, ALLOC_BITMAP};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  use_dir_names = !old;
+  use_extents = !old;
+  use_dir_slots = slots;
+  CreateDir("d");
+  NextDir("d");
+  const int d = current_dir_index;
+  for (int i = 0; i < N; ++i) {
+    CreateFile(name(0, i).c_str());
+  }
+
+  const dirSlotStat before = *GetDirSlotStat();
+  int rounds = 0;
+  bool full = false;
+  double t0 = now_ms();
+  for (int r = 1; r <= ROUNDS && !full; ++r, ++rounds) {
+    for (int i = 0; i < N; ++i) {
+      if (i % 10 != 0) {
+        DeleteFile(name(r - 1, i).c_str());
+      }
+    }
+    for (int i = 0; i < N && !full; ++i) {
+      if (i % 10 != 0) {
+        full = !CreateFile(name(r, i).c_str());
+      } else {
+        Rename(name(r - 1, i).c_str(), name(r, i).c_str());
+      }
+    }
+  }
+  double t1 = now_ms();
+
+  // 按顺序找不存在的名字，要扫整个目录
+  use_dir_index = false;
+  use_dentry_cache = false;
+  double t2 = now_ms();
+  for (int i = 0; i < MISSES; ++i) {
+    Open(("missing" + std::to_string(i)).c_str());
+  }
+  double t3 = now_ms();
+  use_dir_index = true;
+  use_dentry_cache = true;
+
+  const dirSlotStat *stat = GetDirSlotStat();
+  const int block_size = GetSuperBlock()->block_size;
+  printf("[%s%s] %d 轮 %9.2f ms，目录 %6d 项 %4d 块；顺序找 %d 次 %9.2f ms；"
+         "复用 %lld，压缩 %lld 次，搬动 %lld 项，还回 %lld 块%s\n",
+         old ? "老的目录项" : "带名字", slots ? "+空位" : "", rounds, t1 - t0, DirEntries(d),
+         (GetInode(d)->length + block_size - 1) / block_size, MISSES, t3 - t2,
+         stat->reused - before.reused, stat->compactions - before.compactions,
+         stat->moved - before.moved, stat->freed_blocks - before.freed_blocks,
+         full ? "，目录满了" : "");
+  use_dir_names = true;
+  use_extents = true;
+  use_dir_slots = true;
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  run(false, false);
+  run(false, true);
+  run(true, false);
+  run(true, true);
+  return 0;
+}
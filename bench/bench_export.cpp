@@ -0,0 +1,75 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 导出吞吐。负载：一个 256MB 的连续文件和一个每隔一块打一个洞的 64MB 稀疏文件，
+// 对比 Read 到 1MB 缓冲区再 write 和 Export，目标都是本地的普通文件。
+constexpr int CHUNK = 1 << 20;
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char *name, const char *how, long long bytes, double ms) {
+  printf("[%s] %-8s %.1f ms (%.1f MB/s)\n", name, how, ms, bytes / 1048576.0 / (ms / 1000));
+}
+
+static void run(const char *name, int index) {
+  const long long length = GetInode(index)->length;
+  std::vector<char> buf(CHUNK);
+  int out = open("bench_export.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  double t0 = now_ms();
+  for (long long pos = 0; pos < length; pos += CHUNK) {
+    const int len = Read(index, pos, std::min<long long>(CHUNK, length - pos), buf.data());
+    write(out, buf.data(), len);
+  }
+  double t1 = now_ms();
+  close(out);
+  report(name, "Read", length, t1 - t0);
+
+  const exportStat before = *GetExportStat();
+  out = open("bench_export.out", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  t0 = now_ms();
+  Export(index, out);
+  t1 = now_ms();
+  close(out);
+  report(name, "Export", length, t1 - t0);
+  const exportStat *stat = GetExportStat();
+  printf("    copy_file_range %lld KB，sendfile %lld KB，writev %lld KB，%lld 次系统调用\n",
+         (stat->copied - before.copied) >> 10, (stat->sent - before.sent) >> 10,
+         (stat->vectored - before.vectored) >> 10, stat->syscalls - before.syscalls);
+}
+
+int main() {
+  need_log = false;
+  geometry geo{1LL << 30, 4096, 0, 0, ALLOC_BITMAP};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+
+  std::vector<char> data(CHUNK);
+  for (int i = 0; i < CHUNK; ++i) {
+    data[i] = (char)(i * 131);
+  }
+  CreateFile("big");
+  int big = Open("big");
+  for (int pos = 0; pos < (256 << 20); pos += CHUNK) {
+    Write(big, pos, CHUNK, data.data());
+  }
+  CreateFile("sparse");
+  int sparse = Open("sparse");
+  for (int pos = 0; pos < (64 << 20); pos += 8192) {
+    Write(sparse, pos, 4096, data.data());
+  }
+  FlushBuffer();
+
+  run("连续", big);
+  run("稀疏", sparse);
+  remove("bench_export.out");
+  CloseFileSystem();
+  return 0;
+}
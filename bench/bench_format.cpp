@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "head.h"
+
+// 格式化耗时随镜像大小的变化：耗时、缓冲池系统调用次数、镜像实际占用的磁盘空间。
+// 最后用逐块 ReleaseDataBlock 的旧做法在默认镜像上做对照。
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void run(long long disk_size) {
+  geometry geo{disk_size, 0, 0, 0};
+  bufferStat before = *GetBufferStat();
+  double t0 = now_ms();
+  FormatFileSystem(root_path, &geo);
+  double t1 = now_ms();
+  bufferStat after = *GetBufferStat();
+
+  struct stat s;
+  stat(root_path, &s);
+  printf("[%6lld MB] format %9.3f ms, blocks %8d, syscalls %lld, allocated %lld KB\n",
+         disk_size >> 20, t1 - t0, GetSuperBlock()->block_count, after.syscalls - before.syscalls,
+         (long long)s.st_blocks * 512 / 1024);
+  CloseFileSystem();
+}
+
+static void run_release() {
+  FormatFileSystem(root_path);
+  superBlock *super = GetSuperBlock();
+  bufferStat before = *GetBufferStat();
+  double t0 = now_ms();
+  super->stack_num = 1;
+  super->stack[0] = 0;
+  for (int i = super->block_count - 1; i >= 1; --i) {
+    ReleaseDataBlock(i);
+  }
+  SyncBuffer();
+  double t1 = now_ms();
+  bufferStat after = *GetBufferStat();
+  printf("[逐块释放 %d 块] %9.3f ms, syscalls %lld\n", super->block_count, t1 - t0,
+         after.syscalls - before.syscalls);
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  for (long long size : {50LL << 20, 1LL << 30, 4LL << 30, 16LL << 30}) {
+    run(size);
+  }
+  run_release();
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 启动耗时：打开文件系统、登录并读一次根目录(相当于只执行一次 dir)所需的时间和常驻内存。
+// 每轮之前丢掉镜像的页缓存，模拟冷启动。全量读取一栏模拟以前打开时把整个镜像读进内存的做法。
+
+static double now_ms() {
+  using namespace std::chrono;
+  return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+static long long rss_kb() {
+  long long size = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f != nullptr) {
+    fscanf(f, "%lld %lld", &size, &resident);
+    fclose(f);
+  }
+  return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static void drop_cache() {
+  int f = open(root_path, O_RDONLY);
+  fdatasync(f);
+  posix_fadvise(f, 0, 0, POSIX_FADV_DONTNEED);
+  close(f);
+}
+
+static void run(const char *name, bool warm, bool eager) {
+  warm_up = warm;
+  drop_cache();
+  long long rss0 = rss_kb();
+
+  double t0 = now_ms();
+  OpenFileSystem(root_path);
+  std::vector<char> image;
+  if (eager) {
+    image.resize(GetSuperBlock()->disk_size);
+    pread(fd, image.data(), image.size(), 0);
+  }
+  double t1 = now_ms();
+
+  LogIn("root", "root");
+  int root = GetSuperBlock()->root_dir_id;
+  int len = 0;
+  std::vector<int> files(DirEntries(root) + 1);
+  ReadDir(root, &len, files.data());
+  double t2 = now_ms();
+
+  printf("[%s] open %8.3f ms, first dir %7.3f ms (%d entries), rss +%lld KB\n", name, t1 - t0,
+         t2 - t1, len, rss_kb() - rss0);
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+
+  // 1GB 镜像，根目录下 100 个文件，每个 64KB。
+  geometry geo{1LL << 30, 0, 0, 0};
+  FormatFileSystem(root_path, &geo);
+  LogIn("root", "root");
+  std::string content(64 << 10, 'x');
+  for (int i = 0; i < 100; ++i) {
+    std::string s = std::to_string(i);
+    CreateFile(s.c_str());
+    Append(Open(s.c_str()), content.size(), content.data());
+  }
+  CloseFileSystem();
+
+  run("按需缺页", false, false);
+  run("按需缺页+预热", true, false);
+  run("全量读取(旧做法)", false, true);
+  return 0;
+}
@@ -4,24 +4,61 @@
 #include <atomic>
 #include <set>
 #include <string>
+#include <vector>
 
 constexpr int MAX_NAME_LENGTH = 32;
 constexpr int MAX_PASSWD_LENGTH = 32;
 constexpr int INODE_SIZE = 128;
-constexpr int BLOCK_SIZE = 4096;                          // 数据块内容大小
-constexpr int DISK_SIZE = 50 * 1024 * 1024 + BLOCK_SIZE;  // 50MB 磁盘
-constexpr int MEM_SIZE = DISK_SIZE;  // 因为没有缓冲池，为了方便暂时内存 == 磁盘大小。
-
-constexpr int MAX_BLOCK_NUMBER = (DISK_SIZE - BLOCK_SIZE) / (INODE_SIZE + BLOCK_SIZE);
-constexpr int MAX_INODE_NUMBER = MAX_BLOCK_NUMBER;
-constexpr int INODE_OFFSET = BLOCK_SIZE;
-constexpr int DATA_BLOCK_OFFSET = MAX_BLOCK_NUMBER * INODE_SIZE + INODE_OFFSET;
+constexpr int SUPER_BLOCK_SIZE = 4096;  // 超级块固定 4KB，位于镜像开头
+constexpr int MIN_BLOCK_SIZE = 1024;
+constexpr int MAX_BLOCK_SIZE = 64 * 1024;
+constexpr int DEFAULT_BLOCK_SIZE = 4096;                            // 默认数据块大小
+constexpr long long DEFAULT_DISK_SIZE = 50 * 1024 * 1024 + 4096;  // 默认 50MB 磁盘
+constexpr int DEFAULT_JOURNAL_BLOCKS = 256;  // 默认日志区块数，第一块是日志头
+constexpr unsigned int SUPER_MAGIC = 0x4e455546;
+constexpr unsigned int JOURNAL_MAGIC = 0x4a524e4c;
+constexpr int GROUP_COMMIT_SIZE = 256;  // 攒够这么多个事务就组提交一次
+constexpr int DEFAULT_BYTES_PER_INODE = 4096;  // 默认每 4KB 空间一个 inode
+constexpr int FREE_GROUP_SIZE = 960;    // 超级栈最多的数量，小块时由块大小决定
+
 constexpr int MAX_FIRST_INDEX = 11;
-constexpr int MAX_SECOND_INDEX = BLOCK_SIZE / sizeof(int);
-constexpr int MAX_FILE_SIZE =
-    (MAX_FIRST_INDEX + MAX_SECOND_INDEX) * BLOCK_SIZE;  // 4239360 bytes == 4.04296875 MB
-constexpr int DIR_ENTRY_NUMBER = MAX_FIRST_INDEX * BLOCK_SIZE / sizeof(int);
 constexpr char root_path[] = "./MyFileSystem";
+constexpr int DEFAULT_BUFFER_SIZE = 1024;  // 缓冲池默认帧数
+constexpr int IO_QUEUE_DEPTH = 256;  // 写回后端最多同时在途的请求数
+constexpr int IO_BATCH_SIZE = 256;   // 攒够这么多个写就提交一次
+constexpr int IO_MAX_WRITE = 1 << 20;  // 相邻的写最多合并成这么大
+constexpr int DROP_BATCH = 16 << 20;   // 写回的文件内容攒够这么多字节就丢掉私有页
+constexpr int LOAD_CHUNK = 1 << 20;    // Load 每次从本地文件读这么多
+constexpr int EXPORT_KERNEL_RUN = 16;  // 导出时连续这么多块以上才用 copy_file_range/sendfile
+constexpr int EXPORT_ZERO = 1 << 16;   // 导出空洞用的零页大小
+constexpr int INODE_PAGE_SIZE = 4096;  // inode 表按页写回
+constexpr int IO_THREADS = 4;        // 线程池后端的线程数
+constexpr int DEFAULT_APPEND_SIZE = 64 * 1024;  // 追加缓存攒够这么多字节就写下去
+constexpr int DEFAULT_APPEND_DELAY = 100;       // 追加缓存最多攒这么多毫秒
+constexpr unsigned short REFCOUNT_DEDUP = 0x8000;  // 共享计数的最高位：块在去重索引里
+constexpr int MAX_SHARED = 0x7fff;                 // 共享计数的上限
+constexpr int DEDUP_PROBES = 16;  // 去重索引从指纹的位置起最多找这么多项
+constexpr int COMPRESS_CLUSTER = 16;  // 压缩文件按这么多块一簇压缩
+
+// 写回后端，只在 IO_PWRITE 下使用
+enum io_backend_type : int {
+  IO_BACKEND_SYNC = 0,  // 在调用者线程里逐个 pwrite
+  IO_BACKEND_URING,     // io_uring 批量提交，异步收割
+  IO_BACKEND_THREADS,   // 线程池 pwritev，内核没有 io_uring 时用
+  IO_BACKEND_AUTO,      // 优先 io_uring，不可用时退回线程池
+};
+
+// 磁盘读写方式
+enum io_type : int {
+  IO_PWRITE = 0,  // 映射为 MAP_PRIVATE，只有缓冲池 pwrite 写回的内容才进入文件，支持日志
+  IO_MMAP,        // 纯 mmap，只记录脏页，批量 msync
+};
+
+// 空闲块分配方式，格式化时选定
+enum alloc_type : int {
+  ALLOC_GROUP = 0,  // 成组链接，一次分配一块
+  ALLOC_BITMAP,     // 位图，可以分配连续的一段块
+};
 
 enum file_type : int {
   FILE_TYPE = 0,
@@ -30,8 +67,16 @@ enum file_type : int {
   USER_TYPE,
 };
 
+// inode 标志
+constexpr unsigned int INODE_EXTENTS = 1;  // 用区段树映射块，first_index 区域存树根
+constexpr unsigned int INODE_INTERNAL = 2;  // 内部的 inode：快照的旧版本和快照表、去重索引，不在目录里
+constexpr unsigned int INODE_COMPRESSED = 4;  // 按簇压缩存储，只用于区段树映射的普通文件
+constexpr unsigned int INODE_DIR_INDEX = 8;   // 目录有散列索引，和目录项一致
+constexpr unsigned int INODE_DIR_NAMES = 16;  // 目录项带名字(namedEntry)，老的目录项只有编号
+
 typedef struct inode {
-  file_type type;  // 文件类型
+  file_type type : 16;      // 文件类型
+  unsigned int flags : 16;  // INODE_* 标志，老的 inode 为 0
   int id;          // inode 的id。
   int length;      // 文件所占字节数
   int link_cnt;    // link_cnt，可拓展为目录也可链接。
@@ -44,58 +89,248 @@ typedef struct inode {
 
   char file_name[MAX_NAME_LENGTH];   // 文件名字
   char owner_name[MAX_NAME_LENGTH];  // 主人名字.
-  int first_index[MAX_FIRST_INDEX];  // 一级索引数据域，first_index[0] == id;
-  // 文件最大为：(MAX_FIRST_INDEX + MAX_SECOND_INDEX) * BLOCK_SIZE
-  // == (MAX_FIRST_INDEX + BLOCK_SIZE / sizeof(int)) * BLOCK_SIZE
-  // == MAX_FIRST_INDEX * BLOCK_SIZE + BLOCK_SIZE * BLOCK_SIZE / sizeof(int)
-  // == (1/4) * BLOCK_SIZE^2 + MAX_FIRST_INDEX * BLOCK_SIZE
+  int first_index[MAX_FIRST_INDEX];  // 一级索引数据域，0 表示还没分配；区段树时存树根
+  // 文件最大为：(MAX_FIRST_INDEX + block_size / sizeof(int)) * block_size，见 MaxFileSize
+  // 区段树映射的文件只受 int 长度限制，见 MAX_EXTENT_FILE_SIZE
 } inode;
 
+// 区段：逻辑块 [logical, logical + len) 映射到物理块 [start, start + len)。
+// 索引节点里的项复用这个结构，start 为子节点所在的块，len 不用。
+typedef struct extent {
+  int logical;           // 起始逻辑块
+  int start;             // 起始物理块
+  unsigned short len;    // 块数
+  unsigned short flags;  // 区段标志
+} extent;
+
+typedef struct extentHeader {
+  unsigned short entries;  // 节点中的项数
+  unsigned short depth;    // 0 为叶子
+} extentHeader;
+
+// 树根放在 inode 的 first_index 区域，其余节点各占一块：[extentHeader][extent...]
+constexpr int ROOT_EXTENTS =
+    (sizeof(int) * MAX_FIRST_INDEX - sizeof(extentHeader)) / sizeof(extent);
+constexpr int MAX_EXTENT_LEN = 0xffff;
+constexpr int EXTENT_UNWRITTEN = 1;  // 块已分配但还没写过，内容是旧数据，读出来按全零算
+constexpr int EXTENT_COMPRESSED = 2;  // 压缩簇：簇的前几块存 [压缩后长度][压缩数据]，其余块不映射
+constexpr int MAX_EXTENT_FILE_SIZE = 0x7fff0000;  // 区段树文件的最大字节数，按最大块对齐
+
 static_assert(sizeof(inode) == 128);
-static_assert(BLOCK_SIZE % INODE_SIZE == 0);
+static_assert(MIN_BLOCK_SIZE % INODE_SIZE == 0);
 
+// 块大小在格式化时决定，下面两个结构体只按最大块大小声明，用来做指针强转，不要按值使用。
 typedef struct dataBlock  // 数据块
 {
-  char content[BLOCK_SIZE];  // 数据块内容
+  char content[MAX_BLOCK_SIZE];  // 数据块内容，实际只有 block_size 字节
 } dataBlock;
-static_assert(sizeof(dataBlock) == BLOCK_SIZE);
 
 typedef struct indexBlock {
-  int data_block[(BLOCK_SIZE) /
-                 sizeof(int)];  // 二级索引块，指向数据块的编号。大小应该等于datablock
+  int data_block[MAX_BLOCK_SIZE / sizeof(int)];  // 二级索引块，指向数据块的编号，实际 block_size / 4 项
 } indexBlock;
 
-static_assert(sizeof(indexBlock) == BLOCK_SIZE);
-static_assert(sizeof(indexBlock) == sizeof(dataBlock));
+// 格式化参数。0 表示使用默认值。
+// 每一项都有默认值，写 geometry{size, block_size} 只给前几项也行，以后加的项不用改调用者
+typedef struct geometry {
+  long long disk_size = 0;             // 镜像大小，可以到几十 GB，文件是稀疏的，0 为默认大小
+  int block_size = 0;                  // 块大小，2 的幂，[MIN_BLOCK_SIZE, MAX_BLOCK_SIZE]，0 为默认
+  int inode_count = 0;                 // inode 数量，0 表示每 DEFAULT_BYTES_PER_INODE 字节一个
+  int journal_blocks = 0;              // 日志区块数，0 为默认
+  alloc_type allocator = ALLOC_GROUP;  // 空闲块分配方式
+  bool compress = false;               // 新建的普通文件是否压缩存储
+} geometry;
 
+// 磁盘组织：[superblock][journal][inode table][inode bitmap][inode epoch][block bitmap]
+// [refcount][data blocks]，各区域按块大小对齐。只有位图分配方式才有 block bitmap 区。
+// inode epoch 区每个 inode 一个 int，记录它最后一次为快照保留(或新建)时的纪元。
+// refcount 区每个数据块一个 unsigned short，低 15 位记录除第一个之外还有几个文件共享这一块，
+// 最高位表示块在去重索引里，全零表示都不共享，可以原地写。
+// 偏移都在格式化时算好存在超级块里，运行时 GetInode/GetBlock 根据它计算地址。
 typedef struct superBlock {
-  int user_info_id;  // 用户信息的节点。
-  int root_dir_id;   // 根目录的节点。
-  int stack_num;     // 超级栈的当前空闲数量
-  int stack[(BLOCK_SIZE - sizeof(root_dir_id) - sizeof(stack_num) - sizeof(user_info_id)) /
-            sizeof(int)];  // 超级栈
+  unsigned int magic;       // SUPER_MAGIC
+  int block_size;           // 块大小
+  long long disk_size;      // 镜像大小
+  int block_count;          // 数据块数量，编号 [1, block_count)
+  int inode_count;          // inode 数量，编号 [1, inode_count)，和数据块各自编号
+  int free_inodes;          // 空闲 inode 数
+  int free_blocks;          // 空闲数据块数
+  int journal_blocks;       // 日志区块数
+  int group_size;           // 成组链接每组的大小，受块大小限制
+  long long journal_offset;  // 日志区偏移
+  long long inode_offset;   // inode 表偏移
+  long long inode_bitmap_offset;  // inode 位图偏移，每个 inode 一位，1 表示已分配
+  long long epoch_offset;   // inode 纪元偏移
+  long long bitmap_offset;  // 数据块位图偏移，每块一位，1 表示已分配
+  long long refcount_offset;  // 数据块共享计数偏移
+  long long data_offset;    // 数据块区偏移
+  alloc_type allocator;     // 空闲块分配方式
+  int alloc_hint;           // 位图分配从这里开始找，顺序分配的块尽量连续
+  int inode_hint;           // inode 从这里开始找，先后创建的文件 inode 挨在一起
+  int free_tail;            // [free_tail, block_count) 从没分配过，不在成组链接里
+  int user_info_id;         // 用户信息的节点。
+  int root_dir_id;          // 根目录的节点。
+  int epoch;                // 当前纪元，每建一个快照加一
+  int snapshot_id;          // 快照表文件的节点，0 表示还没有快照
+  int dedup_id;             // 去重索引文件的节点，0 表示还没有用过去重
+  int compress;             // 新建的普通文件是否压缩存储
+  int stack_num;            // 超级栈的当前空闲数量
+  int stack[FREE_GROUP_SIZE];  // 超级栈，stack[0] 是成组链接的下一组。
 } superBlock;
-static_assert(sizeof(superBlock) == BLOCK_SIZE);
+static_assert(sizeof(superBlock) <= SUPER_BLOCK_SIZE);
 
+// 组长块的内容，和超级块最后的 stack_num、stack 布局相同。
 typedef struct freeBlock {
-  const int _;
-  const int __;  // 为了对齐superBlock;
   int stack_num;
-  int stack[(BLOCK_SIZE - sizeof(_) - sizeof(__) - sizeof(stack_num)) / sizeof(int)];
-  ;  // stack[0] 是成组链接的下一组。
+  int stack[FREE_GROUP_SIZE];  // stack[0] 是成组链接的下一组。
 } freeBlock;
-static_assert(sizeof(freeBlock) == BLOCK_SIZE);
 
+// 快照表文件的一项。map_id 文件里是 snapshotMap 数组：快照之后第一次修改 live 前，
+// 把它当时的样子保留成 copy
+typedef struct snapshotEntry {
+  char name[MAX_NAME_LENGTH];
+  int epoch;   // 快照时的纪元，纪元不大于它的 inode 属于这个快照
+  int map_id;  // 保留下来的 inode 的对照表
+} snapshotEntry;
+
+typedef struct snapshotMap {
+  int live;
+  int copy;
+} snapshotMap;
+
+// 去重索引的一项。索引是内部文件里的开放寻址哈希表，block 为 0 表示空位
+typedef struct dedupSlot {
+  unsigned long long hash;  // 块内容的指纹
+  int block;
+  int unused;
+} dedupSlot;
+
+// 老的目录项，名字在 inode 里
 typedef struct dirEntry {
   int file_id;
 } dirEntry;
 
+// 带名字的目录项，INODE_DIR_NAMES 的目录用。一项不跨块，块末尾放不下一项的地方空着；
+// 按顺序找、列目录只读目录块，不用碰每个文件的 inode。名字以目录项为准，
+// 同一个 inode 可以在不同的目录项里有不同的名字(硬链接)
+typedef struct namedEntry {
+  int file_id;                 // inode 编号，<= 0 表示已删除
+  unsigned int hash;           // 名字的散列，NameHash
+  unsigned char type;          // 文件类型
+  unsigned char name_len;      // 名字长度
+  char name[MAX_NAME_LENGTH];  // 名字，以 '\0' 结尾
+} namedEntry;
+constexpr int DIR_BATCH = 64;  // 按顺序扫目录时一次读这么多项
+
+// 目录的散列索引(可扩展散列)，放在目录内容之外的逻辑块上，只有区段树映射的目录才有。
+// 索引第 0 块是根：[dirIndexRoot][桶号 × 2^depth]，名字散列的高 depth 位选桶；
+// 第 k 块(k >= 1)是一个桶：[dirIndexBucket][dirIndexEntry...]。
+constexpr int DIR_INDEX_MIN = 32;  // 目录项达到这么多时第一次查找顺带建索引
+constexpr int DIR_UNINDEXED = -2;  // DirIndexFind 的返回值：目录没有索引
+constexpr int DENTRY_SLOTS = 4096;  // 目录项缓存的槽数，2 的幂
+constexpr int DENTRY_MISS = -2;     // DentryLookup 的返回值：缓存里没有
+constexpr int DIR_SLOT_DIRS = 1024;      // 最多记这么多个目录的空位，多了丢掉一个，用到时再扫
+constexpr int DIR_COMPACT_MIN = 16;      // 删掉的项至少这么多才压缩目录
+constexpr int DIR_COMPACT_PERCENT = 50;  // 删掉的项占目录项的百分比达到这么多才压缩
+
+typedef struct dirIndexRoot {
+  int depth;    // 根的位数
+  int buckets;  // 桶数，桶在索引的第 [1, buckets] 块
+} dirIndexRoot;
+
+typedef struct dirIndexBucket {
+  int depth;  // 桶里的项散列的高 depth 位都相同
+  int count;  // 项数
+} dirIndexBucket;
+
+typedef struct dirIndexEntry {
+  unsigned int hash;  // 名字的散列
+  int pos;            // 目录项的位置
+} dirIndexEntry;
+
 typedef struct userEntry {
   char user_name[MAX_NAME_LENGTH];
   char user_passwd[MAX_PASSWD_LENGTH];
   char parent[MAX_NAME_LENGTH];
 } userEntry;
 
+typedef struct bufferStat {
+  long long hits;         // Put 命中已有帧
+  long long misses;       // Put 未命中
+  long long write_backs;  // 实际写回磁盘的次数
+  long long evictions;    // 被淘汰的帧数
+  long long flushes;      // FlushBuffer 次数
+  long long syscalls;     // 写回产生的系统调用次数(pwrite/msync/fdatasync)
+  long long bytes_written;  // 写回的字节数
+  long long bytes_dropped;  // 落盘后丢掉的私有页字节数
+} bufferStat;
+
+typedef struct journalStat {
+  long long transactions;  // 提交的事务数
+  long long commits;       // 组提交次数，每次两个 fdatasync
+  long long records;       // 写进日志的记录数
+  long long bytes;         // 写进日志的字节数
+  long long checkpoints;   // 大操作中间提前的组提交次数
+  long long overflows;     // 一组超过日志区、只能直接写回的次数
+} journalStat;
+
+typedef struct ioStat {
+  long long requests;  // 提交给写回后端的写
+  long long writes;    // 相邻的合并之后实际发出的写，requests / writes 是合并比
+  long long batches;   // 提交的批数
+  long long syscalls;  // io_uring_enter / pwrite / pwritev 次数
+  long long bytes;     // 写的字节数
+  long long waits;     // 等待全部写完的次数
+} ioStat;
+
+typedef struct appendStat {
+  long long appends;       // 进了追加缓存的 Append 次数
+  long long flushes;       // 写下去的次数
+  long long bytes;         // 写下去的字节数
+  long long preallocated;  // 在写指针前面预分配的块数
+} appendStat;
+
+typedef struct dedupStat {
+  long long hashed;   // 算过指纹的块数
+  long long matched;  // 在索引里找到内容相同的块的次数，这些块不用写
+  long long indexed;  // 加进索引的块数
+} dedupStat;
+
+typedef struct compressStat {
+  long long compressed;  // 压缩存储的簇数
+  long long raw;         // 压不下去、原样存储的簇数
+  long long bytes_in;    // 压缩前的字节数，只算压缩存储的簇
+  long long bytes_out;   // 压缩后的字节数
+} compressStat;
+
+typedef struct exportStat {
+  long long copied;    // copy_file_range 拷的字节数
+  long long sent;      // sendfile 拷的字节数
+  long long vectored;  // writev 直接从映射写出的字节数，包括空洞的零
+  long long syscalls;  // 上面三种系统调用的次数
+} exportStat;
+
+typedef struct dirIndexStat {
+  long long lookups;  // 用索引查找的次数
+  long long hits;     // 其中找到的次数
+  long long builds;   // 建索引的次数
+  long long splits;   // 桶分裂的次数
+  long long drops;    // 放不下或目录删得只剩几项、去掉索引的次数
+} dirIndexStat;
+
+typedef struct dentryStat {
+  long long hits;           // 命中，缓存着找到的文件
+  long long negatives;      // 命中，缓存着没有这个名字
+  long long misses;         // 没命中，要查目录
+  long long invalidations;  // 增删、改名、删目录时改掉或丢掉的缓存项
+} dentryStat;
+
+typedef struct dirSlotStat {
+  long long reused;       // 新的目录项放进删掉的项留下的空位的次数
+  long long compactions;  // 压缩目录的次数
+  long long moved;        // 压缩时搬到前面的目录项数
+  long long freed_blocks;  // 压缩后还回的目录块数
+} dirSlotStat;
+
 typedef struct context {
   std::atomic<bool> flag;  // 是否初始化
   sem_t mutex;             // 互斥锁，保证多进程访问共享内存的安全
@@ -109,6 +344,17 @@ extern int fd;                   // 文件描述符，用于访问磁盘文件 
 extern char *memory;             // 多进程共享内存 定义在disk.cpp
 extern const char *TYPE2NAME[];  // 文件类型名称数组 定义在directory.cpp
 extern bool need_log;            // 是否需要打印日志，定义在disk.cpp中
+extern io_type io_mode;          // 磁盘读写方式，打开文件系统前设置，定义在disk.cpp中
+extern bool use_journal;         // 是否开启日志，只在 IO_PWRITE 下生效，定义在journal.cpp中
+extern bool use_extents;         // 新建的文件是否用区段树映射，定义在file.cpp中
+extern bool use_dir_names;       // 新建的目录是否用带名字的目录项，定义在file.cpp中
+extern bool discard_blocks;      // 释放的块是否在落盘后打洞还给宿主文件系统，定义在disk.cpp中
+extern bool dedup_blocks;        // Write 写整块时是否按内容去重，定义在dedup.cpp中
+extern bool use_dir_index;       // 查找目录时是否用散列索引，定义在dirindex.cpp中
+extern bool use_dentry_cache;    // 查找目录时是否先查目录项缓存，定义在dcache.cpp中
+extern bool use_dir_slots;       // 新目录项是否先用空位、删多了是否压缩目录，定义在dirslot.cpp中
+extern io_backend_type io_backend;  // 写回后端，打开文件系统前设置，定义在io.cpp中
+extern bool warm_up;             // 打开时是否预取超级块、根目录和用户表，定义在disk.cpp中
 /* -------------------全局变量--------------------- */
 
 // 一个简单的宏，用来打印日志。
@@ -118,43 +364,258 @@ extern bool need_log;            // 是否需要打印日志，定义在disk.cpp
   }
 
 /* -------------------磁盘操作--------------------- */
-extern bool FormatFileSystem(const char *file);  //  格式化文件系统
+//  格式化文件系统，geo 为空时使用默认的 50MB 几何
+extern bool FormatFileSystem(const char *file, const geometry *geo = nullptr);
 extern bool OpenFileSystem(const char *file);    // 打开文件系统
 extern bool CloseFileSystem();                   // 关闭文件系统
+extern void RefreshFileSystem();                 // 重新看到其他进程写回的内容
+extern int MaxFileSize();                        // 当前块大小下文件的最大字节数
 extern superBlock *GetSuperBlock();              // 获取超级块
 extern inode *GetInode(int index);               // 获取索引节点
 extern dataBlock *GetBlock(int index);           // 获取数据块
 extern indexBlock *GetIndexBlock(int index);     // 获取二级索引块
 extern void PutBlock(int index, bool write);     // 写入数据块
+extern void PutDataBlock(int index, bool write); // 写入普通文件的内容块，不进日志
 extern void PutInode(int index, bool write);     // 写入索引节点
 extern void PutSuperBlock(bool write);           // 写入超级块
-extern int AllocDataBlock();                     // 分配数据编号
-extern void ReleaseDataBlock(int index);         // 释放数据编号
+extern int AllocInode();                         // 分配 inode 编号，和数据块编号无关
+extern void ReleaseInode(int index);             // 释放 inode 编号
+extern int AllocDataBlock();                     // 分配数据编号，块不清空
+// 分配最多 n 块连续的数据块，len 返回实际块数，失败返回 0。成组链接一次只能给一块。
+extern int AllocExtent(int n, int *len);
+// 释放数据编号，只改元数据。块被共享时只减共享计数，最后一个使用者释放时才真正空闲
+extern void ReleaseDataBlock(int index);
+extern bool ShareDataBlock(int index);  // 多一个文件共享这一块，计数满了返回 false
+extern int DataBlockRefs(int index);    // 使用这一块的文件数，没共享为 1
+extern bool DataBlockShared(int index);  // 块被共享或在去重索引里，写之前要复制一份
+extern void MarkDedupBlock(int index);   // 标记块已加进去重索引，释放时从索引里去掉
+// discard_blocks 时把释放后仍空闲的块在镜像文件上打洞，SyncBuffer 落盘后调用，返回打洞的块数
+extern int DiscardBlocks();
 // extern void FlushDisk();
 /* -------------------磁盘操作--------------------- */
 
+/* -------------------位图------------------------- */
+extern void BitmapInit();                       // 格式化时初始化位图，0 号 inode 和块保留
+extern int BitmapAlloc(int n, int *len);        // 找一段最多 n 块的连续空闲块并标记为已分配
+extern void BitmapRelease(int index);           // 标记为空闲
+extern bool BitmapUsed(int index);              // 块是否已分配
+extern int InodeBitmapAlloc();                  // 在 inode 位图中分配一个编号
+extern void InodeBitmapRelease(int index);      // 归还 inode 编号
+extern bool InodeUsed(int index);               // inode 是否已分配
+extern void InodeBitmapUse(int index);          // 把指定的空闲 inode 编号标记为已分配
+/* -------------------位图------------------------- */
+
+/* -------------------缓冲池----------------------- */
+// 标记磁盘 [offset, offset + length) 被访问，dirty 表示需要写回，journal 表示是元数据需要进日志
+extern void BufferPut(long long offset, int length, bool dirty, bool journal = true);
+extern void FlushBuffer();                   // 把所有脏帧写回磁盘，IO_MMAP 下为 MS_ASYNC
+extern void SyncBuffer();                    // 写回并等待落盘，持久化的刷新点
+extern void SetBufferSize(int size);         // 设置缓冲池帧数
+extern void ResetBuffer();                   // 丢弃所有帧，打开或格式化时调用
+extern const bufferStat *GetBufferStat();    // 缓冲池统计信息
+extern bool BufferFull();                    // 等待日志的帧太多，超出了缓冲池大小
+// 收集所有等待日志的帧，按偏移排序
+extern void BufferLogged(std::vector<std::pair<long long, int>> *ranges);
+extern void BufferWriteBack(bool logged);    // 写回等待日志(logged)或者不需要日志的脏帧
+extern long long BufferLoggedBytes(int *count);  // 等待日志的字节数，count 返回帧数
+extern void BufferDropClean();  // 写回后端写完之后调用，丢掉已经落盘的文件内容私有页
+/* -------------------缓冲池----------------------- */
+
+/* -------------------日志------------------------- */
+extern bool JournalActive();      // 当前是否在记日志
+extern void BeginTransaction();   // 开始事务，可以嵌套
+extern void CommitTransaction();  // 提交事务，攒够一组再真正写日志
+extern bool FlushJournal();       // 立刻组提交，一组装不进日志区时直接写回并返回 false
+// 大操作在中间一致的地方调用：这一组快装不下日志区时提前组提交，之前的改动先持久化
+extern void JournalCheckpoint();
+extern bool ReplayJournal();      // 打开时重放已提交的日志
+extern void ClearJournal();       // 作废日志头，干净关闭时调用
+extern const journalStat *GetJournalStat();
+
+// 作用域内的事务，构造时开始，析构时提交，避免提前 return 漏掉提交。
+struct transaction {
+  transaction() { BeginTransaction(); }
+  ~transaction() { CommitTransaction(); }
+};
+/* -------------------日志------------------------- */
+
+/* -------------------写回后端------------------- */
+extern void IoOpen();   // 按 io_backend 建立写回后端，格式化和打开文件系统时调用
+extern void IoClose();  // 等所有写完成后关闭
+// 把 buf 的内容写到镜像的 offset 处。内容会拷一份，调用者不用等写完，之后可以随意修改 buf
+extern void IoWrite(long long offset, const char *buf, int len);
+extern void IoSubmit();  // 把攒着的写提交出去，不等完成
+extern void IoWait();    // 等所有写完成，之后其他进程读文件能看到这些内容
+extern void IoSync();    // IoWait 之后 fdatasync，持久化点
+extern const char *IoBackendName();
+extern const ioStat *GetIoStat();
+/* -------------------写回后端------------------- */
+
+/* -------------------区段树--------------------- */
+// 第 logical 块映射到的物理块，len 返回从 logical 开始连续的块数，flags 返回区段标志，
+// 没有映射返回 0
+extern int ExtentLookup(const inode *n, int logical, int *len, int *flags = nullptr);
+// 把 [logical, logical + len) 映射到 [start, start + len)，覆盖原有映射，旧块不释放
+extern bool ExtentMap(inode *n, int logical, int start, int len, int flags = 0);
+// 去掉 [logical, logical + len) 的映射并释放这些块
+extern bool ExtentUnmap(inode *n, int logical, int len);
+// logical 起(含)第一个有映射的块，没有返回 -1
+extern int ExtentNext(const inode *n, int logical);
+extern void ExtentFree(inode *n);         // 释放所有数据块和树节点
+extern int ExtentCount(const inode *n);   // 叶子中的区段数
+extern int ExtentDepth(const inode *n);   // 树的层数，只有根为 0
+/* -------------------区段树--------------------- */
+
 /* -------------------文件操作--------------------- */
 // 在index文件的pos位置写入len字节buf内容，最通用的写方法
 extern int Write(int index, int pos, int len, const char *buf);
 // 在index文件的末尾追加len字节buf内容，基于write实现
 extern int Append(int index, int len, const char *buf);
-// 在index文件的pos位置读取len字节到buf中，最通用的读方法
+// 在index文件的pos位置读取len字节到buf中，最通用的读方法。空洞读出全零，不分配块
 extern int Read(int index, int pos, int len, char *buf);
+// 相当于 lseek 的 SEEK_DATA / SEEK_HOLE：pos 起(含)第一个有数据 / 空洞的位置，
+// 文件末尾算一个空洞。pos 不小于文件长度，或之后没有数据时返回 -1
+extern int SeekData(int index, int pos);
+extern int SeekHole(int index, int pos);
+// 把文件的全部内容写到本地的 out，连续的段在内核里直接从镜像拷过去，其余的从映射 writev。
+// 从 out 的当前位置开始写，返回文件长度，失败返回 -1
+extern long long Export(int index, int out);
+// 目录散列索引的第 k 块，在目录内容之外的逻辑块上，老的索引方式的目录没有。
+// write 时没有就分配一块清零的，和快照共享的先复制一份，改完由调用者 PutBlock
+extern dataBlock *DirIndexBlock(int dir, int k, bool write, int *b);
+extern void DirIndexFree(int dir);  // 释放目录散列索引的所有块
+extern const exportStat *GetExportStat();
 // 在index文件的pos下标读取size的项到buf中，基于read实现，把一个文件看作一个数组
 extern int ReadEntry(int index, int pos, int size, char *buf);
 // 在index文件的pos下标写入size的项到buf中，基于write实现，把一个文件看作一个数组
 extern int WriteEntry(int index, int pos, int size, const char *buf);
+// 目录 dir 的目录项数，包括删掉的。两种目录项都当作 namedEntry 读写，
+// 老的目录项读出来时从 inode 里补上名字和类型，写的时候只写编号
+extern int DirEntries(int dir);
+// 读 [pos, pos + count) 项，返回读到的项数。带名字的目录项每块只读一次
+extern int ReadDirEntries(int dir, int pos, int count, namedEntry *out);
+// 写第 pos 项，pos 等于 DirEntries 时追加
+extern bool WriteDirEntry(int dir, int pos, const namedEntry *e);
+// 按 inode 编号和名字填好目录项，file_id <= 0 时是删除标记
+extern void FillDirEntry(namedEntry *e, int file_id, const char *name);
+// 把目录截短到只剩前 count 项，释放后面用不到的块，散列索引的块不动
+extern bool TruncateDir(int dir, int count);
+// 为 [pos, pos + len) 预先分配块，不改变文件长度，相当于 fallocate(FALLOC_FL_KEEP_SIZE)。
+// 区段树文件的块标记为未写，不清零
+extern bool Fallocate(int index, int pos, int len);
+// 还回第 [begin, end) 块，不改变文件长度，不检查权限。用来还回预分配了却没用上的块
+extern void ReleaseBlocks(int index, int begin, int end);
+// 追加缓存：打开的普通文件的小追加先攒在内存里，同时缓存权限检查的结果，
+// 攒够 size 字节或第一笔攒了超过 delay 毫秒才写进块，并在写指针前面预分配块。size 为 0 时关闭
+extern void SetAppendCache(int size, int delay);
+extern void FlushAppend(int index);  // 把攒着的追加写下去，index <= 0 时写所有文件
+extern void DropAppend(int index);   // 写下去并释放多预分配的块，关闭文件时调用，index <= 0 时全部
+extern const appendStat *GetAppendStat();
+// 让空文件 dst 和 src 共享所有数据块(reflink)，块只在其中一个被写时才复制，不占额外空间
+extern bool Reflink(int src, int dst);
+// 和 Reflink 一样，但 src 就是 inode 本身，不跟随链接，也不写下追加缓存
+extern bool CloneBlocks(const inode *src, inode *dst);
+// 离线去重：文件已写的块逐块查去重索引，和已有块内容相同的改为共享，返回省下的块数
+extern int DedupFile(int index);
 // 新建一个文件，返回文件的索引编号
 extern int NewFile(file_type type, const char *file_name, const char *owner_name);
 extern bool RemoveFile(int index);  // 从文件系统删除一个文件index，返回是否成功
+// 文件第 i 块对应的物理块，不分配；len 不为空时返回从 i 开始物理连续的块数，
+// flags 不为空时返回 EXTENT_UNWRITTEN 等标志，这一段块的标志相同
+extern int LookupBlock(const inode *n, int i, int *len = nullptr, int *flags = nullptr);
 /* -------------------文件操作--------------------- */
 
+/* -------------------快照------------------------- */
+// 快照只记下当前纪元，O(1)。之后 inode 第一次被修改前由 PreserveInode 复制一份 inode，
+// 数据块和目录块按 reflink 共享，写时复制。快照是只读的，只有 root 可以建立和回滚。
+extern int *InodeEpoch(int index);         // inode 的纪元，改了之后要 PutEpoch
+extern void PutEpoch(int index);
+extern void PreserveInode(int index);      // 修改 inode 或文件内容之前调用
+extern bool CreateSnapshot(const char *name);
+extern void ShowSnapshots();
+// 快照中 index 号 inode 对应的 inode(保留下来的旧版本或者没改过的当前版本)，不存在返回 -1
+extern int SnapshotInode(const char *name, int index);
+// 快照中路径 path(从根目录开始，/ 分隔)对应的 inode，不存在返回 -1
+extern int SnapshotLookup(const char *name, const char *path);
+extern void SnapshotList(const char *name, const char *path);  // 显示快照中目录的内容
+extern void SnapshotRead(const char *name, const char *path);  // 显示快照中文件的内容
+// 把整个文件系统回滚到快照，之后的快照全部丢掉
+extern bool RollbackSnapshot(const char *name);
+extern void ResetSnapshots();  // 打开、格式化、刷新文件系统后丢掉内存中的快照表
+/* -------------------快照------------------------- */
+
+/* -------------------压缩------------------------- */
+// LZ77 家族的块压缩，格式和 LZ4 块格式类似。压缩结果超过 limit 时放弃，返回 0
+extern int LzCompress(const char *src, int len, char *dst, int limit);
+// 解压到 dst，返回解压出的字节数，数据损坏或 dst 放不下时返回 -1。
+// dst 在解压出的字节之后、capacity 以内的部分可能被改写
+extern int LzDecompress(const char *src, int len, char *dst, int capacity);
+// 压缩文件按 COMPRESS_CLUSTER 块一簇读改写。压得下的簇只占存放压缩数据的几块，
+// 压不下去的簇原样存储，和普通文件的块一样读写
+extern bool SetCompression(int index, bool on);  // 只能对区段树映射的空文件设置
+extern const compressStat *GetCompressStat();
+extern void ResetClusterCache();  // 打开、格式化、刷新文件系统后丢掉解压缓存
+/* -------------------压缩------------------------- */
+
+/* -------------------目录索引--------------------- */
+// 目录项的增删改都要同步到索引；目录没有索引时这些函数什么都不做
+extern unsigned int NameHash(const char *name);
+// 在目录 dir 中找名字，返回 inode 编号，pos 返回目录项的位置；找不到返回 -1，没有索引返回
+// DIR_UNINDEXED
+extern int DirIndexFind(int dir, const char *name, int *pos = nullptr);
+extern void DirIndexAdd(int dir, const char *name, int pos);
+extern void DirIndexRemove(int dir, const char *name, int pos);
+extern bool DirIndexBuild(int dir);  // 按现有的目录项建索引
+extern void DirIndexDrop(int dir);   // 去掉索引，目录退回按顺序查找
+extern const dirIndexStat *GetDirIndexStat();
+/* -------------------目录索引--------------------- */
+
+/* -------------------目录项缓存------------------- */
+// 按 (目录, 名字) 缓存查找的结果，file_id 为 -1 表示没有这个名字。
+// 查找返回 inode 编号或 -1，pos 返回目录项的位置；缓存里没有返回 DENTRY_MISS
+extern int DentryLookup(int dir, const char *name, int *pos);
+// 查完目录或目录项增删改名之后记下结果，顶掉同一个槽里原来的项
+extern void DentrySet(int dir, const char *name, int file_id, int pos);
+extern void DentryForgetDir(int dir);  // 目录删掉了，丢掉它下面的所有项
+extern void ResetDentryCache();        // 打开、格式化、刷新文件系统和回滚快照后清空
+extern const dentryStat *GetDentryStat();
+/* -------------------目录项缓存------------------- */
+
+/* -------------------目录空位--------------------- */
+// 删掉的目录项留下的空位在内存里按目录记着，第一次用到一个目录时扫一遍。
+// 新的目录项先放进最前面的空位，没有才追加；删掉的项够多时把末尾的项搬进前面的空位，
+// 截短目录、还回后面的块，同时改索引和目录项缓存里的位置。
+// 目录 dir 里放新目录项的位置：最前面的空位，没有空位时是 DirEntries(dir)
+extern int DirSlotTake(int dir);
+extern void DirSlotFree(int dir, int pos);  // 第 pos 项删掉了，记成空位
+// 删掉的项达到 DIR_COMPACT_MIN 个和 DIR_COMPACT_PERCENT% 时压缩目录，返回是否压缩了
+extern bool CompactDir(int dir);
+extern void DirSlotForget(int dir);  // 目录删掉了，丢掉它的空位
+extern void ResetDirSlots();         // 打开、格式化、刷新文件系统和回滚快照后清空
+extern const dirSlotStat *GetDirSlotStat();
+/* -------------------目录空位--------------------- */
+
+/* -------------------去重------------------------- */
+// 去重索引按块内容的指纹找内容相同的块，找到后还要逐字节比较，指纹冲突不会错误共享。
+// 在索引里的块写之前都要复制，内容不会变；块释放时按内容算出位置从索引里去掉。
+extern unsigned long long BlockHash(const char *data, int len);
+// 找内容和 data 相同的块，没有返回 0；hash 返回 data 的指纹
+extern int DedupFind(const char *data, unsigned long long *hash);
+extern void DedupInsert(unsigned long long hash, int block);  // 把刚写好的块加进索引
+extern void DedupForget(int block);  // 块要释放了，从索引里去掉
+extern int DedupAll();               // 对所有文件做离线去重，返回省下的块数
+extern const dedupStat *GetDedupStat();
+/* -------------------去重------------------------- */
+
 /* -------------------文件夹操作------------------- */
+// 下面的文件名和目录名都可以是路径：以 / 开头的从根目录找，否则从当前目录找，可以带 . 和 ..
+// 解析路径，返回对应的 inode 编号，不存在返回 -1。不改变当前目录
+extern int ResolvePath(const char *path);
 // 创建一个文件
 extern bool CreateFile(const char *file_name);
-// 在当前目录下打开一个文件，pos表示在目录数据项中的位置
+// 打开一个文件，pos表示在所在目录数据项中的位置
 extern int Open(const char *file_name, int *pos = nullptr);
-// 在当前目录下打开一个文件，返回文件的索引编号，插入进open_file集合中
+// 打开一个文件，返回文件的索引编号，插入进open_file集合中
 extern int OpenFile(const char *file_name);
 // 关闭一个文件，返回是否成功，从open_file集合中删除
 extern bool CloseFile(const char *file_name);
@@ -162,21 +623,21 @@ extern bool CloseFile(const char *file_name);
 extern bool DeleteFile(const char *file_name);
 // 删除一个目录，返回是否成功，基于DeleteFile和RemoveFile实现
 extern bool DeleteDir(const char *dir_name);
-// 在当前目录下创建一个目录，返回是否成功
+// 创建一个目录，返回是否成功
 extern bool CreateDir(const char *dir_name);
-// 在当前目录下进入一个目录，返回是否成功
+// 进入一个目录，返回是否成功
 extern bool NextDir(const char *dir_name);
 // 读取指定目录项index的所有项进files文件，len和files为返回值
 extern bool ReadDir(int index, int *len, int *files);
-// 显示当前目录下的内容
-extern void ShowDir();
+// 显示目录下的内容，path 为空时显示当前目录
+extern void ShowDir(const char *path = nullptr);
 // 返回上一级目录
 extern bool LastDir();
 // 返回当前目录的名字
 extern const char *NowDir();
 // 返回当前目录的绝对路径
 extern std::string GetPath();
-// 重命名
+// 重命名，只能改名不能换目录
 extern bool Rename(const char *old_name, const char *new_name);
 // 移动文件到指定目录，返回是否成功
 extern bool Move(const char *file, const char *dir);
@@ -209,8 +670,12 @@ extern void ReadFile(const char *file);
 extern bool LogIn(const char *name = nullptr, const char *passwd = nullptr);
 // 硬链接
 extern bool Link(const char *src, const char *dst);
-// 将本地文件系统的文件导入至该文件系统
+// 将本地文件系统的文件追加到该文件系统的文件后面，分段流式导入，打印吞吐
 extern bool Load(const char *src, const char *file);
+// 把多个本地文件导入到当前目录，文件名取路径最后一段，没有就新建，返回导入成功的个数
+extern int LoadFiles(int count, const char *const *srcs);
+// 把文件导出到本地文件系统的 dst，已有的会被覆盖
+extern bool ExportFile(const char *file, const char *dst);
 /* -------------------命令------------------------- */
 
 #endif  // __HEAD__
\ No newline at end of file
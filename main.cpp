@@ -3,6 +3,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <iostream>
+#include <vector>
 #include "head.h"
 #include "print.h"
 
@@ -20,7 +21,7 @@ void print() {
 4. 重命名
 5. 移动
 6. 树状用户管理
-7. 随写随刷保证一致性
+7. 重做日志 + 组提交保证崩溃一致性
 8. 共享内存实现多进程共享
 9. 用信号量上超大粒度锁避免竞争
 */
@@ -28,11 +29,12 @@ void MainPage()  // 主页信息
 {
   PRINT_FONT_YEL;
   cout << "--------------------------command list-----------------------------\n";
+  cout << "---文件名和目录名都可以是路径，如 /a/b、../c、./d\n";
   cout << "---close file_name----------------关闭文件\n";
   cout << "---create file_name---------------建立文件\n";
   cout << "---deldir director_name-----------删除文件夹\n";
   cout << "---delfile file_name--------------删除文件\n";
-  cout << "---dir----------------------------显示当前目录中的目录和文件\n";
+  cout << "---dir [dir_name]-----------------显示目录中的目录和文件，默认当前目录\n";
   cout << "---cd dir_name -------------------改变当前目录\n";
   cout << "---mkdir director_name------------建立目录\n";
   cout << "---open file_name-----------------打开文件\n";
@@ -50,7 +52,16 @@ void MainPage()  // 主页信息
   cout << "---users--------------------------显示所有用户\n";
   cout << "---clear--------------------------清空屏幕\n";
   cout << "---load src_file dst_file---------从本地文件系统导入文件\n";
+  cout << "---import src_file...-------------导入多个本地文件到当前目录\n";
+  cout << "---export file_name dst_file------导出文件到本地文件系统\n";
   cout << "---log----------------------------开关日志\n";
+  cout << "---snapshot name------------------建立快照(仅root)\n";
+  cout << "---snapshots----------------------显示所有快照\n";
+  cout << "---snapls name path---------------显示快照中的目录，根目录为 /\n";
+  cout << "---snapcat name path--------------显示快照中的文件\n";
+  cout << "---rollback name------------------回滚到快照(仅root)\n";
+  cout << "---dedup--------------------------对所有文件做离线去重\n";
+  cout << "---compress file_name-------------把空文件设为压缩存储\n";
   cout << "---help---------------------------显示当前页面\n";
   PRINT_FONT_BLA;
 }
@@ -93,7 +104,20 @@ int main() {
     cout << "是否初始化文件系统，若初始化，则之前的信息将消失!  Y/N" << endl;
     cin >> ch;
     if (ch == 'Y' || ch == 'y') {
-      FormatFileSystem(root_path);
+      long long disk_mb = 0;
+      int allocator = 0;
+      int compress = 0;
+      geometry geo;
+      cout << "请输入 镜像大小(MB) 块大小(字节) inode数量 分配方式(0成组链接/1位图) "
+              "压缩(0/1)，0表示默认值"
+           << endl;
+      cin >> disk_mb >> geo.block_size >> geo.inode_count >> allocator >> compress;
+      geo.allocator = allocator == 1 ? ALLOC_BITMAP : ALLOC_GROUP;
+      geo.compress = compress == 1;
+      geo.disk_size = disk_mb << 20;
+      if (FormatFileSystem(root_path, &geo) == false) {
+        continue;
+      }
       break;
     } else {
       if (ch == 'N' || ch == 'n') {
@@ -132,6 +156,7 @@ int main() {
     string param;
 
     sem_wait(&mutex->mutex);
+    RefreshFileSystem();  // 看到其他进程的修改
     if (command == "help") {
       MainPage();
     } else if (command == "link") {
@@ -142,16 +167,17 @@ int main() {
       cin >> param;
       CreateDir(param.c_str());
     } else if (command == "dir") {
-      ShowDir();
-    } else if (command == "cd") {
-      cin >> param;
-      if (param == ".") {
-        ;  // do nothing.
-      } else if (param == "..") {
-        LastDir();
+      while (cin.peek() == ' ' || cin.peek() == '\t') {
+        cin.get();
+      }
+      if (cin.peek() == '\n' || !(cin >> param)) {
+        ShowDir();
       } else {
-        NextDir(param.c_str());
+        ShowDir(param.c_str());
       }
+    } else if (command == "cd") {
+      cin >> param;
+      NextDir(param.c_str());  // . 和 .. 也交给路径解析
     } else if (command == "create") {
       cin >> param;
       CreateFile(param.c_str());
@@ -167,10 +193,10 @@ int main() {
       cin >> temp;
       int fd = Open(param.c_str());
 
-      if (GetInode(fd)->type == DIR_TYPE) {
+      if (fd <= 0 || GetInode(fd)->type == DIR_TYPE) {
         fprintf(stderr, "文件不是文件类型。\n");
       } else {
-        Append(Open(param.c_str()), temp.size(), temp.c_str());
+        Append(fd, temp.size(), temp.c_str());
       }
     } else if (command == "write") {
       int x;
@@ -240,6 +266,56 @@ int main() {
       string src, dst;
       cin >> src >> dst;
       Load(src.c_str(), dst.c_str());
+    } else if (command == "export") {
+      string src, dst;
+      cin >> src >> dst;
+      ExportFile(src.c_str(), dst.c_str());
+    } else if (command == "import") {
+      // 读到行尾为止，换行留给下面的循环
+      vector<string> srcs;
+      while (true) {
+        while (cin.peek() == ' ' || cin.peek() == '\t') {
+          cin.get();
+        }
+        if (cin.peek() == '\n' || !(cin >> param)) {
+          break;
+        }
+        srcs.push_back(param);
+      }
+      vector<const char *> names;
+      for (const string &s : srcs) {
+        names.push_back(s.c_str());
+      }
+      cout << "导入" << LoadFiles(names.size(), names.data()) << "个文件" << endl;
+    } else if (command == "snapshot") {
+      cin >> param;
+      CreateSnapshot(param.c_str());
+    } else if (command == "snapshots") {
+      ShowSnapshots();
+    } else if (command == "snapls") {
+      string path;
+      cin >> param >> path;
+      SnapshotList(param.c_str(), path.c_str());
+    } else if (command == "snapcat") {
+      string path;
+      cin >> param >> path;
+      SnapshotRead(param.c_str(), path.c_str());
+    } else if (command == "rollback") {
+      cin >> param;
+      RollbackSnapshot(param.c_str());
+    } else if (command == "dedup") {
+      int saved = DedupAll();
+      const dedupStat *stat = GetDedupStat();
+      cout << "省下" << saved << "块，指纹" << stat->hashed << "块，命中" << stat->matched << "次"
+           << endl;
+    } else if (command == "compress") {
+      cin >> param;
+      int index = Open(param.c_str());
+      if (index > 0 && SetCompression(index, true)) {
+        const compressStat *stat = GetCompressStat();
+        cout << "已设为压缩存储，累计压缩" << stat->compressed << "簇，原样存储" << stat->raw
+             << "簇" << endl;
+      }
     } else if (command == "clear") {
       system("clear");
     } else if (command == "log") {
@@ -261,6 +337,7 @@ int main() {
       }
     }
 
+    FlushBuffer();  // 每条命令结束是一个刷新点
     sem_post(&mutex->mutex);
   }
 
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <algorithm>
+#include "head.h"
+
+// 位图分配器：每个对象一位，1 表示已分配，0 号永远保留。
+// 数据块位图(只有 ALLOC_BITMAP 才有)和 inode 位图共用这里的查找逻辑。
+// 查找按 64 位字进行：整字全满直接跳过，否则用 ctz 找到字里第一个需要的位。
+// 分配从 hint 开始首次适配，找到的第一段够长的连续空闲位就用；
+// 找不到就退而求其次，给出扫描过程中最长的一段，由调用者继续要剩下的。
+
+typedef unsigned long long word;
+constexpr int WORD_BITS = 64;
+
+// 一张位图在镜像中的位置
+typedef struct bitmapArea {
+  long long offset;  // 位图在镜像中的偏移，按块对齐
+  long long count;   // 位数
+  int *hint;         // 下次从这里开始找，存在超级块里
+} bitmapArea;
+
+static bitmapArea block_area() {
+  superBlock *super = GetSuperBlock();
+  return bitmapArea{super->bitmap_offset, super->block_count, &super->alloc_hint};
+}
+
+static bitmapArea inode_area() {
+  superBlock *super = GetSuperBlock();
+  return bitmapArea{super->inode_bitmap_offset, super->inode_count, &super->inode_hint};
+}
+
+static word *words(const bitmapArea &a) { return (word *)(memory + a.offset); }
+
+// 位图也是元数据，按块交给缓冲池，进日志。
+static void put_bits(const bitmapArea &a, long long begin, long long end) {
+  const int block_size = GetSuperBlock()->block_size;
+  const long long bits_per_block = (long long)block_size * 8;
+  for (long long b = begin / bits_per_block; b <= (end - 1) / bits_per_block; ++b) {
+    BufferPut(a.offset + b * block_size, block_size, true);
+  }
+}
+
+// 在 [from, limit) 中找第一个值为 used 的位，没有就返回 limit。
+static long long find_bit(const bitmapArea &a, long long from, long long limit, bool used) {
+  const word *w = words(a);
+  while (from < limit) {
+    word x = w[from / WORD_BITS];
+    if (!used) {
+      x = ~x;
+    }
+    x &= ~0ULL << (from % WORD_BITS);  // 去掉 from 之前的位
+
+    if (x != 0) {
+      return std::min(limit, from / WORD_BITS * WORD_BITS + __builtin_ctzll(x));
+    }
+    from = (from / WORD_BITS + 1) * WORD_BITS;
+  }
+  return limit;
+}
+
+// 把 [begin, end) 置为 used，整字的部分直接赋值。
+static void set_bits(const bitmapArea &a, long long begin, long long end, bool used) {
+  word *w = words(a);
+  for (long long i = begin; i < end;) {
+    long long bit = i % WORD_BITS;
+    long long n = std::min(end - i, WORD_BITS - bit);
+    word mask = n == WORD_BITS ? ~0ULL : ((1ULL << n) - 1) << bit;
+    if (used) {
+      w[i / WORD_BITS] |= mask;
+    } else {
+      w[i / WORD_BITS] &= ~mask;
+    }
+    i += n;
+  }
+  put_bits(a, begin, end);
+}
+
+static bool test_bit(const bitmapArea &a, long long index) {
+  return (words(a)[index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+}
+
+// 找一段最多 n 位的连续空闲位并置为已分配，len 返回实际长度。
+static long long alloc_bits(const bitmapArea &a, int n, int *len) {
+  const long long limit = a.count;
+  const long long hint = std::min<long long>(std::max(*a.hint, 1), limit);
+  long long best = 0;
+  long long best_len = 0;
+
+  // 先找 [hint, limit)，再绕回 [1, hint)
+  const long long ranges[2][2] = {{hint, limit}, {1, hint}};
+  for (auto &r : ranges) {
+    long long pos = r[0];
+    while (pos < r[1] && best_len < n) {
+      long long begin = find_bit(a, pos, r[1], false);
+      if (begin >= r[1]) {
+        break;
+      }
+
+      long long end = find_bit(a, begin, std::min(r[1], begin + n), true);
+      if (end - begin > best_len) {
+        best = begin;
+        best_len = end - begin;
+      }
+      pos = end;
+    }
+
+    if (best_len >= n) {
+      break;
+    }
+  }
+
+  *len = best_len;
+  if (best_len == 0) {
+    return 0;
+  }
+
+  set_bits(a, best, best + best_len, true);
+  *a.hint = best + best_len;
+  PutSuperBlock(true);
+  return best;
+}
+
+void BitmapInit() {
+  set_bits(inode_area(), 0, 1, true);
+  if (GetSuperBlock()->allocator == ALLOC_BITMAP) {
+    set_bits(block_area(), 0, 1, true);
+  }
+}
+
+bool BitmapUsed(int index) { return test_bit(block_area(), index); }
+
+int BitmapAlloc(int n, int *len) {
+  int ret = alloc_bits(block_area(), n, len);
+  if (ret == 0) {
+    LOG("块不足\n");
+  } else {
+    LOG("分配块[%d, %d)\n", ret, ret + *len);
+  }
+  return ret;
+}
+
+void BitmapRelease(int index) {
+  if (index <= 0 || index >= GetSuperBlock()->block_count) {
+    return;
+  }
+  set_bits(block_area(), index, index + 1, false);
+  LOG("释放块%d\n", index);
+}
+
+bool InodeUsed(int index) { return test_bit(inode_area(), index); }
+
+int InodeBitmapAlloc() {
+  int len = 0;
+  int ret = alloc_bits(inode_area(), 1, &len);
+  if (ret == 0) {
+    LOG("inode不足\n");
+  } else {
+    --GetSuperBlock()->free_inodes;
+    LOG("分配inode%d\n", ret);
+  }
+  return ret;
+}
+
+void InodeBitmapUse(int index) {
+  if (index <= 0 || index >= GetSuperBlock()->inode_count || InodeUsed(index)) {
+    return;
+  }
+  set_bits(inode_area(), index, index + 1, true);
+  --GetSuperBlock()->free_inodes;
+  PutSuperBlock(true);
+}
+
+void InodeBitmapRelease(int index) {
+  if (index <= 0 || index >= GetSuperBlock()->inode_count || !InodeUsed(index)) {
+    return;
+  }
+  set_bits(inode_area(), index, index + 1, false);
+  ++GetSuperBlock()->free_inodes;
+  PutSuperBlock(true);
+  LOG("释放inode%d\n", index);
+}
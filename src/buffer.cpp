@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+#include <vector>
+#include "head.h"
+
+// 缓冲池：位于 disk 和 file 之间。
+// 内存和磁盘一对一映射，所以帧本身不再拷贝一份数据，只记录 [offset, offset + length) 这段内容的状态。
+// Put* 只把帧标记为脏，真正的写回推迟到 被淘汰 或者 FlushBuffer 的时候，由 io.cpp 的后端异步完成。
+// 同一个块被反复修改，只会写回一次。淘汰采用 CLOCK 算法。
+// IO_MMAP 模式下映射本身就是 MAP_SHARED 的文件页，写回不再 pwrite，
+// 而是记录脏页范围，等到刷新点合并相邻页后批量 msync。
+// 开启日志时，元数据帧会被标记为 logged，必须先写进日志才能写回原位，所以不能被淘汰。
+// IO_PWRITE 下映射是私有的，写过的页都成了匿名内存。写回过的文件内容块记下来，等写回后端写完
+// 就丢掉这些私有页，之后访问时重新从文件缺页，内存占用不随写过的字节数增长。
+
+typedef struct bufferFrame {
+  long long offset;  // 帧在磁盘中的偏移，也是哈希表的键
+  int length;        // 帧的长度，inode 表为一整页，块为 block_size
+  bool dirty;        // 是否需要写回
+  bool ref;          // CLOCK 的访问位
+  bool logged;       // 元数据修改还没写进日志，写回前必须先组提交
+  bool data;         // 普通文件的内容块，写回落盘后可以丢掉私有页
+} bufferFrame;
+
+static std::vector<bufferFrame> frames;
+static std::unordered_map<long long, int> frame_table;  // offset -> frames 下标
+static int clock_hand = 0;
+static int buffer_size = DEFAULT_BUFFER_SIZE;
+static bufferStat buffer_stat;
+static std::vector<std::pair<long long, long long>> dirty_pages;  // IO_MMAP 待 msync 的页范围
+static int logged_frames = 0;      // 等待日志的帧数
+static long long logged_bytes = 0;  // 等待日志的字节数
+static std::vector<std::pair<long long, int>> clean;  // 写回过、等落盘后丢掉私有页的内容块
+static long long clean_bytes = 0;
+
+// 把一个帧写回磁盘。
+static void write_back(bufferFrame *f) {
+  if (!f->dirty) {
+    return;
+  }
+
+  LOG("写回[%lld, %d]\n", f->offset, f->length);
+  if (f->logged) {
+    --logged_frames;
+    logged_bytes -= f->length;
+  }
+  f->dirty = false;
+  f->logged = false;
+  ++buffer_stat.write_backs;
+
+  if (io_mode == IO_MMAP) {
+    static const long long page = sysconf(_SC_PAGESIZE);
+    long long begin = f->offset / page * page;
+    long long end = (f->offset + f->length + page - 1) / page * page;
+    dirty_pages.emplace_back(begin, end);
+    return;
+  }
+
+  IoWrite(f->offset, memory + f->offset, f->length);  // 交给写回后端，不等写完
+  buffer_stat.bytes_written += f->length;
+  if (f->data) {
+    clean.emplace_back(f->offset, f->length);
+    clean_bytes += f->length;
+  }
+}
+
+// 按磁盘位置顺序写回脏帧，相邻的块进入同一批，写回后端才能把它们合并成一次写。
+static void write_back_sorted(bool all, bool logged) {
+  std::vector<bufferFrame *> dirty;
+  for (auto &f : frames) {
+    if (f.dirty && (all || f.logged == logged)) {
+      dirty.push_back(&f);
+    }
+  }
+  std::sort(dirty.begin(), dirty.end(),
+            [](const bufferFrame *a, const bufferFrame *b) { return a->offset < b->offset; });
+  for (bufferFrame *f : dirty) {
+    write_back(f);
+  }
+}
+
+// 合并相邻或重叠的脏页，每段一次 msync。
+static void sync_pages(bool sync) {
+  if (dirty_pages.empty()) {
+    return;
+  }
+
+  std::sort(dirty_pages.begin(), dirty_pages.end());
+  long long begin = dirty_pages[0].first;
+  long long end = dirty_pages[0].second;
+
+  auto flush = [&]() {
+    int ret = msync(memory + begin, end - begin, sync ? MS_SYNC : MS_ASYNC);
+    assert(ret == 0);
+    ++buffer_stat.syscalls;
+    buffer_stat.bytes_written += end - begin;
+  };
+
+  for (auto &r : dirty_pages) {
+    if (r.first > end) {
+      flush();
+      begin = r.first;
+    }
+    end = std::max(end, r.second);
+  }
+  flush();
+  dirty_pages.clear();
+}
+
+// 丢掉已经落盘的内容块的私有页，调用前写回后端必须已经写完。只丢整页都是写回过、
+// 之后又没有变脏的内容块的页，和元数据或者还没写回的块共用的页留着。
+void BufferDropClean() {
+  if (clean.empty()) {
+    return;
+  }
+
+  static const long long page = sysconf(_SC_PAGESIZE);
+  std::sort(clean.begin(), clean.end());
+  long long begin = 0;
+  long long end = 0;
+
+  auto drop = [&]() {
+    long long b = (begin + page - 1) / page * page;
+    long long e = end / page * page;
+    if (b < e) {
+      madvise(memory + b, e - b, MADV_DONTNEED);
+      buffer_stat.bytes_dropped += e - b;
+    }
+    begin = end = 0;
+  };
+
+  for (auto &c : clean) {
+    auto it = frame_table.find(c.first);
+    if (it != frame_table.end() && frames[it->second].dirty) {
+      drop();  // 写回之后又改过，这一块不能丢
+      continue;
+    }
+    if (c.first > end) {
+      drop();
+      begin = c.first;
+    }
+    end = std::max(end, c.first + c.second);
+  }
+  drop();
+  clean.clear();
+  clean_bytes = 0;
+}
+
+// CLOCK 找一个可以替换的帧，被替换的脏帧先写回。
+// 等待日志的帧不能淘汰，转两圈都找不到就返回 -1，由调用者扩容。
+static int evict() {
+  for (size_t step = 0; step < 2 * frames.size(); ++step) {
+    clock_hand %= frames.size();
+    bufferFrame *f = &frames[clock_hand];
+
+    if (f->ref || f->logged) {
+      f->ref = false;
+      ++clock_hand;
+      continue;
+    }
+
+    write_back(f);
+    frame_table.erase(f->offset);
+    ++buffer_stat.evictions;
+    return clock_hand++;
+  }
+  return -1;
+}
+
+void BufferPut(long long offset, int length, bool dirty, bool journal) {
+  bool logged = dirty && journal && JournalActive();
+  auto it = frame_table.find(offset);
+
+  if (it != frame_table.end()) {
+    bufferFrame *f = &frames[it->second];
+    f->ref = true;
+    f->dirty |= dirty;
+    if (logged && !f->logged) {
+      f->logged = true;
+      ++logged_frames;
+      logged_bytes += f->length;
+    }
+    f->data = dirty ? !journal : f->data;
+    ++buffer_stat.hits;
+    return;
+  }
+
+  ++buffer_stat.misses;
+
+  // 只读访问不需要占用帧。
+  if (!dirty) {
+    return;
+  }
+
+  int slot = -1;
+  if ((int)frames.size() >= buffer_size) {
+    slot = evict();
+  }
+
+  if (slot < 0) {
+    slot = frames.size();
+    frames.push_back(bufferFrame{});
+  }
+
+  frames[slot] = bufferFrame{offset, length, dirty, true, logged, !journal};
+  frame_table[offset] = slot;
+  if (logged) {
+    ++logged_frames;
+    logged_bytes += length;
+  }
+
+  // 淘汰写回的内容攒多了，等写完丢掉。新帧已经在表里是脏的，刚改的内容不会被丢掉
+  if (clean_bytes >= DROP_BATCH) {
+    IoWait();
+    BufferDropClean();
+  }
+}
+
+long long BufferLoggedBytes(int *count) {
+  *count = logged_frames;
+  return logged_bytes;
+}
+
+bool BufferFull() { return (int)frames.size() > buffer_size; }
+
+void BufferLogged(std::vector<std::pair<long long, int>> *ranges) {
+  for (auto &f : frames) {
+    if (f.logged) {
+      ranges->emplace_back(f.offset, f.length);
+    }
+  }
+  std::sort(ranges->begin(), ranges->end());
+}
+
+void BufferWriteBack(bool logged) {
+  write_back_sorted(false, logged);
+  sync_pages(false);
+}
+
+void FlushBuffer() {
+  FlushAppend(0);  // 追加缓存里攒着的内容也要写下去
+  FlushJournal();
+  write_back_sorted(true, false);
+  IoWait();  // 其他进程读文件时要能看到
+  BufferDropClean();
+  sync_pages(false);
+  ++buffer_stat.flushes;
+}
+
+void SyncBuffer() {
+  FlushAppend(0);
+  FlushJournal();
+  write_back_sorted(true, false);
+
+  if (io_mode == IO_MMAP) {
+    sync_pages(true);
+  } else {
+    IoSync();
+    BufferDropClean();
+    ++buffer_stat.syscalls;
+  }
+  DiscardBlocks();  // 释放块的元数据已经落盘，打洞不会丢掉还在用的内容
+  ++buffer_stat.flushes;
+}
+
+void SetBufferSize(int size) {
+  if (size <= 0) {
+    fprintf(stderr, "缓冲池大小必须大于0\n");
+    return;
+  }
+
+  // 缩小时先全部写回再清空，简单可靠。
+  if (size < (int)frames.size()) {
+    FlushBuffer();
+    frames.clear();
+    frame_table.clear();
+    clock_hand = 0;
+  }
+  buffer_size = size;
+}
+
+void ResetBuffer() {
+  logged_frames = 0;
+  logged_bytes = 0;
+  clean.clear();
+  clean_bytes = 0;
+  dirty_pages.clear();
+  frames.clear();
+  frame_table.clear();
+  clock_hand = 0;
+}
+
+const bufferStat *GetBufferStat() { return &buffer_stat; }
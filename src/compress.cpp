@@ -0,0 +1,162 @@
+#include <string.h>
+#include <algorithm>
+#include "head.h"
+
+// LZ77 家族的块压缩，不依赖外部库。格式和 LZ4 的块格式类似，由若干段组成：
+// [token][字面量长度的延长字节][字面量][匹配偏移 2 字节][匹配长度的延长字节]，最后一段只有字面量。
+// token 高 4 位是字面量长度，低 4 位是匹配长度减 MIN_MATCH，等于 15 时后面跟延长字节，
+// 每个 255 表示还有下一个。
+// 压缩用 4 字节的哈希表找最近一次出现的位置，贪心匹配；一直找不到匹配时步长逐渐变大，
+// 压不下去的数据很快扫过去。
+constexpr int MIN_MATCH = 4;
+constexpr int HASH_BITS = 13;
+constexpr int MAX_OFFSET = 0xffff;
+
+static unsigned int read32(const unsigned char *p) {
+  unsigned int v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static int hash4(unsigned int v) { return (v * 2654435761u) >> (32 - HASH_BITS); }
+
+static unsigned char *putLength(unsigned char *op, int len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+// 一段最多占多少字节
+static int sequenceBound(int literals, int match) {
+  return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+int LzCompress(const char *src, int len, char *dst, int limit) {
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *op = (unsigned char *)dst;
+  unsigned char *const oend = op + limit;
+  int table[1 << HASH_BITS];  // 位置加一，0 表示空
+  memset(table, 0, sizeof(table));
+
+  int anchor = 0;  // 还没输出的字面量从这里开始
+  int ip = 0;
+  while (ip + MIN_MATCH <= len) {
+    const unsigned int v = read32(in + ip);
+    const int h = hash4(v);
+    const int ref = table[h] - 1;
+    table[h] = ip + 1;
+    if (ref < 0 || ip - ref > MAX_OFFSET || read32(in + ref) != v) {
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+
+    int match = MIN_MATCH;
+    while (ip + match < len && in[ref + match] == in[ip + match]) {
+      ++match;
+    }
+    const int literals = ip - anchor;
+    if (oend - op < sequenceBound(literals, match - MIN_MATCH)) {
+      return 0;
+    }
+
+    unsigned char *token = op++;
+    *token = std::min(literals, 15) << 4 | std::min(match - MIN_MATCH, 15);
+    if (literals >= 15) {
+      op = putLength(op, literals - 15);
+    }
+    memcpy(op, in + anchor, literals);
+    op += literals;
+    *op++ = (ip - ref) & 0xff;
+    *op++ = (ip - ref) >> 8;
+    if (match - MIN_MATCH >= 15) {
+      op = putLength(op, match - MIN_MATCH - 15);
+    }
+    ip += match;
+    anchor = ip;
+  }
+
+  const int literals = len - anchor;
+  if (oend - op < sequenceBound(literals, 0) - 3) {
+    return 0;
+  }
+  *op++ = std::min(literals, 15) << 4;
+  if (literals >= 15) {
+    op = putLength(op, literals - 15);
+  }
+  memcpy(op, in + anchor, literals);
+  op += literals;
+  return op - (unsigned char *)dst;
+}
+
+// 读延长字节，越界返回 -1
+static int getLength(const unsigned char **ip, const unsigned char *iend, int len) {
+  int b = 255;
+  while (b == 255) {
+    if (*ip >= iend) {
+      return -1;
+    }
+    b = *(*ip)++;
+    len += b;
+  }
+  return len;
+}
+
+int LzDecompress(const char *src, int len, char *dst, int capacity) {
+  const unsigned char *ip = (const unsigned char *)src;
+  const unsigned char *const iend = ip + len;
+  unsigned char *op = (unsigned char *)dst;
+  unsigned char *const oend = op + capacity;
+
+  while (ip < iend) {
+    const int token = *ip++;
+    int literals = token >> 4;
+    if (literals < 15 && iend - ip >= 16 && oend - op >= 16) {
+      memcpy(op, ip, 16);  // 短字面量，两边都有余量时按定长拷，多拷的会被后面覆盖
+      op += literals;
+      ip += literals;
+    } else {
+      if (literals == 15 && (literals = getLength(&ip, iend, literals)) < 0) {
+        return -1;
+      }
+      if (literals > iend - ip || literals > oend - op) {
+        return -1;
+      }
+      memcpy(op, ip, literals);
+      op += literals;
+      ip += literals;
+    }
+    if (ip == iend) {
+      break;  // 最后一段只有字面量
+    }
+
+    if (iend - ip < 2) {
+      return -1;
+    }
+    const int offset = ip[0] | ip[1] << 8;
+    ip += 2;
+    int match = token & 15;
+    if (match == 15 && (match = getLength(&ip, iend, match)) < 0) {
+      return -1;
+    }
+    match += MIN_MATCH;
+    if (offset == 0 || offset > op - (unsigned char *)dst || match > oend - op) {
+      return -1;
+    }
+
+    const unsigned char *from = op - offset;
+    if (offset >= 16 && match <= 32 && oend - op >= 32) {
+      memcpy(op, from, 16);  // 同上，每次 16 字节不会和源重叠
+      memcpy(op + 16, from + 16, 16);
+    } else if (offset >= match) {
+      memcpy(op, from, match);
+    } else {
+      for (int i = 0; i < match; ++i) {  // 和输出重叠，逐字节拷
+        op[i] = from[i];
+      }
+    }
+    op += match;
+  }
+  return op - (unsigned char *)dst;
+}
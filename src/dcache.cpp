@@ -0,0 +1,81 @@
+#include <string.h>
+#include "head.h"
+
+// 目录项缓存。直接映射的定长表，按目录和名字的散列选槽，冲突时新的顶掉旧的，内存占用固定。
+// 找不到的名字也缓存，建文件前查重名、反复打开不存在的文件都不用再查目录。
+// 目录项的增删改名都经过 DentrySet，只改对应的那个槽；删目录时丢掉它下面的槽，
+// 免得 inode 编号复用后看到旧的项。use_dentry_cache 只管查找，关掉时照样更新，再打开也不会旧。
+bool use_dentry_cache = true;
+static dentryStat dentry_stat;
+
+typedef struct dentrySlot {
+  int dir;      // 目录的 inode 编号，0 表示空槽
+  int file_id;  // -1 表示没有这个名字
+  int pos;      // 目录项的位置
+  unsigned int hash;
+  char name[MAX_NAME_LENGTH];
+} dentrySlot;
+
+static dentrySlot slots[DENTRY_SLOTS];
+
+const dentryStat *GetDentryStat() { return &dentry_stat; }
+
+static dentrySlot *slotOf(int dir, unsigned int hash) {
+  return &slots[(hash ^ (unsigned int)dir * 2654435761u) & (DENTRY_SLOTS - 1)];
+}
+
+static bool same(const dentrySlot *s, int dir, unsigned int hash, const char *name) {
+  return s->dir == dir && s->hash == hash && strcmp(s->name, name) == 0;
+}
+
+int DentryLookup(int dir, const char *name, int *pos) {
+  if (!use_dentry_cache) {
+    return DENTRY_MISS;
+  }
+  const unsigned int hash = NameHash(name);
+  const dentrySlot *s = slotOf(dir, hash);
+  if (!same(s, dir, hash, name)) {
+    ++dentry_stat.misses;
+    return DENTRY_MISS;
+  }
+  if (s->file_id > 0) {
+    ++dentry_stat.hits;
+  } else {
+    ++dentry_stat.negatives;
+  }
+  if (pos != nullptr) {
+    *pos = s->pos;
+  }
+  return s->file_id;
+}
+
+void DentrySet(int dir, const char *name, int file_id, int pos) {
+  const int len = strlen(name);
+  if (len >= MAX_NAME_LENGTH) {
+    return;  // 这么长的名字不会有文件
+  }
+  const unsigned int hash = NameHash(name);
+  dentrySlot *s = slotOf(dir, hash);
+  if (same(s, dir, hash, name)) {
+    if (s->file_id == file_id && s->pos == pos) {
+      return;
+    }
+    ++dentry_stat.invalidations;
+  }
+  s->dir = dir;
+  s->file_id = file_id > 0 ? file_id : -1;
+  s->pos = pos;
+  s->hash = hash;
+  memcpy(s->name, name, len + 1);
+}
+
+void DentryForgetDir(int dir) {
+  for (dentrySlot &s : slots) {
+    if (s.dir == dir) {
+      s.dir = 0;
+      ++dentry_stat.invalidations;
+    }
+  }
+}
+
+void ResetDentryCache() { memset(slots, 0, sizeof(slots)); }
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "head.h"
+
+// 按内容去重。索引是一个内部文件，里面是开放寻址的哈希表，第一次用到时按块数建好，
+// 大小是块数向上取 2 的幂再乘 2 项。按指纹取模找到位置，往后最多看 DEDUP_PROBES 项；
+// 找不到空位时覆盖第一项，被挤掉的块只是不再参与去重。
+// 块进了索引之后打上 REFCOUNT_DEDUP 标记，写之前都要复制，所以释放时内容还是进索引时的样子，
+// 按内容重新算指纹就能找到它的位置。
+bool dedup_blocks = false;
+static dedupStat dedup_stat;
+
+const dedupStat *GetDedupStat() { return &dedup_stat; }
+
+// 每次 8 字节、4 路并行的乘法散列，块大小是 32 的倍数
+unsigned long long BlockHash(const char *data, int len) {
+  constexpr unsigned long long k = 0x9e3779b97f4a7c15ULL;
+  unsigned long long h[4] = {k, k << 1, k << 2, k << 3};
+  for (int i = 0; i + 32 <= len; i += 32) {
+    for (int j = 0; j < 4; ++j) {
+      unsigned long long w;
+      memcpy(&w, data + i + j * 8, 8);
+      h[j] = (h[j] ^ w) * k;
+      h[j] ^= h[j] >> 29;
+    }
+  }
+  unsigned long long ret = len;
+  for (int j = 0; j < 4; ++j) {
+    ret = (ret ^ h[j]) * k;
+    ret ^= ret >> 32;
+  }
+  return ret;
+}
+
+static long long capacity() {
+  long long ret = 1;
+  while (ret < GetSuperBlock()->block_count) {
+    ret <<= 1;
+  }
+  return ret * 2;
+}
+
+// 索引文件，create 时还没有就建一个全零的
+static int indexFile(bool create) {
+  superBlock *super = GetSuperBlock();
+  if (super->dedup_id > 0 || !create) {
+    return super->dedup_id;
+  }
+
+  transaction t;
+  int index = NewFile(FILE_TYPE, ".dedup", "root");
+  if (index <= 0) {
+    return 0;
+  }
+  inode *n = GetInode(index);
+  n->flags |= INODE_INTERNAL | INODE_EXTENTS;  // 空文件，直接换成区段树，不受老索引大小的限制
+  PutInode(index, true);
+
+  // 索引直接按块访问，要真的写成零，不能是未写的预分配块
+  const long long size = capacity() * sizeof(dedupSlot);
+  std::vector<char> zero(IO_MAX_WRITE, 0);
+  for (long long pos = 0; pos < size; pos += zero.size()) {
+    const int len = std::min<long long>(zero.size(), size - pos);
+    if (Write(index, pos, len, zero.data()) != len) {
+      RemoveFile(index);
+      return 0;
+    }
+  }
+  super->dedup_id = index;
+  PutSuperBlock(true);
+  return index;
+}
+
+// 第 i 项所在的块和项，block 返回索引文件的块号
+static dedupSlot *slot(int index, long long i, int *block) {
+  const int per_block = GetSuperBlock()->block_size / sizeof(dedupSlot);
+  *block = LookupBlock(GetInode(index), i / per_block);
+  if (*block <= 0) {
+    return nullptr;
+  }
+  return (dedupSlot *)GetBlock(*block) + i % per_block;
+}
+
+int DedupFind(const char *data, unsigned long long *hash) {
+  const int block_size = GetSuperBlock()->block_size;
+  *hash = BlockHash(data, block_size);
+  ++dedup_stat.hashed;
+  const int index = indexFile(false);
+  if (index <= 0) {
+    return 0;
+  }
+
+  const long long mask = capacity() - 1;
+  for (int p = 0; p < DEDUP_PROBES; ++p) {
+    int b = 0;
+    const dedupSlot *s = slot(index, (*hash + p) & mask, &b);
+    if (s != nullptr && s->block > 0 && s->hash == *hash &&
+        memcmp(GetBlock(s->block), data, block_size) == 0) {
+      ++dedup_stat.matched;
+      return s->block;
+    }
+  }
+  return 0;
+}
+
+void DedupInsert(unsigned long long hash, int block) {
+  const int index = indexFile(true);
+  if (index <= 0) {
+    return;
+  }
+
+  const long long mask = capacity() - 1;
+  int b = 0;
+  dedupSlot *target = nullptr;
+  for (int p = 0; p < DEDUP_PROBES && target == nullptr; ++p) {
+    dedupSlot *s = slot(index, (hash + p) & mask, &b);
+    if (s != nullptr && s->block == 0) {
+      target = s;
+    }
+  }
+  if (target == nullptr && (target = slot(index, hash & mask, &b)) == nullptr) {
+    return;
+  }
+
+  target->hash = hash;
+  target->block = block;
+  PutBlock(b, true);
+  MarkDedupBlock(block);
+  ++dedup_stat.indexed;
+}
+
+void DedupForget(int block) {
+  const int index = indexFile(false);
+  if (index <= 0) {
+    return;
+  }
+
+  const unsigned long long hash = BlockHash(GetBlock(block)->content, GetSuperBlock()->block_size);
+  const long long mask = capacity() - 1;
+  for (int p = 0; p < DEDUP_PROBES; ++p) {
+    int b = 0;
+    dedupSlot *s = slot(index, (hash + p) & mask, &b);
+    if (s != nullptr && s->block == block) {
+      memset(s, 0, sizeof(dedupSlot));
+      PutBlock(b, true);
+      return;
+    }
+  }
+}
+
+int DedupAll() {
+  FlushAppend(0);
+  const superBlock *super = GetSuperBlock();
+  int saved = 0;
+  for (int i = 1; i < super->inode_count; ++i) {
+    if (InodeUsed(i)) {
+      saved += DedupFile(i);
+    }
+  }
+  return saved;
+}
@@ -3,11 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cassert>
 #include <list>
 #include <set>
 #include <string>
+#include <vector>
 #include "head.h"
 #include "print.h"
 
@@ -26,31 +29,152 @@ static void init() {
 // 检查权限
 static bool check(int index = current_dir_index) {
   init();
-  return ValidateCurrent(current_dir_index);
+  return ValidateCurrent(index);
 }
 
-// 检查当前目录下是否有指定文件
-static int has_file(int index, const char *file, int *pos = nullptr) {
-  int len = 0;
-  int *files = (int *)alloca(GetInode(index)->length);
-  int ret = -1;
-  ReadDir(index, &len, files);
-
-  for (int i = 0; i < len; ++i) {
-    inode *n = GetInode(files[i]);
+// 在目录里找指定文件。有散列索引的只查索引，没有的按顺序找，目录项多了顺带建好索引
+static int lookup(int index, const char *file, int *pos) {
+  const int found = DirIndexFind(index, file, pos);
+  if (found != DIR_UNINDEXED) {
+    return found;
+  }
 
-    if (strcmp(n->file_name, file) == 0) {
-      ret = files[i];
-      if (pos != nullptr) {
-        *pos = i;
+  // 先比散列和长度，只读目录块
+  const int len = DirEntries(index);
+  const unsigned int hash = NameHash(file);
+  const int name_len = strlen(file);
+  int ret = -1;
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < len && ret < 0; i += DIR_BATCH) {
+    const int count = ReadDirEntries(index, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      const namedEntry &e = batch[k];
+      if (e.file_id > 0 && e.hash == hash && e.name_len == name_len &&
+          memcmp(e.name, file, name_len) == 0) {
+        ret = e.file_id;
+        *pos = i + k;
+        break;
       }
-      break;
     }
   }
 
+  if (len >= DIR_INDEX_MIN) {
+    DirIndexBuild(index);
+  }
   return ret;
 }
 
+// 检查目录下是否有指定文件。先查目录项缓存，没命中再查目录，找没找到都记进缓存
+static int has_file(int index, const char *file, int *pos = nullptr) {
+  int p = -1;
+  int found = DentryLookup(index, file, &p);
+  if (found == DENTRY_MISS) {
+    found = lookup(index, file, &p);
+    DentrySet(index, file, found, p);
+  }
+  if (found >= 0 && pos != nullptr) {
+    *pos = p;
+  }
+  return found;
+}
+
+// 把 file_id 以名字 name 加到目录 dir 里，先用删掉的项留下的空位，没有才追加，同时加进索引。
+// 老的目录项记不下名字，名字不同时改 inode 里的
+static bool add_entry(int dir, int file_id, const char *name) {
+  inode *n = GetInode(file_id);
+  if (!(GetInode(dir)->flags & INODE_DIR_NAMES) && strcmp(n->file_name, name) != 0) {
+    PreserveInode(file_id);
+    memset(n->file_name, 0, MAX_NAME_LENGTH);
+    strcpy(n->file_name, name);
+    PutInode(file_id, true);
+  }
+  const int pos = DirSlotTake(dir);
+  namedEntry entry;
+  FillDirEntry(&entry, file_id, name);
+  if (WriteDirEntry(dir, pos, &entry) == false) {
+    if (pos < DirEntries(dir)) {
+      DirSlotFree(dir, pos);  // 空位没用上，还回去
+    }
+    return false;
+  }
+  DirIndexAdd(dir, name, pos);
+  DentrySet(dir, name, file_id, pos);
+  return true;
+}
+
+// 把目录 dir 第 pos 项标记为删除，同时从索引里去掉，位置记成空位。
+// 不在这里压缩，删目录时还在按位置扫它；删完由 DeleteFile、DeleteDir 和 Move 调 CompactDir
+static void remove_entry(int dir, int pos, const char *name) {
+  namedEntry entry;
+  FillDirEntry(&entry, -1, "");
+  WriteDirEntry(dir, pos, &entry);
+  DirIndexRemove(dir, name, pos);
+  DentrySet(dir, name, -1, -1);
+  DirSlotFree(dir, pos);
+}
+
+// . 和 .. 是占用的名字
+static bool dot_name(const char *name) { return strcmp(name, ".") == 0 || strcmp(name, "..") == 0; }
+
+// 把路径拆成所在目录和最后一段名字。没有 / 的就在当前目录下，末尾的 / 不算。
+// 所在目录不存在或不是目录、名字为空或过长时返回 false
+static bool parent_of(const char *path, int *dir, char *name) {
+  init();
+  std::string p = path;
+  while (p.size() > 1 && p.back() == '/') {
+    p.pop_back();
+  }
+
+  const size_t slash = p.rfind('/');
+  const std::string base = (slash == std::string::npos ? p : p.substr(slash + 1));
+  if (base.empty() || base.size() >= MAX_NAME_LENGTH) {
+    return false;
+  }
+  memcpy(name, base.c_str(), base.size() + 1);
+
+  if (slash == std::string::npos) {
+    *dir = current_dir_index;
+  } else {
+    *dir = ResolvePath(slash == 0 ? "/" : p.substr(0, slash).c_str());
+  }
+  return *dir > 0 && GetInode(*dir)->type == DIR_TYPE;
+}
+
+// 解析路径，返回对应的 inode 编号，不存在返回 -1。
+// 以 / 开头的从根目录找，否则从当前目录找；. 是本目录，.. 是上级，根目录的上级还是根目录。
+// 只是查找，不改变当前目录
+int ResolvePath(const char *path) {
+  init();
+  int dir = (path[0] == '/' ? GetSuperBlock()->root_dir_id : current_dir_index);
+  const char *p = path;
+  while (*p != '\0') {
+    const char *end = strchr(p, '/');
+    const size_t len = (end == nullptr ? strlen(p) : end - p);
+    const std::string part(p, len);
+    p += len + (end != nullptr);
+
+    if (part.empty() || part == ".") {
+      continue;
+    }
+    if (GetInode(dir)->type != DIR_TYPE) {
+      return -1;  // 中间一段不是目录
+    }
+    if (part == "..") {
+      const int last = GetInode(dir)->last_dir;
+      dir = (last > 0 ? last : dir);
+      continue;
+    }
+    if (len >= MAX_NAME_LENGTH) {
+      return -1;
+    }
+    dir = has_file(dir, part.c_str());
+    if (dir < 0) {
+      return -1;
+    }
+  }
+  return dir;
+}
+
 bool IsOpen(int fd) { return open_file.count(fd) > 0; }
 
 // 当前用户是否有权限访问指定 inode
@@ -60,14 +184,13 @@ bool ValidateCurrent(int index) {
 
 // 读取目录，写入files和len中
 bool ReadDir(int index, int *len, int *files) {
-  inode *n = GetInode(index);
-  constexpr int entry_size = sizeof(dirEntry);
-  *len = n->length / entry_size;
-
-  for (int i = 0; i < *len; ++i) {
-    dirEntry entry;
-    ReadEntry(index, i, entry_size, (char *)&entry);
-    files[i] = entry.file_id;
+  *len = DirEntries(index);
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < *len; i += DIR_BATCH) {
+    const int count = ReadDirEntries(index, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      files[i + k] = batch[k].file_id;
+    }
   }
 
   return true;
@@ -75,44 +198,54 @@ bool ReadDir(int index, int *len, int *files) {
 
 // 创建一个新文件
 bool CreateFile(const char *file_name) {
-  if (check() == false) {
+  transaction t;
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  if (parent_of(file_name, &dir, name) == false) {
+    fprintf(stderr, "无此目录或文件名不合法\n");
+    return false;
+  }
+
+  if (check(dir) == false) {
     fprintf(stderr, "无权限\n");
     return false;
   }
 
-  if (has_file(current_dir_index, file_name) >= 0) {
-    fprintf(stderr, "当前目录已经有%s\n", file_name);
+  if (has_file(dir, name) >= 0) {
+    fprintf(stderr, "当前目录已经有%s\n", name);
     return false;
   }
 
-  if (strcmp(file_name, ".") == 0 || strcmp(file_name, "..") == 0) {
+  if (dot_name(name)) {
     fprintf(stderr, "被占用的目录名\n");
     return false;
   }
 
-  int index = NewFile(FILE_TYPE, file_name, GetCurrentUser()->user_name);
+  int index = NewFile(FILE_TYPE, name, GetCurrentUser()->user_name);
   if (index <= 0) {
     return false;
   }
-  dirEntry entry;
-  entry.file_id = index;
-
-  // 把新文件添加到当前目录
-  Append(current_dir_index, sizeof(dirEntry), (const char *)&entry);
+  if (GetSuperBlock()->compress && (GetInode(index)->flags & INODE_EXTENTS)) {
+    SetCompression(index, true);  // 格式化时选了压缩
+  }
+  // 把新文件添加到所在目录，目录满了就把新文件删掉，避免泄漏
+  if (add_entry(dir, index, name) == false) {
+    RemoveFile(index);
+    return false;
+  }
   open_file.insert(index);
   return true;
 }
 
-// 获取当前目录下的指定文件的index，pos表示目录中的位置
+// 获取路径对应文件的index，pos表示在所在目录中的位置
 int Open(const char *file_name, int *pos) {
-  int fd = has_file(current_dir_index, file_name, pos);
-
-  if (strcmp(file_name, ".") == 0) {
-    return current_dir_index;
-  }
-
-  if (strcmp(file_name, "..") == 0) {
-    return GetInode(current_dir_index)->last_dir;
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  int fd = -1;
+  if (parent_of(file_name, &dir, name) && !dot_name(name)) {
+    fd = has_file(dir, name, pos);
+  } else {
+    fd = ResolvePath(file_name);  // /、. 和 .. 不是所在目录里的目录项
   }
 
   if (fd < 0) {
@@ -148,14 +281,15 @@ bool CloseFile(const char *file_name) {
     fprintf(stderr, "未打开的文件。\n");
     return true;
   }
+  DropAppend(fd);
   open_file.erase(fd);
   return true;
 }
 
-// 删除一个文件。
-bool DeleteFile(const char *file_name) {
+// 删除目录 dir 下的文件 file_name
+static bool delete_file(int dir, const char *file_name) {
   int pos = -1;
-  int fd = Open(file_name, &pos);
+  int fd = has_file(dir, file_name, &pos);
   if (fd < 0 || pos < 0 || GetInode(fd)->type == DIR_TYPE) {
     fprintf(stderr, "不存在的文件。\n");
     return true;
@@ -167,7 +301,7 @@ bool DeleteFile(const char *file_name) {
     return false;
   }
 
-  if (strcmp(file_name, ".") == 0 || strcmp(file_name, "..") == 0) {
+  if (dot_name(file_name)) {
     fprintf(stderr, "被占用的目录名\n");
     return false;
   }
@@ -177,14 +311,14 @@ bool DeleteFile(const char *file_name) {
   bool need_del = false;
   if (n->type == LINK_TYPE) {
     nn = GetInode(n->link_inode);
+    PreserveInode(nn->id);
     need_del = (--nn->link_cnt == 0);
   } else {
+    PreserveInode(n->id);
     need_del = (--n->link_cnt == 0);
   }
 
-  dirEntry entry;
-  entry.file_id = -1;
-  WriteEntry(current_dir_index, pos, sizeof(dirEntry), (const char *)&entry);
+  remove_entry(dir, pos, file_name);
 
   // 如果链接为0，则删除源文件。
   if (need_del) {
@@ -204,58 +338,45 @@ bool DeleteFile(const char *file_name) {
   return true;
 }
 
-// 递归检查文件夹是否有权限，如果文件夹下任意一个文件没有权限，则无法删除这个文件夹。
-static bool validate_dir(const char *dir_name) {
-  int pos = -1;
-  int fd = Open(dir_name, &pos);
-  if (fd < 0 || pos < 0) {
-    fprintf(stderr, "目录不存在\n");
+// 删除一个文件。
+bool DeleteFile(const char *file_name) {
+  transaction t;
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  if (parent_of(file_name, &dir, name) == false) {
+    fprintf(stderr, "不存在的文件。\n");
     return true;
   }
+  const bool ok = delete_file(dir, name);
+  CompactDir(dir);
+  return ok;
+}
 
+// 递归检查文件夹是否有权限，如果文件夹下任意一个文件没有权限，则无法删除这个文件夹。
+static bool validate_dir(int fd) {
   if (ValidateCurrent(fd) == false) {
-    fprintf(stderr, "无权限\n");
     return false;
   }
 
-  inode *d = GetInode(fd);
-  if (d->type != DIR_TYPE) {
-    fprintf(stderr, "该文件不是目录");
-    return true;
-  }
-
-  // 进入目录
-  NextDir(d->file_name);
-  const int num = d->length / sizeof(dirEntry);
-
-  int i;
-  for (i = 0; i < num; ++i) {
-    dirEntry entry;
-    ReadEntry(fd, i, sizeof(dirEntry), (char *)&entry);
-
-    if (entry.file_id > 0) {
-      inode *n = GetInode(entry.file_id);
-      if (ValidateCurrent(n->id) == false) {
-        break;
-      } else if (n->type == DIR_TYPE && validate_dir(n->file_name) == false) {
-        break;
+  const int num = DirEntries(fd);
+  bool ok = true;  // 所有文件都通过验证
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < num && ok; i += DIR_BATCH) {
+    const int count = ReadDirEntries(fd, i, DIR_BATCH, batch);
+    for (int k = 0; k < count && ok; ++k) {
+      const namedEntry &e = batch[k];
+      if (e.file_id > 0) {
+        ok = e.type == DIR_TYPE ? validate_dir(e.file_id) : ValidateCurrent(e.file_id);
       }
     }
   }
-
-  LastDir();        // 退出目录
-  return i == num;  // 所有文件都通过验证
+  return ok;
 }
 
-bool DeleteDir(const char *dir_name) {
-  // 递归检查所有目录下所有文件。
-  if (validate_dir(dir_name) == false) {
-    fprintf(stderr, "无权限\n");
-    return false;
-  }
-
+// 删除目录 dir 下的目录 dir_name，先递归删掉里面的文件和目录
+static bool delete_dir(int dir, const char *dir_name) {
   int pos = -1;
-  int fd = Open(dir_name, &pos);
+  int fd = has_file(dir, dir_name, &pos);
   if (fd < 0 || pos < 0) {
     fprintf(stderr, "目录不存在\n");
     return true;
@@ -266,7 +387,7 @@ bool DeleteDir(const char *dir_name) {
     return false;
   }
 
-  if (strcmp(dir_name, ".") == 0 || strcmp(dir_name, "..") == 0) {
+  if (dot_name(dir_name)) {
     fprintf(stderr, "被占用的目录名\n");
     return false;
   }
@@ -277,68 +398,107 @@ bool DeleteDir(const char *dir_name) {
     return true;
   }
 
-  // 进入目录
-  NextDir(d->file_name);
-  const int num = d->length / sizeof(dirEntry);
-
-  for (int i = 0; i < num; ++i) {
-    dirEntry entry;
-    ReadEntry(fd, i, sizeof(dirEntry), (char *)&entry);
-
-    // 递归删除
-    if (entry.file_id > 0) {
-      inode *n = GetInode(entry.file_id);
-      if (n->type == DIR_TYPE) {
-        DeleteDir(n->file_name);  // 递归。
+  const int num = DirEntries(fd);
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < num; i += DIR_BATCH) {
+    const int count = ReadDirEntries(fd, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      // 递归删除
+      const namedEntry &e = batch[k];
+      if (e.file_id <= 0) {
+        continue;
+      }
+      if (e.type == DIR_TYPE) {
+        delete_dir(fd, e.name);  // 递归。
       } else {
-        DeleteFile(n->file_name);  // 删除文件。
+        delete_file(fd, e.name);  // 删除文件。
       }
+      JournalCheckpoint();  // 删完一项目录还是完整的，大目录分几组提交
     }
   }
 
-  LastDir();  // 退出目录。
-
-  dirEntry entry;
-  entry.file_id = -1;
-  WriteEntry(current_dir_index, pos, sizeof(dirEntry), (const char *)&entry);
+  remove_entry(dir, pos, dir_name);
   PutInode(d->id, true);
+  DentryForgetDir(fd);
+  DirSlotForget(fd);
   return RemoveFile(fd);  // 删除这个目录
 }
 
+bool DeleteDir(const char *dir_name) {
+  transaction t;
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  if (parent_of(dir_name, &dir, name) == false || dot_name(name)) {
+    fprintf(stderr, "目录不存在或被占用的目录名\n");
+    return false;
+  }
+
+  int fd = has_file(dir, name);
+  if (fd < 0 || GetInode(fd)->type != DIR_TYPE) {
+    fprintf(stderr, "目录不存在\n");
+    return true;
+  }
+
+  // 当前目录和它的上级不能删
+  for (int cur = current_dir_index; cur > 0; cur = GetInode(cur)->last_dir) {
+    if (cur == fd) {
+      fprintf(stderr, "不能删除当前目录或它的上级\n");
+      return false;
+    }
+  }
+
+  // 递归检查所有目录下所有文件。
+  if (validate_dir(fd) == false) {
+    fprintf(stderr, "无权限\n");
+    return false;
+  }
+  const bool ok = delete_dir(dir, name);
+  CompactDir(dir);
+  return ok;
+}
+
 bool CreateDir(const char *dir_name) {
-  if (check() == false) {
+  transaction t;
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  if (parent_of(dir_name, &dir, name) == false) {
+    fprintf(stderr, "无此目录或目录名不合法\n");
+    return false;
+  }
+
+  if (check(dir) == false) {
     fprintf(stderr, "无权限\n");
     return false;
   }
 
-  if (has_file(current_dir_index, dir_name) >= 0) {
+  if (has_file(dir, name) >= 0) {
     fprintf(stderr, "目录下已存在相同名字\n");
     return false;
   }
 
-  if (strcmp(dir_name, ".") == 0 || strcmp(dir_name, "..") == 0) {
+  if (dot_name(name)) {
     fprintf(stderr, "被占用的目录名\n");
     return false;
   }
 
-  int fd = NewFile(DIR_TYPE, dir_name, GetCurrentUser()->user_name);
+  int fd = NewFile(DIR_TYPE, name, GetCurrentUser()->user_name);
   if (fd < 0) {
     return false;
   }
 
   // 创建文件夹。
   inode *n = GetInode(fd);
-  n->last_dir = current_dir_index;
-
-  dirEntry entry;
-  entry.file_id = fd;
-  Append(current_dir_index, sizeof(dirEntry), (const char *)&entry);
+  n->last_dir = dir;
   PutInode(n->id, true);
+  if (add_entry(dir, fd, name) == false) {
+    RemoveFile(fd);
+    return false;
+  }
   return true;
 }
 
 bool NextDir(const char *dir_name) {
-  int fd = has_file(current_dir_index, dir_name);
+  int fd = ResolvePath(dir_name);
   if (fd < 0 || GetInode(fd)->type != DIR_TYPE) {
     fprintf(stderr, "无此目录\n");
     return false;
@@ -359,18 +519,27 @@ bool LastDir() {
   return true;
 }
 
-// 打印出来目录下所有项。
-void ShowDir() {
-  int len = 0;
-  int *files = (int *)alloca(GetInode(current_dir_index)->length);
-  ReadDir(current_dir_index, &len, files);
-
-  for (int i = 0; i < len; ++i) {
-    dirEntry entry;
-    ReadEntry(current_dir_index, i, sizeof(entry), (char *)&entry);
+// 打印出来目录下所有项。path 为空时打印当前目录
+void ShowDir(const char *path) {
+  init();
+  const int dir = (path == nullptr ? current_dir_index : ResolvePath(path));
+  if (dir < 0 || GetInode(dir)->type != DIR_TYPE) {
+    fprintf(stderr, "无此目录\n");
+    return;
+  }
 
-    if (entry.file_id > 0) {
-      inode *n = GetInode(entry.file_id);
+  FlushAppend(0);  // 显示的大小要包括攒着的追加
+  const int len = DirEntries(dir);
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < len; i += DIR_BATCH) {
+    const int count = ReadDirEntries(dir, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      const namedEntry &e = batch[k];
+      if (e.file_id <= 0) {
+        continue;
+      }
+      // 名字和类型在目录项里，大小、主人和链接数还要看 inode
+      inode *n = GetInode(e.file_id);
       inode *nn = nullptr;
 
       if (n->type == LINK_TYPE) {
@@ -378,9 +547,9 @@ void ShowDir() {
       }
 
       PRINT_FONT_YEL;
-      fprintf(stdout, "[type]%s ", TYPE2NAME[n->type]);
+      fprintf(stdout, "[type]%s ", TYPE2NAME[e.type]);
       PRINT_FONT_GRE;
-      fprintf(stdout, "[name]%s ", n->file_name);
+      fprintf(stdout, "[name]%s ", e.name);
       PRINT_FONT_RED;
       fprintf(stdout, "[owner]%s [size]%d [inode]%d [link]%d\n", n->owner_name,
               (nn != nullptr ? nn->length : n->length), n->id,
@@ -426,13 +595,21 @@ std::string GetPath() {
 
 // 链接
 bool Link(const char *src, const char *dst) {
-  int i = has_file(current_dir_index, src);
+  transaction t;
+  int i = Open(src);
   if (i < 0) {
     fprintf(stderr, "不存在该文件\n");
     return false;
   }
 
-  int j = has_file(current_dir_index, dst);
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  if (parent_of(dst, &dir, name) == false || dot_name(name)) {
+    fprintf(stderr, "无此目录或文件名不合法\n");
+    return false;
+  }
+
+  int j = has_file(dir, name);
   if (j >= 0) {
     fprintf(stderr, "文件已存在\n");
     return false;
@@ -449,28 +626,52 @@ bool Link(const char *src, const char *dst) {
     return false;
   }
 
-  int index = NewFile(LINK_TYPE, dst, GetCurrentUser()->user_name);
+  // 目录项带名字时，链接就是指向同一个 inode 的另一个目录项
+  if (GetInode(dir)->flags & INODE_DIR_NAMES) {
+    PreserveInode(old->id);
+    old->link_cnt += 1;
+    PutInode(old->id, true);
+    if (add_entry(dir, i, name) == false) {
+      old->link_cnt -= 1;
+      PutInode(old->id, true);
+      return false;
+    }
+    return true;
+  }
+
+  // 老的目录项记不下名字，用一个链接 inode 存名字
+  int index = NewFile(LINK_TYPE, name, GetCurrentUser()->user_name);
   if (index <= 0) {
     return false;
   }
 
   open_file.insert(index);
   inode *n = GetInode(index);
+  PreserveInode(old->id);
   old->link_cnt += 1;
   n->link_inode = i;
-
-  dirEntry entry;
-  entry.file_id = index;
-
-  Append(current_dir_index, sizeof(dirEntry), (const char *)&entry);
   PutInode(n->id, true);
+  if (add_entry(dir, index, name) == false) {
+    old->link_cnt -= 1;
+    PutInode(old->id, true);
+    RemoveFile(index);
+    open_file.erase(index);
+    return false;
+  }
   PutInode(old->id, true);
   return true;
 }
 
-// 重命名
+// 重命名。新名字可以是路径，但要和原来在同一个目录下
 bool Rename(const char *old_name, const char *new_name) {
-  int i = has_file(current_dir_index, old_name);
+  transaction t;
+  int dir = -1;
+  char name[MAX_NAME_LENGTH];
+  int pos = -1;
+  int i = -1;
+  if (parent_of(old_name, &dir, name) && !dot_name(name)) {
+    i = has_file(dir, name, &pos);
+  }
   if (i < 0) {
     fprintf(stderr, "不存在该文件\n");
     return false;
@@ -481,64 +682,93 @@ bool Rename(const char *old_name, const char *new_name) {
     return false;
   }
 
-  int j = has_file(current_dir_index, new_name);
-  if (j >= 0) {
-    fprintf(stderr, "文件已存在\n");
+  int new_dir = dir;
+  char new_base[MAX_NAME_LENGTH];
+  const int len = strlen(new_name);
+  if (len >= MAX_NAME_LENGTH && strchr(new_name, '/') == nullptr) {
+    fprintf(stderr, "文件名过长\n");
+    return false;
+  }
+  if (strchr(new_name, '/') == nullptr) {
+    memcpy(new_base, new_name, len + 1);
+  } else if (parent_of(new_name, &new_dir, new_base) == false || new_dir != dir) {
+    fprintf(stderr, "只能在同一目录下重命名，移动请用 move\n");
     return false;
   }
 
-  int len = strlen(new_name);
+  if (dot_name(new_base)) {
+    fprintf(stderr, "被占用的目录名\n");
+    return false;
+  }
 
-  if (len >= MAX_NAME_LENGTH) {
-    fprintf(stderr, "文件名过长\n");
+  int j = has_file(dir, new_base);
+  if (j >= 0) {
+    fprintf(stderr, "文件已存在\n");
     return false;
   }
+
   inode *n = GetInode(i);
+  PreserveInode(n->id);
   memset(n->file_name, 0, MAX_NAME_LENGTH);
 
-  // 修改文件名。
-  memcpy(n->file_name, new_name, len);
+  // 修改文件名。目录项带名字时改目录项，inode 里的名字也跟着改
+  DirIndexRemove(dir, name, pos);
+  memcpy(n->file_name, new_base, strlen(new_base));
   PutInode(n->id, true);
+  if (GetInode(dir)->flags & INODE_DIR_NAMES) {
+    namedEntry entry;
+    FillDirEntry(&entry, i, new_base);
+    WriteDirEntry(dir, pos, &entry);
+  }
+  DirIndexAdd(dir, new_base, pos);
+  DentrySet(dir, name, -1, -1);
+  DentrySet(dir, new_base, i, pos);
   return true;
 }
 
-// 拷贝
-bool Copy(const char *file, const char *dir) {
-  int pos = -1;
-  int i = has_file(current_dir_index, file, &pos);
+// 找 Copy 和 Move 的源文件和目标目录，file 的所在目录和目录项位置放进 from 和 pos，
+// 目标目录放进 to，文件名放进 name。返回源文件的 inode 编号，出错返回 -1
+static int copy_target(const char *file, const char *dir, int *from, int *pos, int *to,
+                       char *name) {
+  int i = -1;
+  if (parent_of(file, from, name) && !dot_name(name)) {
+    i = has_file(*from, name, pos);
+  }
   if (i < 0 || GetInode(i)->type == DIR_TYPE) {
     fprintf(stderr, "不存在该文件\n");
-    return false;
+    return -1;
   }
 
-  int j = has_file(current_dir_index, dir);
-  // j < 0 说明不在复制的文件夹不在当前目录下
-  if (j < 0) {
-    // 如果还不是 .. 则不存在
-    if (strcmp(dir, "..") != 0) {
-      fprintf(stderr, "不存在目录\n");
-      return false;
-    }
-
-    inode *n = GetInode(current_dir_index);
-
-    if (n->last_dir < 0) {
-      fprintf(stderr, "已在根目录\n");
-      return false;
-    }
-
-    j = n->last_dir;  // 目标文件夹时 n 的上一级目录
+  *to = ResolvePath(dir);
+  if (*to < 0 || GetInode(*to)->type != DIR_TYPE) {
+    fprintf(stderr, "不存在目录\n");
+    return -1;
   }
 
-  // 如果目标文件夹已经有了同名文件，则不能拷贝。
-  if (has_file(j, file) >= 0) {
+  // 如果目标文件夹已经有了同名文件，则不能拷贝或移动。
+  if (has_file(*to, name) >= 0) {
     fprintf(stderr, "目录中已有该文件\n");
+    return -1;
+  }
+  return i;
+}
+
+// 拷贝
+bool Copy(const char *file, const char *dir) {
+  transaction t;
+  int from = -1;
+  int pos = -1;
+  int j = -1;
+  char name[MAX_NAME_LENGTH];
+  int i = copy_target(file, dir, &from, &pos, &j, name);
+  if (i < 0) {
     return false;
   }
 
   // 把文件 i 拷贝到文件夹 j 中。
+  FlushAppend(i);
   inode *f = GetInode(i);
-  int index = NewFile(f->type, f->file_name, GetCurrentUser()->user_name);
+  int index = NewFile(f->type, name, GetCurrentUser()->user_name);
   if (index <= 0) {
     return false;
   }
@@ -549,30 +779,45 @@ bool Copy(const char *file, const char *dir) {
   if (f->type == LINK_TYPE) {
     n->link_inode = f->link_inode;
     inode *nn = GetInode(n->link_inode);
+    PreserveInode(nn->id);
     nn->link_cnt += 1;
     n->link_cnt = nn->link_cnt;
     PutInode(nn->id, true);
   } else {
-    // 把文件内容拷贝了。
-    char *buf = (char *)alloca(f->length);
-    Read(f->id, 0, f->length, buf);
-    Write(n->id, 0, f->length, buf);
+    // 不复制内容，和源文件共享数据块，之后谁写到哪块再复制哪块。
+    if (Reflink(f->id, n->id) == false) {
+      RemoveFile(index);
+      open_file.erase(index);
+      fprintf(stderr, "空间不足\n");
+      return false;
+    }
   }
 
-  dirEntry entry;
-  entry.file_id = index;
-  Append(j, sizeof(entry), (const char *)&entry);
   PutInode(n->id, true);
   PutInode(f->id, true);
+  // 目标目录满了就把副本删掉，避免泄漏 inode 和共享的块
+  if (add_entry(j, index, name) == false) {
+    if (f->type == LINK_TYPE) {
+      inode *nn = GetInode(n->link_inode);
+      nn->link_cnt -= 1;
+      PutInode(nn->id, true);
+    }
+    RemoveFile(index);
+    open_file.erase(index);
+    return false;
+  }
   return true;
 }
 
 // 移动
 bool Move(const char *file, const char *dir) {
+  transaction t;
+  int from = -1;
   int pos = -1;
-  int i = has_file(current_dir_index, file, &pos);
-  if (i < 0 || GetInode(i)->type == DIR_TYPE) {
-    fprintf(stderr, "不存在该文件\n");
+  int j = -1;
+  char name[MAX_NAME_LENGTH];
+  int i = copy_target(file, dir, &from, &pos, &j, name);
+  if (i < 0) {
     return false;
   }
 
@@ -581,76 +826,189 @@ bool Move(const char *file, const char *dir) {
     return false;
   }
 
-  // 这部分和copy说一样的逻辑，寻找目标文件夹。
-  int j = has_file(current_dir_index, dir);
-  if (j < 0) {
-    if (strcmp(dir, "..") != 0) {
-      fprintf(stderr, "不存在目录\n");
-      return false;
-    }
-    inode *n = GetInode(current_dir_index);
-
-    if (n->last_dir < 0) {
-      fprintf(stderr, "已在根目录\n");
-      return false;
-    }
-
-    j = n->last_dir;
-  }
-
-  if (has_file(j, file) >= 0) {
-    fprintf(stderr, "目录中已有该文件\n");
+  // 把文件 i 移动到文件夹 j 中。
+  // 移动，只需要在新文件夹中增加index，再在原来的文件夹中删除index即可。
+  // 先加后删，目标目录满了时文件还留在原处，不会丢掉唯一的目录项。
+  if (add_entry(j, i, name) == false) {
+    fprintf(stderr, "目标目录已满\n");
     return false;
   }
-
-  // 把文件 i 移动到文件夹 j 中。
-  // 移动，只需要在原来的文件夹中删除index，在新文件夹中增加index即可。
-  dirEntry entry;
-  entry.file_id = -1;
-  WriteEntry(current_dir_index, pos, sizeof(dirEntry), (const char *)&entry);
-  entry.file_id = i;
-  Append(j, sizeof(entry), (const char *)&entry);
+  remove_entry(from, pos, name);
+  CompactDir(from);
   return true;
 }
 
-bool Load(const char *src, const char *file) {
-  // 检查
+static double nowMs() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+// 流式导入：按 LOAD_CHUNK 分段读本地文件再写进去，内存占用和文件大小无关。
+// 区段树文件先按文件大小预分配一段连续的块，之后每段直接写进去；不包在一个大事务里，
+// 每段的 Write 各自是一个事务，导入很大的文件也不会撑爆日志区。
+static std::vector<char> load_buf;
+
+// 把本地文件 src 追加到文件 index 后面，返回导入的字节数，出错返回 -1
+static long long loadFile(const char *src, int index) {
   int fd = open(src, O_RDONLY);
   if (fd < 0) {
     fprintf(stderr, "不存在文件%s\n", src);
+    return -1;
+  }
+  struct stat s;
+  if (fstat(fd, &s) < 0 || !S_ISREG(s.st_mode)) {
+    fprintf(stderr, "%s不是普通文件\n", src);
     close(fd);
-    return false;
+    return -1;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  FlushAppend(index);
+  inode *n = GetInode(index);
+  const long long limit = (n->flags & INODE_EXTENTS) ? MAX_EXTENT_FILE_SIZE : MaxFileSize();
+  const int pos = n->length;
+  long long size = s.st_size;
+  if (pos + size > limit) {
+    fprintf(stderr, "%s过大，将被截断\n", src);
+    size = std::max(limit - pos, 0LL);
+  }
+  // 老的索引方式记不下未写的块，预分配要清零，不如直接写；压缩文件每簇都换新块，也不预分配
+  const bool prealloc = size > 0 && (n->flags & INODE_EXTENTS) && !(n->flags & INODE_COMPRESSED);
+  const int block_size = GetSuperBlock()->block_size;
+  const int prealloc_end = (pos + size + block_size - 1) / block_size;
+  // 预分配的块里没写到的还回去，不然留在文件长度后面，要等删文件才回来
+  auto trim = [&](long long done) {
+    if (prealloc) {
+      ReleaseBlocks(index, (pos + done + block_size - 1) / block_size, prealloc_end);
+    }
+  };
+  if (prealloc && Fallocate(index, pos, size) == false) {
+    fprintf(stderr, "空间不足\n");
+    trim(0);  // 分配到一半的也要还
+    close(fd);
+    return -1;
+  }
+
+  load_buf.resize(LOAD_CHUNK);
+  long long done = 0;
+  while (done < size) {
+    const int want = std::min<long long>(LOAD_CHUNK, size - done);
+    const ssize_t got = read(fd, load_buf.data(), want);
+    if (got <= 0) {
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      break;  // 文件在导入时变短了
+    }
+    const int w = Write(index, pos + done, got, load_buf.data());
+    done += w;
+    if (w != got) {
+      break;
+    }
   }
+  trim(done);
+  close(fd);
+  return done;
+}
+
+// verb 是导入或导出
+static void printRate(const char *verb, const char *name, long long bytes, double ms) {
+  PRINT_FONT_GRE
+  printf("%s%s %lld字节，用时%.1fms，%.1fMB/s\n", verb, name, bytes, ms,
+         ms > 0 ? bytes / 1048576.0 / (ms / 1000) : 0.0);
+  PRINT_FONT_BLA
+}
 
+bool Load(const char *src, const char *file) {
   int index = Open(file);
   if (index < 0 || GetInode(index)->type != FILE_TYPE) {
     fprintf(stderr, "不存在文件%s\n", file);
-    close(fd);
     return false;
   }
 
   if (ValidateCurrent(index) == false) {
     fprintf(stderr, "无权限\n");
-    close(fd);
     return false;
   }
 
   if (IsOpen(index) == false) {
     fprintf(stderr, "未打开\n");
-    close(fd);
     return false;
   }
 
-  // 先拷贝到buf，再append到文件
-  struct stat s;
-  fstat(fd, &s);
-  int len = s.st_size;
-  char *buf = (char *)alloca(len + 1);
-  memset(buf, 0, len + 1);
-  read(fd, buf, len);
+  const double t0 = nowMs();
+  const long long bytes = loadFile(src, index);
+  if (bytes < 0) {
+    return false;
+  }
+  printRate("导入", src, bytes, nowMs() - t0);
+  return true;
+}
 
-  Append(index, len, buf);
-  close(fd);
+int LoadFiles(int count, const char *const *srcs) {
+  const double t0 = nowMs();
+  long long total = 0;
+  int loaded = 0;
+  for (int i = 0; i < count; ++i) {
+    const char *slash = strrchr(srcs[i], '/');
+    const char *name = slash != nullptr ? slash + 1 : srcs[i];
+    if (*name == '\0' || strlen(name) >= MAX_NAME_LENGTH) {
+      fprintf(stderr, "%s的文件名不合法\n", srcs[i]);
+      continue;
+    }
+    if (has_file(current_dir_index, name) < 0 && CreateFile(name) == false) {
+      continue;
+    }
+    int index = Open(name);
+    if (index < 0 || GetInode(index)->type != FILE_TYPE) {
+      fprintf(stderr, "%s不是普通文件\n", name);
+      continue;
+    }
+    if (ValidateCurrent(index) == false) {
+      fprintf(stderr, "无权限\n");
+      continue;
+    }
+    open_file.insert(index);  // 导入的文件视为打开
+    const double t = nowMs();
+    const long long bytes = loadFile(srcs[i], index);
+    if (bytes >= 0) {
+      printRate("导入", srcs[i], bytes, nowMs() - t);
+      total += bytes;
+      ++loaded;
+    }
+  }
+  if (count > 1) {
+    printRate("导入", "全部", total, nowMs() - t0);
+  }
+  return loaded;
+}
+
+bool ExportFile(const char *file, const char *dst) {
+  int index = Open(file);
+  if (index < 0 || GetInode(index)->type == DIR_TYPE) {
+    fprintf(stderr, "不存在文件%s\n", file);
+    return false;
+  }
+
+  if (ValidateCurrent(index) == false) {
+    fprintf(stderr, "无权限\n");
+    return false;
+  }
+
+  int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    fprintf(stderr, "无法创建%s\n", dst);
+    return false;
+  }
+  const double t0 = nowMs();
+  const long long bytes = Export(index, out);
+  close(out);
+  if (bytes < 0) {
+    fprintf(stderr, "导出%s失败\n", dst);
+    return false;
+  }
+  printRate("导出", file, bytes, nowMs() - t0);
   return true;
 }
 
@@ -670,18 +1028,20 @@ void ReadFile(const char *file) {
   if (n->type == LINK_TYPE) {
     n = GetInode(n->link_inode);
   }
+  FlushAppend(n->id);
 
-  char *s = (char *)alloca(n->length + 1);
-  memset(s, 0, n->length + 1);
-
-  // 读取
-  int len = Read(fd, 0, n->length, s);
-  s[len] = '\0';
-
-  // 按字节打印，避免因为'\0'出现问题。
+  // 按 LOAD_CHUNK 分段读出来整段写到屏幕，内存占用和文件大小无关，'\0' 也原样输出
+  load_buf.resize(LOAD_CHUNK);
+  const int length = n->length;
+  int len = 0;
   PRINT_FONT_GRE
-  for (int i = 0; i < len; ++i) {
-    putc(s[i], stdout);
+  while (len < length) {
+    const int got = Read(fd, len, std::min(LOAD_CHUNK, length - len), load_buf.data());
+    if (got <= 0) {
+      break;
+    }
+    fwrite(load_buf.data(), 1, got, stdout);
+    len += got;
   }
   PRINT_FONT_RED
   fprintf(stdout, "\n共读取%d字节\n", len);
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <string.h>
+#include "head.h"
+
+// 目录的散列索引，可扩展散列。根按名字散列的高位把查找分到一个桶，桶里是 (散列, 目录项位置)，
+// 散列相同的再读出目录项比较名字，所以查找只碰根、一个桶和命中的目录项，
+// 和目录多大无关。桶满时按下一位分成两个，桶的位数已经等于根的位数时先把根加倍。
+// 根放不下更多桶，或者散列相同的项一个桶放不下时放弃索引，目录退回按顺序查找。
+// 删除时只从桶里去掉，桶不合并。
+bool use_dir_index = true;
+static dirIndexStat dir_index_stat;
+
+const dirIndexStat *GetDirIndexStat() { return &dir_index_stat; }
+
+// FNV-1a
+unsigned int NameHash(const char *name) {
+  unsigned int h = 2166136261u;
+  for (; *name != '\0'; ++name) {
+    h = (h ^ (unsigned char)*name) * 16777619u;
+  }
+  return h;
+}
+
+// 根最多的位数，桶号表要放得进一块
+static int maxDepth() {
+  const int slots = (GetSuperBlock()->block_size - sizeof(dirIndexRoot)) / sizeof(int);
+  int depth = 0;
+  while ((2 << depth) <= slots) {
+    ++depth;
+  }
+  return depth;
+}
+
+static int bucketCapacity() {
+  return (GetSuperBlock()->block_size - sizeof(dirIndexBucket)) / sizeof(dirIndexEntry);
+}
+
+static int *slots(dirIndexRoot *root) { return (int *)(root + 1); }
+
+static int slotOf(const dirIndexRoot *root, unsigned int hash) {
+  return root->depth == 0 ? 0 : hash >> (32 - root->depth);
+}
+
+static dirIndexEntry *entries(dirIndexBucket *bucket) { return (dirIndexEntry *)(bucket + 1); }
+
+static bool indexed(int dir) { return GetInode(dir)->flags & INODE_DIR_INDEX; }
+
+int DirIndexFind(int dir, const char *name, int *pos) {
+  if (!use_dir_index || !indexed(dir)) {
+    return DIR_UNINDEXED;
+  }
+  int b = 0;
+  dirIndexRoot *root = (dirIndexRoot *)DirIndexBlock(dir, 0, false, &b);
+  if (root == nullptr) {
+    return DIR_UNINDEXED;
+  }
+  ++dir_index_stat.lookups;
+  const unsigned int hash = NameHash(name);
+  dirIndexBucket *bucket =
+      (dirIndexBucket *)DirIndexBlock(dir, slots(root)[slotOf(root, hash)], false, &b);
+  if (bucket == nullptr) {
+    return DIR_UNINDEXED;
+  }
+
+  const dirIndexEntry *e = entries(bucket);
+  for (int i = 0; i < bucket->count; ++i) {
+    if (e[i].hash != hash) {
+      continue;
+    }
+    namedEntry entry;
+    if (ReadDirEntries(dir, e[i].pos, 1, &entry) == 1 && entry.file_id > 0 &&
+        strcmp(entry.name, name) == 0) {
+      ++dir_index_stat.hits;
+      if (pos != nullptr) {
+        *pos = e[i].pos;
+      }
+      return entry.file_id;
+    }
+  }
+  return -1;
+}
+
+// 把第 k 个桶按下一位分成两个，新桶放在最后
+static bool split(int dir, dirIndexRoot *root, int k, dirIndexBucket *bucket) {
+  if (bucket->depth == root->depth) {
+    if (root->depth == maxDepth()) {
+      return false;
+    }
+    // 根加倍：原来的第 s 项变成第 2s 和 2s + 1 项
+    int *slot = slots(root);
+    for (int s = (1 << root->depth) - 1; s >= 0; --s) {
+      slot[2 * s] = slot[2 * s + 1] = slot[s];
+    }
+    ++root->depth;
+  }
+
+  int b = 0;
+  const int fresh = root->buckets + 1;
+  dirIndexBucket *other = (dirIndexBucket *)DirIndexBlock(dir, fresh, true, &b);
+  if (other == nullptr) {
+    return false;
+  }
+  ++root->buckets;
+  const unsigned int bit = 1u << (31 - bucket->depth);
+  ++bucket->depth;
+  other->depth = bucket->depth;
+  other->count = 0;
+
+  dirIndexEntry *e = entries(bucket);
+  int kept = 0;
+  for (int i = 0; i < bucket->count; ++i) {
+    if (e[i].hash & bit) {
+      entries(other)[other->count++] = e[i];
+    } else {
+      e[kept++] = e[i];
+    }
+  }
+  bucket->count = kept;
+
+  // 指向这个桶、对应位为 1 的那一半根项改指新桶
+  int *slot = slots(root);
+  const int shift = root->depth - bucket->depth;
+  for (int s = 0; s < (1 << root->depth); ++s) {
+    if (slot[s] == k && ((s >> shift) & 1)) {
+      slot[s] = fresh;
+    }
+  }
+  PutBlock(b, true);
+  ++dir_index_stat.splits;
+  return true;
+}
+
+static bool insert(int dir, unsigned int hash, int pos) {
+  while (true) {
+    int root_b = 0;
+    int bucket_b = 0;
+    dirIndexRoot *root = (dirIndexRoot *)DirIndexBlock(dir, 0, true, &root_b);
+    if (root == nullptr) {
+      return false;
+    }
+    const int k = slots(root)[slotOf(root, hash)];
+    dirIndexBucket *bucket = (dirIndexBucket *)DirIndexBlock(dir, k, true, &bucket_b);
+    if (bucket == nullptr) {
+      return false;
+    }
+    if (bucket->count < bucketCapacity()) {
+      entries(bucket)[bucket->count++] = {hash, pos};
+      PutBlock(bucket_b, true);
+      return true;
+    }
+    const bool ok = split(dir, root, k, bucket);
+    PutBlock(root_b, true);
+    PutBlock(bucket_b, true);
+    if (!ok) {
+      return false;
+    }
+  }
+}
+
+void DirIndexAdd(int dir, const char *name, int pos) {
+  if (indexed(dir) && insert(dir, NameHash(name), pos) == false) {
+    DirIndexDrop(dir);
+  }
+}
+
+void DirIndexRemove(int dir, const char *name, int pos) {
+  if (!indexed(dir)) {
+    return;
+  }
+  int b = 0;
+  dirIndexRoot *root = (dirIndexRoot *)DirIndexBlock(dir, 0, false, &b);
+  if (root == nullptr) {
+    return;
+  }
+  const unsigned int hash = NameHash(name);
+  const int k = slots(root)[slotOf(root, hash)];
+  dirIndexBucket *bucket = (dirIndexBucket *)DirIndexBlock(dir, k, true, &b);
+  if (bucket == nullptr) {
+    DirIndexDrop(dir);
+    return;
+  }
+  dirIndexEntry *e = entries(bucket);
+  for (int i = 0; i < bucket->count; ++i) {
+    if (e[i].hash == hash && e[i].pos == pos) {
+      e[i] = e[--bucket->count];  // 桶里的项无序，最后一项补上来
+      break;
+    }
+  }
+  PutBlock(b, true);
+}
+
+bool DirIndexBuild(int dir) {
+  inode *d = GetInode(dir);
+  const int len = DirEntries(dir);
+  // 项数接近上限时很可能放不下，不用试
+  if (!use_dir_index || d->type != DIR_TYPE || !(d->flags & INODE_EXTENTS) || indexed(dir) ||
+      len > (1 << maxDepth()) * bucketCapacity() / 2) {
+    return false;
+  }
+
+  transaction t;
+  int root_b = 0;
+  int bucket_b = 0;
+  dirIndexRoot *root = (dirIndexRoot *)DirIndexBlock(dir, 0, true, &root_b);
+  dirIndexBucket *bucket = (dirIndexBucket *)DirIndexBlock(dir, 1, true, &bucket_b);
+  if (root == nullptr || bucket == nullptr) {
+    DirIndexFree(dir);
+    return false;
+  }
+  root->depth = 0;
+  root->buckets = 1;
+  slots(root)[0] = 1;
+  PutBlock(root_b, true);
+  PutBlock(bucket_b, true);
+
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < len; i += DIR_BATCH) {
+    const int count = ReadDirEntries(dir, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      if (batch[k].file_id > 0 && insert(dir, batch[k].hash, i + k) == false) {
+        DirIndexFree(dir);
+        ++dir_index_stat.drops;
+        return false;
+      }
+    }
+  }
+  d->flags |= INODE_DIR_INDEX;
+  PutInode(dir, true);
+  ++dir_index_stat.builds;
+  return true;
+}
+
+void DirIndexDrop(int dir) {
+  if (!indexed(dir)) {
+    return;
+  }
+  transaction t;
+  DirIndexFree(dir);
+  GetInode(dir)->flags &= ~INODE_DIR_INDEX;
+  PutInode(dir, true);
+  ++dir_index_stat.drops;
+}
@@ -0,0 +1,121 @@
+#include <set>
+#include <unordered_map>
+#include "head.h"
+
+// 目录空位。删掉的目录项只写一个删除标记，位置按目录记在内存里，新的目录项先放进最前面的空位，
+// 目录不会只增不减，也不会明明没几项却到了块数上限。删掉的项多了就压缩：末尾的项依次搬进
+// 前面的空位，目录截短到只剩有效的项，后面的块还回去；搬动的项同时改散列索引和目录项缓存。
+// 剩下的项很少时连散列索引也去掉。删掉的项不多时不压缩，空位留给之后新建的项。
+// 空位只在内存里，每个进程第一次用到一个目录时扫一遍，刷新文件系统后重新扫。
+// use_dir_slots 关掉时照常记空位，只是不用也不压缩，再打开时记的还是对的。
+bool use_dir_slots = true;
+static dirSlotStat slot_stat;
+
+typedef struct dirSlots {
+  std::set<int> free;  // 空位，从小到大
+} dirSlots;
+
+static std::unordered_map<int, dirSlots> dirs;
+
+const dirSlotStat *GetDirSlotStat() { return &slot_stat; }
+
+// 目录 dir 的空位，还没记过的扫一遍目录
+static dirSlots *load(int dir) {
+  auto it = dirs.find(dir);
+  if (it != dirs.end()) {
+    return &it->second;
+  }
+  if (dirs.size() >= DIR_SLOT_DIRS) {
+    dirs.erase(dirs.begin());  // 丢掉的目录下次用到时再扫
+  }
+
+  dirSlots *s = &dirs[dir];
+  const int len = DirEntries(dir);
+  namedEntry batch[DIR_BATCH];
+  for (int i = 0; i < len; i += DIR_BATCH) {
+    const int count = ReadDirEntries(dir, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      if (batch[k].file_id <= 0) {
+        s->free.insert(i + k);
+      }
+    }
+  }
+  return s;
+}
+
+int DirSlotTake(int dir) {
+  dirSlots *s = load(dir);
+  if (!use_dir_slots || s->free.empty()) {
+    return DirEntries(dir);
+  }
+  const int pos = *s->free.begin();
+  s->free.erase(s->free.begin());
+  ++slot_stat.reused;
+  return pos;
+}
+
+void DirSlotFree(int dir, int pos) { load(dir)->free.insert(pos); }
+
+// 目录 dir 占的块数
+static int blocksOf(int dir) {
+  const int block_size = GetSuperBlock()->block_size;
+  return (GetInode(dir)->length + block_size - 1) / block_size;
+}
+
+// 目录截短到 count 项之后，还回的块记进统计。剩下的项少到按顺序找也很快时去掉散列索引，
+// 留一半的余量，免得在 DIR_INDEX_MIN 上下反复建了又删
+static void shrink(int dir, int count, int blocks) {
+  transaction t;
+  TruncateDir(dir, count);
+  if (count < DIR_INDEX_MIN / 2) {
+    DirIndexDrop(dir);
+  }
+  slot_stat.freed_blocks += blocks - blocksOf(dir);
+}
+
+bool CompactDir(int dir) {
+  if (!use_dir_slots) {
+    return false;
+  }
+  dirSlots *s = load(dir);
+  const int len = DirEntries(dir);
+  const int dead = s->free.size();
+  const int blocks = blocksOf(dir);
+  if (dead < DIR_COMPACT_MIN || dead * 100 < len * DIR_COMPACT_PERCENT) {
+    return false;
+  }
+
+  // [live, len) 里的有效项正好和 [0, live) 里的空位一样多，按顺序一一对上
+  transaction t;
+  const int live = len - dead;
+  auto hole = s->free.begin();
+  namedEntry gone;
+  FillDirEntry(&gone, -1, "");
+  namedEntry batch[DIR_BATCH];
+  for (int i = live; i < len; i += DIR_BATCH) {
+    const int count = ReadDirEntries(dir, i, DIR_BATCH, batch);
+    for (int k = 0; k < count; ++k) {
+      const namedEntry &e = batch[k];
+      if (e.file_id <= 0) {
+        continue;
+      }
+      const int to = *hole++;
+      WriteDirEntry(dir, to, &e);
+      WriteDirEntry(dir, i + k, &gone);
+      DirIndexRemove(dir, e.name, i + k);
+      DirIndexAdd(dir, e.name, to);
+      DentrySet(dir, e.name, e.file_id, to);
+      ++slot_stat.moved;
+      JournalCheckpoint();  // 原位置已经删掉，每搬一项目录都是完整的
+    }
+  }
+
+  shrink(dir, live, blocks);
+  s->free.clear();
+  ++slot_stat.compactions;
+  return true;
+}
+
+void DirSlotForget(int dir) { dirs.erase(dir); }
+
+void ResetDirSlots() { dirs.clear(); }
@@ -5,21 +5,167 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <vector>
 #include "head.h"
 
 int fd = -1;
 char *memory = nullptr;
 bool need_log = true;
+io_type io_mode = IO_PWRITE;
+bool warm_up = false;
+bool discard_blocks = false;
+static std::vector<int> discards;  // 释放过、等落盘后打洞的块
+
+// IO_MMAP 下映射和文件共享页；IO_PWRITE 下映射是私有的，只有缓冲池写回的内容才会进入文件，
+// 这样没提交的事务不会被内核提前刷到磁盘上。写过的页成了私有内存，缓冲池写回落盘后再丢掉。
+static char *map_disk(size_t size) {
+  int flags = io_mode == IO_MMAP ? MAP_SHARED : MAP_PRIVATE | MAP_NORESERVE;
+  return (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+}
 
+// 内存中的内容要么就是文件页，要么已经由缓冲池写回，不需要再整体写回一遍。
 bool CloseFileSystem() {
-  assert(pwrite(fd, memory, DISK_SIZE, 0) == DISK_SIZE);
+  DropAppend(0);
+  SyncBuffer();
+  ClearJournal();
+  IoClose();
+  ResetBuffer();
+  munmap(memory, GetSuperBlock()->disk_size);
+  memory = nullptr;
   close(fd);
   return true;
 }
 
+// 给 [offset, offset + length) 所在的页加上访问提示。
+static void advise(long long offset, long long length, int advice) {
+  static const long long page = sysconf(_SC_PAGESIZE);
+  long long begin = offset / page * page;
+  long long end = (offset + length + page - 1) / page * page;
+  madvise(memory + begin, std::min(end, GetSuperBlock()->disk_size) - begin, advice);
+}
+
+// inode 表按编号扫描，预读有用；数据块的访问没有规律，预读只会白白占内存。
+static void advise_layout() {
+  superBlock *super = GetSuperBlock();
+  advise(super->inode_offset, (long long)INODE_SIZE * super->inode_count, MADV_SEQUENTIAL);
+  advise(super->data_offset, (long long)super->block_size * super->block_count, MADV_RANDOM);
+}
+
+// 预取 [offset, offset + length)。
+static void prefetch(long long offset, long long length) {
+#ifdef MADV_POPULATE_READ
+  advise(offset, length, MADV_POPULATE_READ);  // 连页表一起建好，之后访问不再缺页
+#else
+  advise(offset, length, MADV_WILLNEED);
+#endif
+}
+
+// 预取一个文件的 inode 和前 MAX_FIRST_INDEX 块，连续的一段一起预取。
+static void prefetch_file(int index) {
+  superBlock *super = GetSuperBlock();
+  inode *n = GetInode(index);
+  prefetch(super->inode_offset + (long long)INODE_SIZE * index, INODE_SIZE);
+  for (int i = 0; i < MAX_FIRST_INDEX;) {
+    int len = 0;
+    int b = LookupBlock(n, i, &len);
+    if (b <= 0 || b >= super->block_count) {
+      ++i;
+      continue;
+    }
+    len = std::min({len, MAX_FIRST_INDEX - i, super->block_count - b});
+    prefetch(super->data_offset + (long long)super->block_size * b,
+             (long long)super->block_size * len);
+    i += len;
+  }
+}
+
+static long long align_up(long long x, long long a) { return (x + a - 1) / a * a; }
+
+// 根据格式化参数计算各区域的位置，写进超级块。inode 和数据块各自编号。
+static bool make_geometry(const geometry *geo, superBlock *super) {
+  long long disk_size = geo->disk_size > 0 ? geo->disk_size : DEFAULT_DISK_SIZE;
+  int block_size = geo->block_size > 0 ? geo->block_size : DEFAULT_BLOCK_SIZE;
+  int journal_blocks = geo->journal_blocks > 0 ? geo->journal_blocks : DEFAULT_JOURNAL_BLOCKS;
+
+  if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+      (block_size & (block_size - 1)) != 0) {
+    fprintf(stderr, "块大小必须是[%d, %d]之间2的幂\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+    return false;
+  }
+
+  if (journal_blocks < 2) {
+    fprintf(stderr, "日志区至少需要2块\n");
+    return false;
+  }
+
+  const long long align = std::max(block_size, 4096);  // 至少按页对齐，方便 mmap 和 msync
+  long long journal_offset = align_up(SUPER_BLOCK_SIZE, align);
+  long long inode_offset = align_up(journal_offset + (long long)journal_blocks * block_size, align);
+  long long inode_count = geo->inode_count;
+
+  if (inode_count <= 0) {
+    inode_count = (disk_size - inode_offset) / (DEFAULT_BYTES_PER_INODE + INODE_SIZE);
+  }
+
+  // 位图按 8 字节补齐，方便按字查找。块位图按剩余空间能放下的最多块数留位。
+  long long inode_bitmap_offset = align_up(inode_offset + inode_count * INODE_SIZE, align);
+  long long epoch_offset = align_up(inode_bitmap_offset + align_up((inode_count + 7) / 8, 8), align);
+  long long bitmap_offset = align_up(epoch_offset + inode_count * sizeof(int), align);
+  long long max_blocks = (disk_size - bitmap_offset) / block_size;
+  long long bitmap_bytes =
+      geo->allocator == ALLOC_BITMAP && max_blocks > 0 ? align_up((max_blocks + 7) / 8, 8) : 0;
+  long long refcount_offset = align_up(bitmap_offset + bitmap_bytes, align);
+  long long refcount_bytes = max_blocks > 0 ? align_up(max_blocks * sizeof(unsigned short), 8) : 0;
+  long long data_offset = align_up(refcount_offset + refcount_bytes, align);
+  long long block_count = (disk_size - data_offset) / block_size;
+
+  if (block_count < 16 || inode_count < 16 || block_count >= INT32_MAX ||
+      inode_count >= INT32_MAX) {
+    fprintf(stderr, "镜像太小或者太大，无法格式化\n");
+    return false;
+  }
+
+  super->magic = SUPER_MAGIC;
+  super->block_size = block_size;
+  super->disk_size = disk_size;
+  super->block_count = block_count;
+  super->inode_count = inode_count;
+  super->journal_blocks = journal_blocks;
+  super->group_size = std::min(FREE_GROUP_SIZE, block_size / (int)sizeof(int)) - 1;
+  super->journal_offset = journal_offset;
+  super->inode_offset = inode_offset;
+  super->free_inodes = inode_count - 1;
+  super->free_blocks = block_count - 1;
+  super->inode_bitmap_offset = inode_bitmap_offset;
+  super->epoch_offset = epoch_offset;
+  super->bitmap_offset = bitmap_offset;
+  super->refcount_offset = refcount_offset;
+  super->data_offset = data_offset;
+  super->allocator = geo->allocator;
+  super->compress = geo->compress;
+  super->alloc_hint = 1;
+  super->inode_hint = 1;
+  return true;
+}
+
 // 格式化
-bool FormatFileSystem(const char *file_name) {
+bool FormatFileSystem(const char *file_name, const geometry *geo) {
+  geometry default_geo;
+  superBlock config;
+  memset(&config, 0, sizeof(config));
+  if (make_geometry(geo != nullptr ? geo : &default_geo, &config) == false) {
+    return false;
+  }
+
+  IoClose();  // 上一个镜像没关闭的话，先把它在途的写写完，不能写到新文件里
+  discards.clear();
+  ResetSnapshots();
+  ResetClusterCache();
+  ResetDentryCache();
+  ResetDirSlots();
   fd = open(file_name, O_CREAT | O_RDWR | O_TRUNC, 0b111111111);
 
   if (fd < 0) {
@@ -27,23 +173,30 @@ bool FormatFileSystem(const char *file_name) {
     return false;
   }
 
-  ftruncate(fd, DISK_SIZE);
-  memory = (char *)mmap(NULL, DISK_SIZE, PROT_WRITE | PROT_READ, MAP_SHARED, fd, 0);
+  // O_TRUNC 之后再 ftruncate 得到的是全零的稀疏文件，不需要 memset
+  ftruncate(fd, config.disk_size);
+  memory = map_disk(config.disk_size);
   // 共享内存。
   if (memory == MAP_FAILED) {
     fprintf(stderr, "格式化文件系统失败。");
     return false;
   }
 
-  memset(memory, 0, DISK_SIZE);
+  IoOpen();
+
+  // 格式化本身不需要原子性，不记日志
+  bool journal = use_journal;
+  use_journal = false;
+  ResetBuffer();
   superBlock *super = GetSuperBlock();
+  memcpy(super, &config, sizeof(config));
+  advise_layout();
+
+  // 所有块都还没用过，成组链接为空，分配时再从 free_tail 逐组取出，格式化的代价和镜像大小无关。
   super->stack_num = 1;
   super->stack[0] = 0;
-
-  // 把所有块进行初始化
-  for (int i = MAX_BLOCK_NUMBER - 1; i >= 1; --i) {
-    ReleaseDataBlock(i);
-  }
+  super->free_tail = 1;
+  BitmapInit();
 
   // 根目录设置为空，谁都可以进行创建和删除文件。
   super->root_dir_id = NewFile(DIR_TYPE, "/", "");
@@ -56,15 +209,26 @@ bool FormatFileSystem(const char *file_name) {
   inode *user_info = GetInode(super->user_info_id);
   user_info->link_cnt = -1;
   user_info->last_dir = -1;
+  PutInode(root_dir->id, true);
+  PutInode(user_info->id, true);
+  PutSuperBlock(true);
 
   // user_info_id应该永远都在open_file中
   open_file.insert(super->user_info_id);
+  current_dir_index = super->root_dir_id;  // 换了文件系统，从根目录开始
   UserAdd("root", "root", "root");
-  assert(pwrite(fd, memory, DISK_SIZE, 0) == DISK_SIZE);
+  SyncBuffer();
+  use_journal = journal;
   return true;
 }
 
 bool OpenFileSystem(const char *file_name) {
+  IoClose();
+  discards.clear();
+  ResetSnapshots();
+  ResetClusterCache();
+  ResetDentryCache();
+  ResetDirSlots();
   fd = open(file_name, O_CREAT | O_RDWR, 0b111111111);
 
   if (fd < 0) {
@@ -74,88 +238,181 @@ bool OpenFileSystem(const char *file_name) {
 
   struct stat s;
   fstat(fd, &s);
-  if (s.st_size != DISK_SIZE) {
+  if (s.st_size < SUPER_BLOCK_SIZE) {
     close(fd);
     return FormatFileSystem(file_name);
   }
 
   // 共享内存
-  memory = (char *)mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  memory = map_disk(s.st_size);
 
   if (memory == MAP_FAILED) {
     fprintf(stderr, "文件系统打开失败。");
     return false;
   }
 
-  // 读取
-  assert(pread(fd, memory, DISK_SIZE, 0) == DISK_SIZE);
+  // 几何信息以超级块为准，对不上说明不是本文件系统的镜像，重新格式化。
+  superBlock *super = GetSuperBlock();
+  if (super->magic != SUPER_MAGIC || super->disk_size != s.st_size) {
+    munmap(memory, s.st_size);
+    close(fd);
+    return FormatFileSystem(file_name);
+  }
+
+  // 映射的就是文件本身，访问时按需缺页，不需要再 pread 一遍。
+  ResetBuffer();
+  ReplayJournal();
+  IoOpen();
+  advise_layout();
+
+  // 启动后马上就要用到超级块、根目录和用户表，其余的等用到再缺页。
+  if (warm_up) {
+    prefetch(0, SUPER_BLOCK_SIZE);
+    prefetch_file(super->root_dir_id);
+    prefetch_file(super->user_info_id);
+  }
+  current_dir_index = super->root_dir_id;  // 上次的当前目录在这个镜像里不一定还在
   return true;
 }
 
+// 多进程共享：IO_PWRITE 下映射是私有的，其他进程写回文件的内容看不到。
+// 拿到锁之后先把自己的修改写回，再丢掉私有页，之后访问时重新从文件缺页。
+void RefreshFileSystem() {
+  FlushBuffer();
+  if (io_mode == IO_PWRITE) {
+    madvise(memory, GetSuperBlock()->disk_size, MADV_DONTNEED);
+  }
+  ResetSnapshots();  // 其他进程可能建了快照
+  ResetClusterCache();
+  ResetDentryCache();
+  ResetDirSlots();
+}
+
+int MaxFileSize() {
+  const int block_size = GetSuperBlock()->block_size;
+  return (MAX_FIRST_INDEX + block_size / (int)sizeof(int)) * block_size;
+}
+
 /*----------------------几个指针强转型实现--------------------------------------------------*/
 superBlock *GetSuperBlock() { return (superBlock *)memory; }
 
-inode *GetInode(int index) { return (inode *)(memory + INODE_OFFSET + INODE_SIZE * index); }
+inode *GetInode(int index) {
+  return (inode *)(memory + GetSuperBlock()->inode_offset + (long long)INODE_SIZE * index);
+}
 
 dataBlock *GetBlock(int index) {
-  return (dataBlock *)(memory + DATA_BLOCK_OFFSET + BLOCK_SIZE * index);
+  superBlock *super = GetSuperBlock();
+  return (dataBlock *)(memory + super->data_offset + (long long)super->block_size * index);
 }
 
 indexBlock *GetIndexBlock(int index) { return (indexBlock *)GetBlock(index); }
 
+// Put* 不再直接 pwrite，而是交给缓冲池标记脏帧，由缓冲池决定何时写回。
 void PutBlock(int index, bool write) {
   if (write) {
     LOG("刷新块[%d]\n", index);
-    dataBlock *block = GetBlock(index);
-    assert(pwrite(fd, block, BLOCK_SIZE, DATA_BLOCK_OFFSET + BLOCK_SIZE * index) == BLOCK_SIZE);
   }
+  superBlock *super = GetSuperBlock();
+  BufferPut(super->data_offset + (long long)super->block_size * index, super->block_size, write);
 }
 
+// 普通文件的内容不进日志，组提交时先于元数据写回(有序模式)。
+void PutDataBlock(int index, bool write) {
+  superBlock *super = GetSuperBlock();
+  BufferPut(super->data_offset + (long long)super->block_size * index, super->block_size, write,
+            false);
+}
+
+// inode 按所在的整页写回，同一页上的几个 inode 修改只写一次，也不会出现 128 字节的小写。
 void PutInode(int index, bool write) {
   if (write) {
     LOG("刷新inode[%d]\n", index);
-    inode *n = GetInode(index);
-    assert(pwrite(fd, n, INODE_SIZE, INODE_OFFSET + INODE_SIZE * index) == INODE_SIZE);
   }
+  superBlock *super = GetSuperBlock();
+  long long page = (long long)INODE_SIZE * index / INODE_PAGE_SIZE * INODE_PAGE_SIZE;
+  long long table = (long long)INODE_SIZE * super->inode_count;
+  BufferPut(super->inode_offset + page, std::min<long long>(INODE_PAGE_SIZE, table - page), write);
 }
 
-void PutSuperBlock(bool write) {
-  if (write) {
-    assert(pwrite(fd, GetSuperBlock(), BLOCK_SIZE, 0) == BLOCK_SIZE);
-  }
+void PutSuperBlock(bool write) { BufferPut(0, SUPER_BLOCK_SIZE, write); }
+
+int *InodeEpoch(int index) {
+  return (int *)(memory + GetSuperBlock()->epoch_offset) + index;
+}
+
+void PutEpoch(int index) {
+  superBlock *super = GetSuperBlock();
+  long long offset = (long long)sizeof(int) * index;
+  BufferPut(super->epoch_offset + offset / super->block_size * super->block_size,
+            super->block_size, true);
 }
 /*----------------------几个指针强转型实现--------------------------------------------------*/
 
 /*----------------------对超级块进行操作实现分配释放-----------------------------------------*/
+// 组长块里存的是 [stack_num, stack[0..group_size)]，和超级块末尾的布局相同。
+// 分配和释放都只改元数据，块里的旧内容不清零：写文件时没写到的部分由 file.cpp 清零，
+// 预分配的块标记为未写，读出来是全零；当作索引的块由使用者自己初始化。
+
+int AllocInode() {
+  int ret = InodeBitmapAlloc();
+  if (ret > 0) {
+    memset(GetInode(ret), 0, INODE_SIZE);
+    PutInode(ret, true);
+  }
+  return ret;
+}
+
+void ReleaseInode(int index) {
+  memset(GetInode(index), 0, INODE_SIZE);
+  PutInode(index, true);
+  InodeBitmapRelease(index);
+}
+
 int AllocDataBlock() {
   superBlock *super = GetSuperBlock();
   int ret = 0;
-  constexpr int max_length = (sizeof(super->stack) / sizeof(int)) - 1;
+  const int max_length = super->group_size;
+  const int block_count = super->block_count;
+
+  if (super->allocator == ALLOC_BITMAP) {
+    int len = 0;
+    ret = BitmapAlloc(1, &len);
+    if (ret > 0) {
+      --super->free_blocks;
+      PutSuperBlock(true);
+    }
+    return ret;
+  }
 
   // 超级栈不足
   while (super->stack_num <= 1 && super->stack[0] != 0) {
     int block = super->stack[0];
 
-    if (block <= 0 || block >= MAX_BLOCK_NUMBER) {
+    if (block <= 0 || block >= block_count) {
       break;
     }
 
-    int root = super->root_dir_id;
-    int user = super->user_info_id;
-    memcpy(super, GetBlock(block), BLOCK_SIZE);
-
+    memcpy(&super->stack_num, GetBlock(block), sizeof(int) * (max_length + 1));
     super->stack_num = max_length;
-    super->root_dir_id = root;
-    super->user_info_id = user;
 
     // 把信息拷贝到超级栈中。
-    if (super->stack[0] >= MAX_BLOCK_NUMBER) {
+    if (super->stack[0] >= block_count) {
       super->stack_num = 0;
     }
   }
 
+  // 成组链接用完了，从没用过的尾部取下一组。栈底 stack[0] 仍然是 0，表示链接结束。
+  if (super->stack_num <= 1 && super->stack[0] == 0 && super->free_tail < block_count) {
+    int end = std::min(block_count, super->free_tail + max_length - 1);
+    super->stack_num = 1;
+    for (int i = end - 1; i >= super->free_tail; --i) {
+      super->stack[super->stack_num++] = i;
+    }
+    super->free_tail = end;
+  }
+
   // 超级栈充足时，从超级栈中分配
-  if (super->stack_num > 1 || (super->stack[0] > 0 && super->stack[0] < MAX_BLOCK_NUMBER)) {
+  if (super->stack_num > 1 || (super->stack[0] > 0 && super->stack[0] < block_count)) {
     ret = super->stack[--super->stack_num];
     LOG("分配块%d\n", ret);
   } else {
@@ -163,28 +420,93 @@ int AllocDataBlock() {
     LOG("块不足\n");
   }
 
+  // 计数和超级栈一起改完再交给缓冲池
+  if (ret > 0 && ret < block_count) {
+    --super->free_blocks;
+  }
   PutSuperBlock(true);
+  return ret >= block_count || ret <= 0 ? 0 : ret;
+}
 
-  // 清空
-  if (ret > 0) {
-    memset(GetInode(ret), 0, INODE_SIZE);
-    memset(GetBlock(ret), 0, BLOCK_SIZE);
-    PutInode(ret, true);
-    PutBlock(ret, true);
+int AllocExtent(int n, int *len) {
+  if (GetSuperBlock()->allocator != ALLOC_BITMAP) {
+    int ret = AllocDataBlock();
+    *len = ret > 0 ? 1 : 0;
+    return ret;
   }
-  return ret >= MAX_BLOCK_NUMBER || ret <= 0 ? 0 : ret;
+
+  int ret = BitmapAlloc(n, len);
+  GetSuperBlock()->free_blocks -= *len;
+  PutSuperBlock(true);
+  return ret;
+}
+
+// 共享计数，和位图一样按块交给缓冲池进日志
+static unsigned short *refcount(int index) {
+  return (unsigned short *)(memory + GetSuperBlock()->refcount_offset) + index;
+}
+
+static void put_refcount(int index) {
+  superBlock *super = GetSuperBlock();
+  long long offset = (long long)sizeof(unsigned short) * index;
+  BufferPut(super->refcount_offset + offset / super->block_size * super->block_size,
+            super->block_size, true);
+}
+
+bool ShareDataBlock(int index) {
+  if ((*refcount(index) & ~REFCOUNT_DEDUP) == MAX_SHARED) {
+    return false;
+  }
+  ++*refcount(index);
+  put_refcount(index);
+  return true;
+}
+
+int DataBlockRefs(int index) { return (*refcount(index) & ~REFCOUNT_DEDUP) + 1; }
+
+bool DataBlockShared(int index) { return *refcount(index) != 0; }
+
+void MarkDedupBlock(int index) {
+  *refcount(index) |= REFCOUNT_DEDUP;
+  put_refcount(index);
 }
 
 void ReleaseDataBlock(int index) {
   superBlock *super = GetSuperBlock();
-  constexpr int max_length = (sizeof(super->stack) / sizeof(int)) - 1;
+  const int max_length = super->group_size;
+
+  // 还有别的文件在用，只少一个使用者
+  if ((*refcount(index) & ~REFCOUNT_DEDUP) > 0) {
+    --*refcount(index);
+    put_refcount(index);
+    return;
+  }
+
+  // 在索引里的块没被改过，趁内容还在按指纹把它从索引里去掉
+  if (*refcount(index) & REFCOUNT_DEDUP) {
+    DedupForget(index);
+    *refcount(index) = 0;
+    put_refcount(index);
+  }
+
+  ++super->free_blocks;
+  if (super->allocator == ALLOC_BITMAP) {
+    BitmapRelease(index);
+    PutSuperBlock(true);
+    if (discard_blocks) {
+      discards.push_back(index);
+    }
+    return;
+  }
+
   super->stack[super->stack_num++] = index;  // 追加到尾部
 
   // 如果太大, 分组分块, 注意到, 分配之后的块的组长块就是最后释放的块.
   // 所以，如果超级栈如果不足，需要拉取组长的块的时候，第一个被分配的就是组长块
   while (super->stack_num >= max_length) {
-    memcpy(GetBlock(index), super, BLOCK_SIZE);  // 既是组长块也是空闲块。
-    super->stack[0] = index;                     // 指向下一个组长块
+    // 既是组长块也是空闲块。
+    memcpy(GetBlock(index), &super->stack_num, sizeof(int) * (max_length + 1));
+    super->stack[0] = index;  // 指向下一个组长块
     super->stack_num = 1;
     PutBlock(index, true);
   }
@@ -192,6 +514,34 @@ void ReleaseDataBlock(int index) {
   PutSuperBlock(true);
   LOG("释放块%d\n", index);
 }
+
+// 成组链接的空闲块里存着组长信息，不能打洞，只有位图分配器支持。
+// 释放到落盘之间块可能又被分配出去，打洞前再查一次位图。
+int DiscardBlocks() {
+  std::sort(discards.begin(), discards.end());
+  discards.erase(std::unique(discards.begin(), discards.end()), discards.end());
+  const superBlock *super = GetSuperBlock();
+  int ret = 0;
+  for (size_t i = 0; i < discards.size();) {
+    if (BitmapUsed(discards[i])) {
+      ++i;
+      continue;
+    }
+    size_t j = i + 1;
+    while (j < discards.size() && discards[j] == discards[j - 1] + 1 && !BitmapUsed(discards[j])) {
+      ++j;
+    }
+    long long offset = super->data_offset + (long long)super->block_size * discards[i];
+    long long length = (long long)super->block_size * (j - i);
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) != 0) {
+      break;  // 宿主文件系统不支持打洞
+    }
+    ret += j - i;
+    i = j;
+  }
+  discards.clear();
+  return ret;
+}
 /*----------------------对超级块进行操作实现分配释放-----------------------------------------*/
 
-// void FlushDisk() { assert(pwrite(fd, memory, DISK_SIZE, 0) == DISK_SIZE); }
\ No newline at end of file
+// void FlushDisk() { assert(pwrite(fd, memory, GetSuperBlock()->disk_size, 0) == GetSuperBlock()->disk_size); }
\ No newline at end of file
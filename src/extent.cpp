@@ -0,0 +1,361 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "head.h"
+
+// 区段树：把文件的逻辑块映射到物理块，每一项描述一段连续的块。
+// 树根在 inode 的 first_index 区域，只能放 ROOT_EXTENTS 项；放不下时根的内容搬到新块，
+// 根变成索引节点。其余节点各占一块，满了就对半分裂，新节点插到上一层。
+// 索引项的 logical 是子树中最小的逻辑块，查找时取最后一个 logical <= 目标的项。
+// 所有修改都在叶子上做：先把叶子读成数组，改完再写回，写回时放不下就分裂。
+// 去掉映射后空了的节点还回去，从上一层删掉指向它的项；根只剩一个孩子又放得下时把孩子收进根，
+// 树矮一层。反复打洞、截短之后树的大小跟着区段数走，不会停在最大的样子。
+
+typedef struct extentNode {
+  extentHeader *header;
+  extent *entries;
+  int capacity;
+  int block;  // 0 表示在 inode 里的根
+} extentNode;
+
+typedef struct pathItem {
+  extentNode node;
+  int pos;  // 在这一层选中的项
+} pathItem;
+
+static extentNode root_node(const inode *n) {
+  char *p = (char *)n->first_index;
+  return extentNode{(extentHeader *)p, (extent *)(p + sizeof(extentHeader)), ROOT_EXTENTS, 0};
+}
+
+static extentNode block_node(int block) {
+  char *p = GetBlock(block)->content;
+  int capacity = (GetSuperBlock()->block_size - sizeof(extentHeader)) / sizeof(extent);
+  return extentNode{(extentHeader *)p, (extent *)(p + sizeof(extentHeader)), capacity, block};
+}
+
+// 树节点是元数据，要进日志。
+static void put_node(inode *n, const extentNode &x) {
+  if (x.block == 0) {
+    PutInode(n->id, true);
+  } else {
+    PutBlock(x.block, true);
+  }
+}
+
+// 最后一个 logical <= target 的项，都比 target 大时返回 0。
+static int find(const extentNode &x, int target) {
+  int lo = 0;
+  int hi = x.header->entries;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (x.entries[mid].logical <= target) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return std::max(lo - 1, 0);
+}
+
+static void descend(const inode *n, int logical, std::vector<pathItem> *path) {
+  path->clear();
+  extentNode x = root_node(n);
+  while (true) {
+    int pos = find(x, logical);
+    path->push_back(pathItem{x, pos});
+    if (x.header->depth == 0 || x.header->entries == 0) {
+      break;
+    }
+    x = block_node(x.entries[pos].start);
+  }
+}
+
+static void fill(inode *n, const extentNode &x, const std::vector<extent> &items) {
+  memcpy(x.entries, items.data(), items.size() * sizeof(extent));
+  x.header->entries = items.size();
+  put_node(n, x);
+}
+
+// 把 items 写回第 level 层的节点，放不下就分裂。
+static bool store(inode *n, std::vector<pathItem> *path, int level, std::vector<extent> items) {
+  extentNode x = (*path)[level].node;
+
+  if (items.empty() && x.block != 0) {
+    // 节点空了：还回这一块，上一层去掉指向它的项
+    pathItem &parent = (*path)[level - 1];
+    std::vector<extent> parent_items(parent.node.entries,
+                                     parent.node.entries + parent.node.header->entries);
+    parent_items.erase(parent_items.begin() + parent.pos);
+    ReleaseDataBlock(x.block);
+    path->resize(level);
+    return store(n, path, level - 1, parent_items);
+  }
+
+  if ((int)items.size() <= x.capacity) {
+    if (items.empty()) {
+      x.header->depth = 0;  // 只有根会空着留下来，整棵树没有映射了
+    }
+    fill(n, x, items);
+    // 子树最小的逻辑块变了，上层的键跟着改
+    for (int l = level; l > 0 && !items.empty(); --l) {
+      pathItem &parent = (*path)[l - 1];
+      extent &key = parent.node.entries[parent.pos];
+      if (key.logical == items[0].logical) {
+        break;
+      }
+      key.logical = items[0].logical;
+      put_node(n, parent.node);
+      if (parent.pos != 0) {
+        break;
+      }
+    }
+    return true;
+  }
+
+  if (x.block == 0) {
+    // 根放不下：内容搬到新块，根变成只有一项的索引，树长高一层
+    int b = AllocDataBlock();
+    if (b <= 0) {
+      return false;
+    }
+    extentNode child = block_node(b);
+    child.header->depth = x.header->depth;
+    child.header->entries = 0;
+    x.header->depth += 1;
+    std::vector<extent> root_items{extent{items[0].logical, b, 0, 0}};
+    fill(n, x, root_items);
+    (*path)[0].pos = 0;
+    path->insert(path->begin() + 1, pathItem{child, 0});
+    return store(n, path, 1, items);
+  }
+
+  // 对半分裂，右半放到新块
+  int b = AllocDataBlock();
+  if (b <= 0) {
+    return false;
+  }
+  extentNode right = block_node(b);
+  right.header->depth = x.header->depth;
+  const int half = items.size() / 2;
+  std::vector<extent> left_items(items.begin(), items.begin() + half);
+  std::vector<extent> right_items(items.begin() + half, items.end());
+  fill(n, right, right_items);
+
+  pathItem &parent = (*path)[level - 1];
+  std::vector<extent> parent_items(parent.node.entries,
+                                   parent.node.entries + parent.node.header->entries);
+  parent_items.insert(parent_items.begin() + parent.pos + 1,
+                      extent{right_items[0].logical, b, 0, 0});
+  if (store(n, path, level, left_items) == false) {
+    return false;
+  }
+  return store(n, path, level - 1, parent_items);
+}
+
+// 从 logical 开始(含)第一个还没结束的区段，没有返回 false。
+static bool next_extent(const inode *n, int logical, extent *out) {
+  std::vector<pathItem> path;
+  while (true) {
+    descend(n, logical, &path);
+    const extentNode &leaf = path.back().node;
+    for (int i = path.back().pos; i < leaf.header->entries; ++i) {
+      const extent &e = leaf.entries[i];
+      if (e.logical + e.len > logical) {
+        *out = e;
+        return true;
+      }
+    }
+
+    // 这个叶子里没有了，找右边的兄弟子树
+    int level = path.size() - 2;
+    while (level >= 0 && path[level].pos + 1 >= path[level].node.header->entries) {
+      --level;
+    }
+    if (level < 0) {
+      return false;
+    }
+    int next = path[level].node.entries[path[level].pos + 1].logical;
+    if (next <= logical) {
+      return false;
+    }
+    logical = next;
+  }
+}
+
+// 根只剩一个孩子、孩子的项放得进根时，把孩子收进根，还回孩子的块
+static void collapse(inode *n) {
+  extentNode root = root_node(n);
+  while (root.header->depth > 0 && root.header->entries == 1) {
+    extentNode child = block_node(root.entries[0].start);
+    if (child.header->entries > root.capacity) {
+      break;
+    }
+    std::vector<extent> items(child.entries, child.entries + child.header->entries);
+    root.header->depth = child.header->depth;
+    fill(n, root, items);
+    ReleaseDataBlock(child.block);
+  }
+}
+
+// 去掉 [begin, end) 的映射，区段被截成前后两段。release 时把去掉的块还回去。
+static bool unmap(inode *n, int begin, int end, bool release) {
+  extent e;
+  std::vector<pathItem> path;
+  while (begin < end && next_extent(n, begin, &e) && e.logical < end) {
+    const int cut_begin = std::max(begin, e.logical);
+    const int cut_end = std::min(end, e.logical + e.len);
+
+    descend(n, e.logical, &path);
+    const extentNode &leaf = path.back().node;
+    std::vector<extent> items(leaf.entries, leaf.entries + leaf.header->entries);
+    auto it = std::find_if(items.begin(), items.end(),
+                           [&](const extent &x) { return x.logical == e.logical; });
+    int pos = it - items.begin();
+    items.erase(it);
+
+    if (cut_end < e.logical + e.len) {
+      int skip = cut_end - e.logical;
+      items.insert(items.begin() + pos,
+                   extent{cut_end, e.start + skip, (unsigned short)(e.len - skip), e.flags});
+    }
+    if (cut_begin > e.logical) {
+      items.insert(items.begin() + pos,
+                   extent{e.logical, e.start, (unsigned short)(cut_begin - e.logical), e.flags});
+    }
+    if (store(n, &path, path.size() - 1, items) == false) {
+      return false;
+    }
+    if (release) {
+      for (int b = cut_begin; b < cut_end; ++b) {
+        ReleaseDataBlock(e.start + b - e.logical);
+      }
+    }
+    begin = cut_end;
+  }
+  collapse(n);
+  return true;
+}
+
+// 插入一段新映射，前提是 [e.logical, e.logical + e.len) 没有映射。能和左右邻居合并就合并。
+static bool insert(inode *n, extent e) {
+  std::vector<pathItem> path;
+  descend(n, e.logical, &path);
+  const extentNode &leaf = path.back().node;
+  std::vector<extent> items(leaf.entries, leaf.entries + leaf.header->entries);
+  int pos = 0;
+  while (pos < (int)items.size() && items[pos].logical < e.logical) {
+    ++pos;
+  }
+
+  auto joinable = [](const extent &a, const extent &b) {
+    return a.logical + a.len == b.logical && a.start + a.len == b.start && a.flags == b.flags &&
+           a.len + b.len <= MAX_EXTENT_LEN;
+  };
+
+  if (pos > 0 && joinable(items[pos - 1], e)) {
+    e.logical = items[pos - 1].logical;
+    e.start = items[pos - 1].start;
+    e.len += items[pos - 1].len;
+    items.erase(items.begin() + --pos);
+  }
+  if (pos < (int)items.size() && joinable(e, items[pos])) {
+    e.len += items[pos].len;
+    items.erase(items.begin() + pos);
+  }
+  items.insert(items.begin() + pos, e);
+  return store(n, &path, path.size() - 1, items);
+}
+
+int ExtentLookup(const inode *n, int logical, int *len, int *flags) {
+  extentNode x = root_node(n);
+  while (x.header->depth > 0 && x.header->entries > 0) {
+    x = block_node(x.entries[find(x, logical)].start);
+  }
+
+  if (x.header->entries > 0) {
+    const extent &e = x.entries[find(x, logical)];
+    if (logical >= e.logical && logical < e.logical + e.len) {
+      if (len != nullptr) {
+        *len = e.logical + e.len - logical;
+      }
+      if (flags != nullptr) {
+        *flags = e.flags;
+      }
+      return e.start + logical - e.logical;
+    }
+  }
+
+  if (len != nullptr) {
+    *len = 0;
+  }
+  if (flags != nullptr) {
+    *flags = 0;
+  }
+  return 0;
+}
+
+bool ExtentMap(inode *n, int logical, int start, int len, int flags) {
+  if (unmap(n, logical, logical + len, false) == false) {
+    return false;
+  }
+
+  while (len > 0) {
+    int l = std::min(len, MAX_EXTENT_LEN);
+    if (insert(n, extent{logical, start, (unsigned short)l, (unsigned short)flags}) == false) {
+      return false;
+    }
+    logical += l;
+    start += l;
+    len -= l;
+  }
+  return true;
+}
+
+bool ExtentUnmap(inode *n, int logical, int len) {
+  return unmap(n, logical, logical + len, true);
+}
+
+static void free_node(const extentNode &x) {
+  for (int i = 0; i < x.header->entries; ++i) {
+    const extent &e = x.entries[i];
+    if (x.header->depth > 0) {
+      free_node(block_node(e.start));
+      ReleaseDataBlock(e.start);
+      continue;
+    }
+    for (int b = e.start; b < e.start + e.len; ++b) {
+      ReleaseDataBlock(b);
+    }
+  }
+}
+
+void ExtentFree(inode *n) {
+  extentNode root = root_node(n);
+  free_node(root);
+  memset(n->first_index, 0, sizeof(n->first_index));
+  PutInode(n->id, true);
+}
+
+static int count(const extentNode &x) {
+  if (x.header->depth == 0) {
+    return x.header->entries;
+  }
+  int ret = 0;
+  for (int i = 0; i < x.header->entries; ++i) {
+    ret += count(block_node(x.entries[i].start));
+  }
+  return ret;
+}
+
+int ExtentNext(const inode *n, int logical) {
+  extent e;
+  if (next_extent(n, logical, &e) == false) {
+    return -1;
+  }
+  return std::max(logical, e.logical);
+}
+
+int ExtentCount(const inode *n) { return count(root_node(n)); }
+
+int ExtentDepth(const inode *n) { return root_node(n).header->depth; }
@@ -1,17 +1,125 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <vector>
 #include "head.h"
 
+// Write 一次要用到多块新块时，用 AllocExtent 要一段连续的块，getBlock 优先从中取，
+// 用不完的在 Write 结束时还回去。这样大文件追加的块在磁盘上是连续的。
+// 分配来的块不清零，writeBlocks 只把新块中没写到的部分清零。
+static int reserve_start = 0;
+static int reserve_len = 0;
+static int reserve_want = 0;  // 本次 Write 还需要新分配的块数
+
+static int allocBlock() {
+  if (reserve_len == 0 && reserve_want > 1) {
+    reserve_start = AllocExtent(reserve_want, &reserve_len);
+  }
+
+  reserve_want = std::max(reserve_want - 1, 0);
+  if (reserve_len > 0) {
+    --reserve_len;
+    return reserve_start++;
+  }
+  return AllocDataBlock();
+}
+
+static void releaseReserve() {
+  while (reserve_len > 0) {
+    ReleaseDataBlock(reserve_start++);
+    --reserve_len;
+  }
+  reserve_want = 0;
+}
+
+bool use_extents = true;
+bool use_dir_names = true;
+
+// 第 i 块已经分配的话返回块号，否则返回 0，不分配。
+// len 返回从第 i 块起物理上连续的块数，老的索引方式总是 1。
+int LookupBlock(const inode *n, int i, int *len, int *flags) {
+  if (n->flags & INODE_EXTENTS) {
+    return ExtentLookup(n, i, len, flags);
+  }
+
+  int ret = 0;
+  if (i < MAX_FIRST_INDEX) {
+    ret = std::max(n->first_index[i], 0);
+  } else if (n->type != DIR_TYPE && n->second_index > 0) {
+    ret = std::max(GetIndexBlock(n->second_index)->data_block[i - MAX_FIRST_INDEX], 0);
+  }
+  if (len != nullptr) {
+    *len = ret > 0;
+  }
+  if (flags != nullptr) {
+    *flags = 0;
+  }
+  return ret;
+}
+
+// 文件最多能有多少字节
+static int maxLength(const inode *n) {
+  return (n->flags & INODE_EXTENTS) ? MAX_EXTENT_FILE_SIZE : MaxFileSize();
+}
+
+// 老的索引方式的二级索引块，没有就分配一块清空的，失败返回 nullptr
+static indexBlock *secondIndex(inode *n) {
+  if (n->second_index <= 0) {
+    n->second_index = allocBlock();
+    PutInode(n->id, true);
+    if (n->second_index <= 0) {
+      return nullptr;
+    }
+
+    // 清空磁盘块：因为分配来的块可能是脏数据块。当用它来当作二级索引块的时候，需要先清空.
+    // 而非二级索引块在分配来的时候，不需要清空。因为不记录状态信息。
+    // 但是二级索引块，用 0 表示空闲，这个状态信息。
+    memset(GetBlock(n->second_index), 0, GetSuperBlock()->block_size);
+    PutBlock(n->second_index, true);
+  }
+
+  LOG("访问二级索引块%d\n", n->second_index);
+  return GetIndexBlock(n->second_index);
+}
+
 // 我觉得这个函数写的挺好，屏蔽了文件的多级索引，直接抽象成了一个块数组，通过下标来访问对应块
 // 要考虑到，写入的时候可能会有空心，也就是后面的块分配了，但是中间的块却没有分配
-// 不过只需要保证，分配来的块是clear的全零即可，因此需要在AllocaDataBlock中清空。
+// 空洞读出来是全零，不占块；分配来的块里是旧内容，由调用者清零或者标记为未写。
 // 实现了文件是block块的抽象。
 ///@param n 传入文件的inode
 ///@param i 文件分为若干块，这里i是第i块的意思
 ///@param index 部分地方调用可能需要知道块在整个磁盘的位置
+///@param flags 区段树文件新分配的块的区段标志
 ///@return 返回块
-static dataBlock *getBlock(inode *n, int i, int *index) {
+static dataBlock *getBlock(inode *n, int i, int *index, int flags = 0) {
+  if (n->flags & INODE_EXTENTS) {
+    *index = ExtentLookup(n, i, nullptr);
+    if (*index <= 0) {
+      *index = allocBlock();
+      if (*index <= 0) {
+        return nullptr;
+      }
+      if (ExtentMap(n, i, *index, 1, flags) == false) {
+        ReleaseDataBlock(*index);
+        *index = 0;
+        return nullptr;
+      }
+    }
+    return GetBlock(*index);
+  }
+
   if (i < MAX_FIRST_INDEX) {
-    n->first_index[i] = (n->first_index[i] <= 0 ? AllocDataBlock() : n->first_index[i]);
+    if (n->first_index[i] <= 0) {
+      n->first_index[i] = allocBlock();
+      PutInode(n->id, true);
+    }
     *index = n->first_index[i];
     return (n->first_index[i] <= 0 ? nullptr : GetBlock(n->first_index[i]));
   } else {
@@ -21,29 +129,45 @@ static dataBlock *getBlock(inode *n, int i, int *index) {
       return nullptr;
     }
 
-    if (n->second_index <= 0) {
-      n->second_index = AllocDataBlock();
-      if (n->second_index <= 0) {
-        return nullptr;
-      }
-
-      // 清空磁盘块：因为分配来的块可能是脏数据块。当用它来当作二级索引块的时候，需要先清空.
-      // 而非二级索引块在分配来的时候，不需要清空。因为不记录状态信息。
-      // 但是二级索引块，用 0 表示空闲，这个状态信息。
-      memset(GetBlock(n->second_index), 0, BLOCK_SIZE);
-      PutBlock(n->second_index, true);
+    indexBlock *block = secondIndex(n);
+    if (block == nullptr) {
+      return nullptr;
     }
-
-    LOG("访问二级索引块%d\n", n->second_index);
-    indexBlock *block = GetIndexBlock(n->second_index);
     i -= MAX_FIRST_INDEX;
-    block->data_block[i] = (block->data_block[i] <= 0 ? AllocDataBlock() : block->data_block[i]);
+    if (block->data_block[i] <= 0) {
+      block->data_block[i] = allocBlock();
+      PutBlock(n->second_index, true);
+    }
     *index = block->data_block[i];
     return (block->data_block[i] <= 0 ? nullptr : GetBlock(block->data_block[i]));
   }
   return nullptr;
 }
 
+// 把第 [i, i + len) 块映射到物理块 [b, b + len)，覆盖原有映射，旧块由调用者处理
+static bool mapBlocks(inode *n, int i, int b, int len, int flags = 0) {
+  if (n->flags & INODE_EXTENTS) {
+    return ExtentMap(n, i, b, len, flags);
+  }
+
+  const int per_index = GetSuperBlock()->block_size / (int)sizeof(int);
+  for (int k = 0; k < len; ++k) {
+    if (i + k < MAX_FIRST_INDEX) {
+      n->first_index[i + k] = b + k;
+      PutInode(n->id, true);
+      continue;
+    }
+    indexBlock *block = nullptr;
+    if (n->type == DIR_TYPE || i + k - MAX_FIRST_INDEX >= per_index ||
+        (block = secondIndex(n)) == nullptr) {
+      return false;
+    }
+    block->data_block[i + k - MAX_FIRST_INDEX] = b + k;
+    PutBlock(n->second_index, true);
+  }
+  return true;
+}
+
 int NewFile(file_type type, const char *file_name, const char *owner_name) {
   const int file_name_len = strlen(file_name);
   const int owner_name_len = strlen(owner_name);
@@ -52,59 +176,122 @@ int NewFile(file_type type, const char *file_name, const char *owner_name) {
     return -1;
   }
 
-  int index = AllocDataBlock();
+  transaction t;
+  int index = AllocInode();
   if (index <= 0) {
     return index;
   }
 
+  // inode 和数据块各自编号，数据块等真正写入内容时再由 getBlock 分配，空文件、链接不占块。
   inode *n = GetInode(index);
   memset(n, 0, INODE_SIZE);
   n->type = type;
   n->link_cnt = 1;
   n->id = index;
-  n->first_index[0] = index;
   n->length = 0;
   n->second_index = 0;
-  // 因为inode节点和block节点共用编号，所以这个编号分配给inode之后，会让其对应的block节点浪费，为了减少浪费，把它分配给第一块
-  // 不过对于链接来说，没啥用。
+  n->flags = use_extents ? INODE_EXTENTS : 0;
+  if (type == DIR_TYPE && use_dir_names) {
+    n->flags |= INODE_DIR_NAMES;
+  }
 
   memcpy(n->file_name, file_name, file_name_len);
   memcpy(n->owner_name, owner_name, owner_name_len);
+  *InodeEpoch(index) = GetSuperBlock()->epoch;  // 快照里没有它，改的时候不用保留
+  PutEpoch(index);
 
   PutInode(index, true);
   return index;
 }
 
-// 在写入的时候，指定位置写入，可能会导致文件中间是空的。读取的时候要小心
-// 实现了文件是字节数组的抽象。
-int Write(int index, int pos, int len, const char *buf) {
-  if (GetSuperBlock()->user_info_id != index && ValidateCurrent(index) == false) {
-    fprintf(stderr, "无权限\n");
-    return 0;
+// [begin, end) 块中还没分配的块数，老的索引方式还要算上二级索引块。
+// cow 时和别的文件共享或在去重索引里、写之前要复制的块也算上
+static int countMissing(const inode *n, int begin, int end, bool cow = false) {
+  int ret = 0;
+  for (int i = begin; i < end; ++i) {
+    int run = 0;
+    int b = LookupBlock(n, i, &run);
+    if (b > 0) {
+      run = std::min(run, end - i);
+      for (int k = 0; cow && k < run; ++k) {
+        ret += DataBlockShared(b + k);
+      }
+      i += run - 1;  // 已经分配的一段整体跳过
+    } else {
+      ++ret;
+    }
   }
-  inode *n = GetInode(index);
-
-  if (IsOpen(index) == 0 && n->type == FILE_TYPE) {
-    fprintf(stderr, "未打开文件\n");
-    return 0;
+  if (!(n->flags & INODE_EXTENTS) && end > MAX_FIRST_INDEX && n->type != DIR_TYPE &&
+      n->second_index <= 0) {
+    ++ret;  // 二级索引块
   }
+  return ret;
+}
 
-  if (index <= 0) {
-    return 0;
+// 把 [begin, end) 块中没分配的都分配上，count 加上新分配的块数，块不够时返回 false。
+// 区段树文件的新块标记为未写，不用清零；老的索引方式记不下这个状态，只能清零。
+static bool allocRange(inode *n, int begin, int end, int *count) {
+  transaction t;
+  PreserveInode(n->id);
+  reserve_want = countMissing(n, begin, end);
+  const int block_size = GetSuperBlock()->block_size;
+  bool ok = true;
+  for (int i = begin; i < end && ok; ++i) {
+    int run = 0;
+    if (LookupBlock(n, i, &run) > 0) {
+      i += run - 1;
+      continue;
+    }
+    int b = 0;
+    dataBlock *block = getBlock(n, i, &b, EXTENT_UNWRITTEN);
+    ok = block != nullptr;
+    *count += ok;
+    if (ok && !(n->flags & INODE_EXTENTS)) {
+      memset(block, 0, block_size);
+      PutDataBlock(b, true);
+    }
   }
+  releaseReserve();
+  PutInode(n->id, true);
+  return ok;
+}
 
-  if (n->type == LINK_TYPE) {
-    n = GetInode(n->link_inode);
+// 去掉 [begin, end) 块的映射并释放这些块
+static void releaseRange(inode *n, int begin, int end) {
+  PreserveInode(n->id);
+  if (n->flags & INODE_EXTENTS) {
+    ExtentUnmap(n, begin, end - begin);
+    return;
   }
 
-  int start_i = pos / BLOCK_SIZE;        // 起始块的编号
-  int end_i = (pos + len) / BLOCK_SIZE;  // 结束块的编号
-  int start_pos = pos % BLOCK_SIZE;      // 偏移量
-  int w_size = 0;                        // 实际写入的字节数
+  for (int i = begin; i < end; ++i) {
+    if (i < MAX_FIRST_INDEX) {
+      if (n->first_index[i] > 0) {
+        ReleaseDataBlock(n->first_index[i]);
+        n->first_index[i] = 0;
+        PutInode(n->id, true);
+      }
+    } else if (n->type != DIR_TYPE && n->second_index > 0) {
+      indexBlock *block = GetIndexBlock(n->second_index);
+      if (block->data_block[i - MAX_FIRST_INDEX] > 0) {
+        ReleaseDataBlock(block->data_block[i - MAX_FIRST_INDEX]);
+        block->data_block[i - MAX_FIRST_INDEX] = 0;
+        PutBlock(n->second_index, true);
+      }
+    }
+  }
+}
 
-  if (pos + len > MAX_FILE_SIZE) {
+// 把 buf 写进文件 n 的 pos 处，不检查权限，返回实际写入的字节数
+static int writeBlocks(inode *n, int pos, int len, const char *buf) {
+  transaction t;
+  PreserveInode(n->id);
+  const superBlock *super = GetSuperBlock();
+  const int block_size = super->block_size;
+  const int max_file_size = maxLength(n);
+  if ((long long)pos + len > max_file_size) {
     fprintf(stderr, "文件过大，将被截断\n");
-    len -= pos + len - MAX_FILE_SIZE;
+    len = std::max(max_file_size - pos, 0);
   }
 
   if (len <= 0) {
@@ -112,34 +299,571 @@ int Write(int index, int pos, int len, const char *buf) {
     return 0;
   }
 
+  int start_i = pos / block_size;        // 起始块的编号
+  int end_i = (pos + len) / block_size;  // 结束块的编号
+  int last_i = (pos + len - 1) / block_size;  // 最后一个写到的块
+  int start_pos = pos % block_size;      // 偏移量
+  int w_size = 0;                        // 实际写入的字节数
+  int fresh_end = start_i;               // [start_i, fresh_end) 是刚从未写转成已写的块
+
+  // 数一下要新分配多少块，多于一块就一次要一段连续的
+  reserve_want = countMissing(n, start_i, last_i + 1, true);
+  // 内部文件不参与去重，去重索引自己也是内部文件
+  const bool dedup = dedup_blocks && n->type == FILE_TYPE && !(n->flags & INODE_INTERNAL);
+
   for (int i = start_i; i <= end_i && len > 0; ++i) {
-    int b = -1;
+    int run = 0;
+    int flags = 0;
+    int b = LookupBlock(n, i, &run, &flags);
+    bool fresh = b <= 0 || i < fresh_end;  // 块里是旧内容，没写到的部分要清零
+    if (b > 0 && (flags & EXTENT_UNWRITTEN)) {
+      // 预分配的块第一次写，这次写到的一段整体转成已写
+      int count = std::min(run, last_i - i + 1);
+      if (ExtentMap(n, i, b, count) == false) {
+        break;
+      }
+      fresh_end = i + count;
+      fresh = true;
+    }
+
+    int s = std::min(block_size - start_pos, len);  // 不能越过块尾
+    unsigned long long hash = 0;
+    int same = 0;
+    if (dedup && s == block_size) {
+      same = DedupFind(buf + w_size, &hash);
+      // 内容和已有的块一样：映射过去共享，不用写；原来就是这一块的什么都不用做
+      if (same > 0 && (same == b || ShareDataBlock(same))) {
+        if (same != b && mapBlocks(n, i, same, 1) == false) {
+          ReleaseDataBlock(same);
+          break;
+        }
+        if (same != b && b > 0) {
+          ReleaseDataBlock(b);
+        }
+        len -= s;
+        w_size += s;
+        continue;
+      }
+    }
+
+    if (b > 0 && DataBlockShared(b)) {
+      // 写时复制：和别的文件共享的、在去重索引里的块先换成自己的一份，整块覆盖的不用拷旧内容
+      int copy = allocBlock();
+      if (copy <= 0) {
+        break;
+      }
+      if (!fresh && s < block_size) {
+        memcpy(GetBlock(copy), GetBlock(b), block_size);
+      }
+      if (mapBlocks(n, i, copy, 1) == false) {
+        ReleaseDataBlock(copy);
+        break;
+      }
+      ReleaseDataBlock(b);
+    }
+
     dataBlock *block = getBlock(n, i, &b);
 
-    if (block == nullptr || b <= 0 || b >= MAX_BLOCK_NUMBER) {
+    if (block == nullptr || b <= 0 || b >= super->block_count) {
       break;
     }
 
-    int s = std::min(BLOCK_SIZE, len);
+    if (fresh) {
+      memset(block->content, 0, start_pos);
+      memset(block->content + start_pos + s, 0, block_size - start_pos - s);
+    }
     memcpy(block->content + start_pos, buf + w_size, s);
     start_pos += s;
-    start_pos %= BLOCK_SIZE;
+    start_pos %= block_size;
 
     LOG("写入块%d\n", b);
-    PutBlock(b, true);
+    if (n->type == FILE_TYPE) {
+      PutDataBlock(b, true);
+    } else {
+      PutBlock(b, true);  // 目录项、用户表也是元数据
+    }
+    if (dedup && s == block_size && same == 0) {
+      DedupInsert(hash, b);
+    }
     len -= s;
     w_size += s;
   }
 
+  releaseReserve();
   n->length = std::max(pos + w_size, n->length);
+  PutInode(n->id, true);
+
+  LOG("共写入%d字节\n", w_size);
+  return w_size;
+}
+
+// 按块读 [pos, pos + len)，不检查长度
+static int readBlocks(const inode *n, int pos, int len, char *buf) {
+  const superBlock *super = GetSuperBlock();
+  const int block_size = super->block_size;
+  int start_i = pos / block_size;
+  int end_i = (pos + len) / block_size;
+  int start_pos = pos % block_size;
+  int r_size = 0;
+  int run_b = 0;      // 当前连续段中第 i 块的块号
+  int run_len = 0;    // 当前连续段从第 i 块起还剩的块数
+  int run_flags = 0;  // 当前连续段的区段标志
+
+  for (int i = start_i; i <= end_i && len > 0; ++i) {
+    // 一段连续的块只查一次映射
+    if (run_len == 0) {
+      run_b = LookupBlock(n, i, &run_len, &run_flags);
+    }
+    int b = run_b;
+    int s = std::min(block_size - start_pos, len);  // 不能越过块尾
+    if (run_len > 0 && !(run_flags & EXTENT_UNWRITTEN)) {
+      if (b >= super->block_count) {
+        break;
+      }
+      memcpy(buf + r_size, GetBlock(b)->content + start_pos, s);
+      LOG("读取块%d\n", b);
+      PutBlock(b, false);
+    } else {
+      memset(buf + r_size, 0, s);  // 空洞和没写过的预分配块读出全零，不分配也不写
+    }
+    if (run_len > 0) {
+      ++run_b;
+      --run_len;
+    }
+
+    start_pos += s;
+    start_pos %= block_size;
+    len -= s;
+    r_size += s;
+  }
+
+  LOG("共读取%d字节\n", r_size);
+  return r_size;
+}
+
+// 压缩文件。第 c 簇是逻辑块 [c * COMPRESS_CLUSTER, (c + 1) * COMPRESS_CLUSTER)。
+// 压得下的簇只映射存放压缩数据的前几块，标记为 EXTENT_COMPRESSED，第一块开头是压缩后的字节数；
+// 压不下去的簇和普通文件一样按块存储。压缩簇从不原地改写，每次写都整簇换成新块，
+// 所以和快照、reflink 共享时也不用写时复制。
+// 最近解压的一簇留在内存里，顺序的小块读不用每次都解压。
+static compressStat compress_stat;
+static struct {
+  int id = 0;  // 文件的 inode，0 表示没有
+  int cluster = 0;
+  int block = 0;  // 簇的第一块，簇改写后会换
+  std::vector<char> data;
+} cluster_cache;
+
+const compressStat *GetCompressStat() { return &compress_stat; }
+
+void ResetClusterCache() { cluster_cache.id = 0; }
+
+bool SetCompression(int index, bool on) {
+  inode *n = GetInode(index);
+  if (n->type != FILE_TYPE || !(n->flags & INODE_EXTENTS) || (n->flags & INODE_INTERNAL) ||
+      n->length > 0) {
+    fprintf(stderr, "只能压缩区段树映射的空文件\n");
+    return false;
+  }
+  if (ValidateCurrent(index) == false) {
+    fprintf(stderr, "无权限\n");
+    return false;
+  }
+  PreserveInode(index);  // 快照里的旧版本保持原来的存储方式
+  n->flags = on ? (n->flags | INODE_COMPRESSED) : (n->flags & ~INODE_COMPRESSED);
   PutInode(index, true);
+  return true;
+}
 
-  if (n->second_index > 0) {
-    PutBlock(n->second_index, true);
+static int clusterBytes() { return COMPRESS_CLUSTER * GetSuperBlock()->block_size; }
+
+// 第 c 簇是不是压缩存储的，是的话返回第一块
+static int packedCluster(const inode *n, int c) {
+  int flags = 0;
+  const int b = LookupBlock(n, c * COMPRESS_CLUSTER, nullptr, &flags);
+  return b > 0 && (flags & EXTENT_COMPRESSED) ? b : 0;
+}
+
+// 解压第一块为 b 的第 c 簇，返回整簇的内容
+static const char *unpackCluster(const inode *n, int c, int b) {
+  const int block_size = GetSuperBlock()->block_size;
+  const int cluster = clusterBytes();
+  if (cluster_cache.id == n->id && cluster_cache.cluster == c && cluster_cache.block == b) {
+    return cluster_cache.data.data();
   }
 
-  LOG("共写入%d字节\n", w_size);
-  return w_size;
+  // 压缩数据按段收集，去重和拷贝满了的共享计数可能让它们不连续
+  int size = 0;
+  memcpy(&size, GetBlock(b), sizeof(int));
+  const int total = sizeof(int) + std::clamp(size, 0, cluster);
+  std::vector<char> packed(total);
+  for (int got = 0; got < total;) {
+    int run = 0;
+    const int pb = LookupBlock(n, c * COMPRESS_CLUSTER + got / block_size, &run);
+    if (pb <= 0) {
+      break;
+    }
+    const int bytes = std::min(run * block_size, total - got);
+    memcpy(packed.data() + got, GetBlock(pb), bytes);
+    got += bytes;
+  }
+
+  cluster_cache.data.resize(cluster);
+  int out = LzDecompress(packed.data() + sizeof(int), total - sizeof(int), cluster_cache.data.data(),
+                         cluster);
+  if (out < 0 || size > cluster) {
+    fprintf(stderr, "压缩数据损坏\n");
+    out = 0;
+  }
+  memset(cluster_cache.data.data() + out, 0, cluster - out);
+  cluster_cache.id = n->id;
+  cluster_cache.cluster = c;
+  cluster_cache.block = b;
+  return cluster_cache.data.data();
+}
+
+static int readCompressed(const inode *n, int pos, int len, char *buf) {
+  const int cluster = clusterBytes();
+  int r = 0;
+  while (r < len) {
+    const int c = (pos + r) / cluster;
+    const int off = (pos + r) % cluster;
+    const int s = std::min(cluster - off, len - r);
+    const int b = packedCluster(n, c);
+    if (b > 0) {
+      memcpy(buf + r, unpackCluster(n, c, b) + off, s);
+    } else {
+      readBlocks(n, pos + r, s, buf + r);
+    }
+    r += s;
+  }
+  return r;
+}
+
+// 压缩 data 的前 len 字节到 packed，[压缩后长度][压缩数据]，返回总字节数。
+// 占的块不比原样少时返回 0。先试着压第一块，压不到 15/16 就当作压不下去，不再压整簇。
+static int packCluster(const char *data, int len, char *packed) {
+  const int block_size = GetSuperBlock()->block_size;
+  const int limit = ((len + block_size - 1) / block_size - 1) * block_size - (int)sizeof(int);
+  if (limit <= 0) {
+    return 0;
+  }
+  if (len > block_size &&
+      LzCompress(data, block_size, packed + sizeof(int), block_size / 16 * 15) == 0) {
+    return 0;
+  }
+  const int size = LzCompress(data, len, packed + sizeof(int), limit);
+  if (size == 0) {
+    return 0;
+  }
+  memcpy(packed, &size, sizeof(int));
+  return sizeof(int) + size;
+}
+
+// 把压缩好的一簇写到新块上，换掉第 begin 块起的一簇。先分配好新块再放掉旧的，
+// 空间不够时原来的内容还在。
+static bool storeCluster(inode *n, int begin, const char *packed, int total) {
+  const int block_size = GetSuperBlock()->block_size;
+  const int count = (total + block_size - 1) / block_size;
+  std::vector<std::pair<int, int>> runs;
+  for (int got = 0; got < count;) {
+    int len = 0;
+    const int b = AllocExtent(count - got, &len);
+    if (b <= 0) {
+      for (auto [start, l] : runs) {
+        for (int k = 0; k < l; ++k) {
+          ReleaseDataBlock(start + k);
+        }
+      }
+      fprintf(stderr, "空间不足\n");
+      return false;
+    }
+    runs.emplace_back(b, len);
+    got += len;
+  }
+
+  releaseRange(n, begin, begin + COMPRESS_CLUSTER);
+  int i = 0;
+  for (auto [start, len] : runs) {
+    for (int k = 0; k < len; ++k) {
+      const int off = (i + k) * block_size;
+      const int bytes = std::min(block_size, total - off);
+      memcpy(GetBlock(start + k), packed + off, bytes);
+      memset(GetBlock(start + k)->content + bytes, 0, block_size - bytes);
+      PutDataBlock(start + k, true);
+    }
+    if (mapBlocks(n, begin + i, start, len, EXTENT_COMPRESSED) == false) {
+      return false;
+    }
+    i += len;
+  }
+  return true;
+}
+
+// 按簇读改写：把原来的内容读出来，改好后重新压缩。压不下去时还是原样按块写，
+// 原来就不是压缩的只写改到的部分。
+static int writeCompressed(inode *n, int pos, int len, const char *buf) {
+  transaction t;
+  PreserveInode(n->id);
+  ResetClusterCache();
+  const int max_file_size = maxLength(n);
+  if ((long long)pos + len > max_file_size) {
+    fprintf(stderr, "文件过大，将被截断\n");
+    len = std::max(max_file_size - pos, 0);
+  }
+  if (len <= 0) {
+    fprintf(stderr, "写入小于等于0，无效写入\n");
+    return 0;
+  }
+
+  const int cluster = clusterBytes();
+  std::vector<char> data(cluster);
+  std::vector<char> packed(cluster);
+  int w = 0;
+  while (w < len) {
+    const int c = (pos + w) / cluster;
+    const int off = (pos + w) % cluster;
+    const int s = std::min(cluster - off, len - w);
+    const int begin = c * COMPRESS_CLUSTER;
+    const int old_len = std::clamp(n->length - c * cluster, 0, cluster);
+    const int new_len = std::max(old_len, off + s);
+    const int b = packedCluster(n, c);
+
+    if (b > 0) {
+      memcpy(data.data(), unpackCluster(n, c, b), old_len);
+      ResetClusterCache();
+    } else if (old_len > 0) {
+      readBlocks(n, c * cluster, old_len, data.data());
+    }
+    memset(data.data() + old_len, 0, new_len - old_len);
+    memcpy(data.data() + off, buf + w, s);
+
+    const int total = packCluster(data.data(), new_len, packed.data());
+    if (total > 0) {
+      if (storeCluster(n, begin, packed.data(), total) == false) {
+        break;
+      }
+      ++compress_stat.compressed;
+      compress_stat.bytes_in += new_len;
+      compress_stat.bytes_out += total;
+      n->length = std::max(n->length, c * cluster + new_len);
+    } else {
+      ++compress_stat.raw;
+      if (b > 0) {
+        releaseRange(n, begin, begin + COMPRESS_CLUSTER);
+        if (writeBlocks(n, c * cluster, new_len, data.data()) != new_len) {
+          break;
+        }
+      } else if (writeBlocks(n, pos + w, s, buf + w) != s) {
+        break;
+      }
+    }
+    w += s;
+  }
+
+  PutInode(n->id, true);
+  return w;
+}
+
+// 按文件的存储方式写
+static int writeFile(inode *n, int pos, int len, const char *buf) {
+  if (n->flags & INODE_COMPRESSED) {
+    return writeCompressed(n, pos, len, buf);
+  }
+  return writeBlocks(n, pos, len, buf);
+}
+
+// 追加缓存。日志式的写法是对一个打开的文件反复小追加，每次都查权限、找块、写 inode 很浪费。
+// 小追加先拼在 pending 里，攒够了一次写下去；权限只在第一次和换了用户时检查。
+// 写下去时如果写指针前面预分配的块不够下一次写，就再连续分配两次的量，关闭时把没用上的还回去。
+// 时间阈值在下一次追加时检查，没有后台线程。
+typedef struct appendState {
+  std::string pending;            // 还没写进块的追加内容
+  long long since;                // pending 中第一笔的时间，毫秒
+  char user[MAX_NAME_LENGTH];     // 通过权限检查的用户
+  int prealloc_begin;             // 预分配过的块 [prealloc_begin, prealloc_end)
+  int prealloc_end;
+} appendState;
+
+static std::map<int, appendState> appends;
+static int append_size = DEFAULT_APPEND_SIZE;
+static int append_delay = DEFAULT_APPEND_DELAY;
+static appendStat append_stat;
+
+static long long nowMs() {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+
+static void preallocate(inode *n, appendState *a) {
+  const int block_size = GetSuperBlock()->block_size;
+  if (n->flags & INODE_COMPRESSED) {
+    return;  // 压缩簇每次都换新块，预分配的用不上
+  }
+  if ((long long)a->prealloc_end * block_size >= (long long)n->length + append_size) {
+    return;
+  }
+
+  const int begin = std::max(a->prealloc_end, (n->length + block_size - 1) / block_size);
+  const int end = std::min((n->length + 2LL * append_size + block_size - 1) / block_size,
+                           (long long)maxLength(n) / block_size);
+  if (end <= begin) {
+    return;
+  }
+  if (a->prealloc_begin >= a->prealloc_end) {
+    a->prealloc_begin = begin;
+  }
+
+  int count = 0;
+  allocRange(n, begin, end, &count);
+  a->prealloc_end = end;
+  append_stat.preallocated += count;
+}
+
+static void flushPending(inode *n, appendState *a) {
+  if (a->pending.empty()) {
+    return;
+  }
+  int w = writeFile(n, n->length, a->pending.size(), a->pending.data());
+  a->pending.clear();
+  ++append_stat.flushes;
+  append_stat.bytes += w;
+  preallocate(n, a);
+}
+
+static int appendCached(inode *n, int len, const char *buf) {
+  auto it = appends.find(n->id);
+  if (it == appends.end() || strcmp(it->second.user, GetCurrentUser()->user_name) != 0) {
+    if (ValidateCurrent(n->id) == false) {
+      fprintf(stderr, "无权限\n");
+      return 0;
+    }
+    if (IsOpen(n->id) == false) {
+      fprintf(stderr, "未打开文件\n");
+      return 0;
+    }
+    appendState &a = appends[n->id];
+    memcpy(a.user, GetCurrentUser()->user_name, MAX_NAME_LENGTH);
+    it = appends.find(n->id);
+  }
+
+  appendState &a = it->second;
+  if ((long long)n->length + (long long)a.pending.size() + len > maxLength(n)) {
+    flushPending(n, &a);
+    return writeFile(n, n->length, len, buf);  // 由 writeBlocks 截断
+  }
+
+  const long long now = nowMs();
+  if (a.pending.empty()) {
+    a.since = now;
+  }
+  a.pending.append(buf, len);
+  ++append_stat.appends;
+  if ((int)a.pending.size() >= append_size || now - a.since >= append_delay) {
+    flushPending(n, &a);
+  }
+  return len;
+}
+
+void SetAppendCache(int size, int delay) {
+  FlushAppend(0);
+  append_size = std::max(size, 0);
+  append_delay = std::max(delay, 0);
+}
+
+void FlushAppend(int index) {
+  for (auto &[id, a] : appends) {
+    if (index <= 0 || id == index) {
+      flushPending(GetInode(id), &a);
+    }
+  }
+}
+
+void DropAppend(int index) {
+  const int block_size = GetSuperBlock()->block_size;
+  for (auto it = appends.begin(); it != appends.end();) {
+    if (index > 0 && it->first != index) {
+      ++it;
+      continue;
+    }
+
+    transaction t;
+    inode *n = GetInode(it->first);
+    appendState &a = it->second;
+    flushPending(n, &a);
+    const int used = (n->length + block_size - 1) / block_size;
+    if (a.prealloc_end > std::max(used, a.prealloc_begin)) {
+      releaseRange(n, std::max(used, a.prealloc_begin), a.prealloc_end);
+    }
+    it = appends.erase(it);
+  }
+}
+
+const appendStat *GetAppendStat() { return &append_stat; }
+
+bool Fallocate(int index, int pos, int len) {
+  if (index <= 0 || pos < 0 || len <= 0) {
+    return false;
+  }
+  if (ValidateCurrent(index) == false) {
+    fprintf(stderr, "无权限\n");
+    return false;
+  }
+
+  inode *n = GetInode(index);
+  if (n->type == LINK_TYPE) {
+    n = GetInode(n->link_inode);
+  }
+  if ((long long)pos + len > maxLength(n)) {
+    fprintf(stderr, "文件过大\n");
+    return false;
+  }
+
+  const int block_size = GetSuperBlock()->block_size;
+  int count = 0;
+  return allocRange(n, pos / block_size, (pos + len - 1) / block_size + 1, &count);
+}
+
+void ReleaseBlocks(int index, int begin, int end) {
+  if (index <= 0 || begin >= end) {
+    return;
+  }
+  transaction t;
+  inode *n = GetInode(index);
+  if (n->type == LINK_TYPE) {
+    n = GetInode(n->link_inode);
+  }
+  releaseRange(n, begin, end);
+  PutInode(n->id, true);
+}
+
+// 在写入的时候，指定位置写入，可能会导致文件中间是空的。读取的时候要小心
+// 实现了文件是字节数组的抽象。
+int Write(int index, int pos, int len, const char *buf) {
+  if (index <= 0) {
+    return 0;
+  }
+  inode *n = GetInode(index);
+  const bool internal = GetSuperBlock()->user_info_id == index || (n->flags & INODE_INTERNAL);
+  if (!internal && ValidateCurrent(index) == false) {
+    fprintf(stderr, "无权限\n");
+    return 0;
+  }
+
+  if (!internal && IsOpen(index) == 0 && n->type == FILE_TYPE) {
+    fprintf(stderr, "未打开文件\n");
+    return 0;
+  }
+
+  if (n->type == LINK_TYPE) {
+    n = GetInode(n->link_inode);
+  }
+
+  if (!appends.empty()) {
+    FlushAppend(n->id);  // 先把攒着的追加写下去，保证顺序
+  }
+  return writeFile(n, pos, len, buf);
 }
 
 int Append(int index, int len, const char *buf) {
@@ -153,6 +877,13 @@ int Append(int index, int len, const char *buf) {
     n = GetInode(n->link_inode);
   }
 
+  // 只缓存普通文件的小追加，目录项和用户表要立刻写下去
+  if (append_size > 0 && n->type == FILE_TYPE && len > 0 && len < append_size) {
+    return appendCached(n, len, buf);
+  }
+  if (!appends.empty()) {
+    FlushAppend(n->id);
+  }
   return Write(n->id, n->length, len, buf);
 }
 
@@ -167,9 +898,14 @@ int Read(int index, int pos, int len, char *buf) {
     n = GetInode(n->link_inode);
   }
 
-  if (pos + len > MAX_FILE_SIZE) {
+  if (!appends.empty()) {
+    FlushAppend(n->id);
+  }
+
+  const int max_file_size = maxLength(n);
+  if ((long long)pos + len > max_file_size) {
     fprintf(stderr, "文件过大，读取将被截断\n");
-    len -= pos + len - MAX_FILE_SIZE;
+    len = std::max(max_file_size - pos, 0);
   }
 
   if (len <= 0) {
@@ -177,36 +913,399 @@ int Read(int index, int pos, int len, char *buf) {
     return 0;
   }
 
-  int start_i = pos / BLOCK_SIZE;
-  int end_i = (pos + len) / BLOCK_SIZE;
-  int start_pos = pos % BLOCK_SIZE;
-  int r_size = 0;
+  if (n->flags & INODE_COMPRESSED) {
+    return readCompressed(n, pos, len, buf);
+  }
+  return readBlocks(n, pos, len, buf);
+}
 
-  for (int i = start_i; i <= end_i && len > 0; ++i) {
-    int b = -1;
-    dataBlock *block = getBlock(n, i, &b);  // 可能会分配新的块
+// 从第 i 块起(含)第一个有数据的块，直到 end 都没有返回 -1。
+// 未写的预分配块只在 unwritten 时算上
+static int nextMapped(const inode *n, int i, int end, bool unwritten = false) {
+  if (n->flags & INODE_EXTENTS) {
+    while ((i = ExtentNext(n, i)) >= 0 && i < end) {
+      int run = 0;
+      int flags = 0;
+      ExtentLookup(n, i, &run, &flags);
+      if (unwritten || !(flags & EXTENT_UNWRITTEN)) {
+        return i;
+      }
+      i += run;
+    }
+    return -1;
+  }
+  for (; i < end; ++i) {
+    if (LookupBlock(n, i) > 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// 文件的真正内容，链接指向的文件，攒着的追加先写下去
+static inode *contentInode(int index) {
+  inode *n = GetInode(index);
+  if (n->type == LINK_TYPE) {
+    n = GetInode(n->link_inode);
+  }
+  if (!appends.empty()) {
+    FlushAppend(n->id);
+  }
+  return n;
+}
+
+int SeekData(int index, int pos) {
+  if (index <= 0 || pos < 0) {
+    return -1;
+  }
+  const inode *n = contentInode(index);
+  if (pos >= n->length) {
+    return -1;
+  }
+
+  const int block_size = GetSuperBlock()->block_size;
+  if ((n->flags & INODE_COMPRESSED) && packedCluster(n, pos / clusterBytes()) > 0) {
+    return pos;  // 压缩簇只映射前几块，整簇都是数据
+  }
+  const int i = nextMapped(n, pos / block_size, (n->length + block_size - 1) / block_size);
+  if (i < 0) {
+    return -1;
+  }
+  return std::max(pos, i * block_size);
+}
+
+int SeekHole(int index, int pos) {
+  if (index <= 0 || pos < 0) {
+    return -1;
+  }
+  const inode *n = contentInode(index);
+  if (pos >= n->length) {
+    return -1;
+  }
+
+  const int block_size = GetSuperBlock()->block_size;
+  const int end = (n->length + block_size - 1) / block_size;
+  int i = pos / block_size;
+  while (i < end) {
+    int run = 0;
+    int flags = 0;
+    if (LookupBlock(n, i, &run, &flags) <= 0 || (flags & EXTENT_UNWRITTEN)) {
+      const int c = i / COMPRESS_CLUSTER;
+      if ((n->flags & INODE_COMPRESSED) && i % COMPRESS_CLUSTER != 0 && packedCluster(n, c) > 0) {
+        i = (c + 1) * COMPRESS_CLUSTER;  // 压缩簇后面没映射的块不是空洞
+        continue;
+      }
+      return std::max(pos, i * block_size);
+    }
+    i += run;
+  }
+  return n->length;  // 文件末尾算一个隐含的空洞
+}
+
+// 导出。长的连续段用 copy_file_range 在内核里从镜像拷到目标，目标不支持时退到 sendfile；
+// 短段直接把映射里的块作为 iovec，空洞和没写过的块指向共用的零页，攒够一批 writev 出去。
+// 除了压缩文件要先解压，数据都不经过中间缓冲。内核读的是镜像文件，开始前要先把映射里的修改写回。
+static exportStat export_stat;
+
+const exportStat *GetExportStat() { return &export_stat; }
+
+typedef struct exportState {
+  int out;
+  int kernel;  // 0 用 copy_file_range，1 用 sendfile，2 都不支持
+  bool failed;
+  std::vector<iovec> iov;
+} exportState;
+
+static const char *zeroPage() {
+  static const std::vector<char> zero(EXPORT_ZERO, 0);
+  return zero.data();
+}
+
+static void flushExport(exportState *e) {
+  iovec *iov = e->iov.data();
+  int count = e->iov.size();
+  while (count > 0 && !e->failed) {
+    const ssize_t w = writev(e->out, iov, std::min(count, IOV_MAX));
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    e->failed = w <= 0;
+    ++export_stat.syscalls;
+    export_stat.vectored += std::max<ssize_t>(w, 0);
+    // 跳过写完的，目标是管道时可能只写了一部分
+    for (size_t left = std::max<ssize_t>(w, 0); count > 0 && left > 0;) {
+      const size_t s = std::min(left, iov->iov_len);
+      iov->iov_base = (char *)iov->iov_base + s;
+      iov->iov_len -= s;
+      left -= s;
+      if (iov->iov_len == 0) {
+        ++iov;
+        --count;
+      }
+    }
+  }
+  e->iov.clear();
+}
+
+static void exportIov(exportState *e, const char *p, size_t len) {
+  if (!e->iov.empty() && (char *)e->iov.back().iov_base + e->iov.back().iov_len == p) {
+    e->iov.back().iov_len += len;  // 映射里相邻的段合成一项
+  } else {
+    e->iov.push_back({(void *)p, len});
+  }
+  if ((int)e->iov.size() >= IOV_MAX) {
+    flushExport(e);
+  }
+}
+
+static void exportZeros(exportState *e, long long len) {
+  for (; len > 0; len -= EXPORT_ZERO) {
+    exportIov(e, zeroPage(), std::min<long long>(len, EXPORT_ZERO));
+  }
+}
 
-    if (block == nullptr || b <= 0 || b >= MAX_BLOCK_NUMBER) {
+// 在内核里把镜像 [offset, offset + len) 拷到目标，返回拷了多少，目标不支持时返回 0
+static long long exportKernel(exportState *e, long long offset, long long len) {
+  flushExport(e);  // 保证顺序
+  long long done = 0;
+  while (done < len && e->kernel < 2 && !e->failed) {
+    ssize_t w = 0;
+    if (e->kernel == 0) {
+      loff_t in = offset + done;
+      w = copy_file_range(fd, &in, e->out, nullptr, len - done, 0);
+      export_stat.copied += std::max<ssize_t>(w, 0);
+    } else {
+      off_t in = offset + done;
+      w = sendfile(e->out, fd, &in, len - done);
+      export_stat.sent += std::max<ssize_t>(w, 0);
+    }
+    ++export_stat.syscalls;
+    if (w < 0 && errno == EINTR) {
+      continue;
+    }
+    if (w <= 0) {
+      // 一个字节都还没拷时换下一种方式，已经拷了一部分说明是真的写不下去了
+      if (done > 0 || (errno != EXDEV && errno != EINVAL && errno != ENOSYS &&
+                       errno != EOPNOTSUPP && errno != EBADF)) {
+        e->failed = true;
+      }
+      ++e->kernel;
       break;
     }
+    done += w;
+  }
+  return done;
+}
 
-    int s = std::min(BLOCK_SIZE, len);
-    memcpy(buf + r_size, block->content + start_pos, s);
+long long Export(int index, int out) {
+  if (index <= 0 || out < 0) {
+    return -1;
+  }
+  inode *n = GetInode(index);
+  if (n->type == LINK_TYPE) {
+    n = GetInode(n->link_inode);
+  }
+  if (n->type != FILE_TYPE) {
+    fprintf(stderr, "只能导出普通文件\n");
+    return -1;
+  }
+  if (!appends.empty()) {
+    FlushAppend(n->id);
+  }
+  FlushBuffer();
 
-    LOG("读取块%d\n", b);
-    PutBlock(b, true);
-    start_pos += s;
-    start_pos %= BLOCK_SIZE;
-    len -= s;
-    r_size += s;
+  const superBlock *super = GetSuperBlock();
+  const int block_size = super->block_size;
+  const long long length = n->length;
+  const int end = (length + block_size - 1) / block_size;
+  exportState e{out, 0, false, {}};
+
+  if (n->flags & INODE_COMPRESSED) {
+    std::vector<char> buf(clusterBytes());
+    for (long long pos = 0; pos < length && !e.failed; pos += buf.size()) {
+      const int len = std::min<long long>(buf.size(), length - pos);
+      readCompressed(n, pos, len, buf.data());
+      exportIov(&e, buf.data(), len);
+      flushExport(&e);  // 缓冲区下一簇要重用
+    }
+    return e.failed ? -1 : length;
   }
 
-  if (n->second_index > 0) {
-    PutBlock(n->second_index, true);
+  for (int i = 0; i < end && !e.failed;) {
+    const long long start = (long long)i * block_size;
+    int run = 0;
+    int flags = 0;
+    const int b = LookupBlock(n, i, &run, &flags);
+    if (b <= 0 || (flags & EXTENT_UNWRITTEN)) {
+      int next = b > 0 ? i + run : nextMapped(n, i, end, true);
+      next = next < 0 ? end : std::min(next, end);
+      exportZeros(&e, std::min<long long>((long long)next * block_size, length) - start);
+      i = next;
+      continue;
+    }
+    // 老的索引方式一次只返回一块，物理上相邻的接起来
+    for (int next = 0, f = 0; i + run < end && LookupBlock(n, i + run, &next, &f) == b + run &&
+                              !(f & EXTENT_UNWRITTEN);) {
+      run += next;
+    }
+    run = std::min(run, end - i);
+    if (b + run > super->block_count) {
+      e.failed = true;
+      break;
+    }
+    const long long bytes = std::min<long long>((long long)run * block_size, length - start);
+    long long copied = 0;
+    if (run >= EXPORT_KERNEL_RUN) {
+      copied = exportKernel(&e, super->data_offset + (long long)b * block_size, bytes);
+    }
+    if (copied < bytes) {
+      exportIov(&e, GetBlock(b)->content + copied, bytes - copied);
+    }
+    i += run;
   }
+  flushExport(&e);
+  return e.failed ? -1 : length;
+}
 
-  LOG("共读取%d字节\n", r_size);
-  return r_size;
+bool Reflink(int src, int dst) { return CloneBlocks(contentInode(src), GetInode(dst)); }
+
+// 目录的散列索引从最大文件长度对应的逻辑块起，Read/Write 碰不到，随目录释放，随快照共享
+static int dirIndexBase() { return MAX_EXTENT_FILE_SIZE / GetSuperBlock()->block_size; }
+
+dataBlock *DirIndexBlock(int dir, int k, bool write, int *b) {
+  inode *n = GetInode(dir);
+  *b = 0;
+  if (!(n->flags & INODE_EXTENTS)) {
+    return nullptr;
+  }
+  const int i = dirIndexBase() + k;
+  *b = LookupBlock(n, i);
+  if (!write) {
+    if (*b > 0) {
+      PutBlock(*b, false);
+    }
+    return *b > 0 ? GetBlock(*b) : nullptr;
+  }
+
+  PreserveInode(dir);
+  const int block_size = GetSuperBlock()->block_size;
+  if (*b > 0 && DataBlockShared(*b)) {
+    const int copy = allocBlock();
+    if (copy <= 0) {
+      return nullptr;
+    }
+    memcpy(GetBlock(copy), GetBlock(*b), block_size);
+    if (mapBlocks(n, i, copy, 1) == false) {
+      ReleaseDataBlock(copy);
+      return nullptr;
+    }
+    ReleaseDataBlock(*b);
+    *b = copy;
+  } else if (*b <= 0) {
+    dataBlock *block = getBlock(n, i, b);
+    if (block == nullptr) {
+      return nullptr;
+    }
+    memset(block, 0, block_size);
+  }
+  return GetBlock(*b);
+}
+
+void DirIndexFree(int dir) {
+  inode *n = GetInode(dir);
+  if (n->flags & INODE_EXTENTS) {
+    PreserveInode(dir);
+    ExtentUnmap(n, dirIndexBase(), INT_MAX - dirIndexBase());
+  }
+}
+
+// 按段共享：每块加一次共享计数，再把整段映射进 dst，区段树文件一段只要一次 ExtentMap。
+// 计数满了的块只能复制一份。
+bool CloneBlocks(const inode *s, inode *d) {
+  transaction t;
+  const int block_size = GetSuperBlock()->block_size;
+  // 映射和存储方式、目录项格式和源文件一样，目录的散列索引也一起共享
+  constexpr unsigned int format =
+      INODE_EXTENTS | INODE_COMPRESSED | INODE_DIR_INDEX | INODE_DIR_NAMES;
+  d->flags = (d->flags & ~format) | (s->flags & format);
+
+  const int end =
+      (s->flags & INODE_DIR_INDEX) ? INT_MAX : (maxLength(s) + block_size - 1) / block_size;
+  for (int i = nextMapped(s, 0, end, true); i >= 0; i = nextMapped(s, i, end, true)) {
+    int run = 0;
+    int flags = 0;
+    const int b = LookupBlock(s, i, &run, &flags);
+    for (int k = 0; k < run;) {
+      int shared = 0;
+      while (k + shared < run && ShareDataBlock(b + k + shared)) {
+        ++shared;
+      }
+      if (shared > 0 && mapBlocks(d, i + k, b + k, shared, flags) == false) {
+        for (int x = 0; x < shared; ++x) {
+          ReleaseDataBlock(b + k + x);
+        }
+        return false;
+      }
+      k += shared;
+      if (k < run) {
+        int copy = AllocDataBlock();
+        if (copy <= 0) {
+          return false;
+        }
+        memcpy(GetBlock(copy), GetBlock(b + k), block_size);
+        PutDataBlock(copy, true);
+        if (mapBlocks(d, i + k, copy, 1, flags) == false) {
+          ReleaseDataBlock(copy);
+          return false;
+        }
+        ++k;
+      }
+    }
+    i += run;
+  }
+
+  d->length = s->length;
+  PutInode(d->id, true);
+  return true;
+}
+
+// 已经在索引里的块跳过；内容和索引里别的块相同就改映射到那一块上，否则把这一块加进索引。
+// 内容不变，不用为快照保留。
+int DedupFile(int index) {
+  transaction t;
+  inode *n = GetInode(index);
+  if (n->type != FILE_TYPE || (n->flags & (INODE_INTERNAL | INODE_COMPRESSED))) {
+    return 0;  // 压缩簇的块改映射会丢掉压缩标记
+  }
+  const int block_size = GetSuperBlock()->block_size;
+  const int end = (n->length + block_size - 1) / block_size;
+  int saved = 0;
+  for (int i = nextMapped(n, 0, end); i >= 0; i = nextMapped(n, i, end)) {
+    int run = 0;
+    const int b = LookupBlock(n, i, &run);
+    run = std::min(run, end - i);
+    for (int k = 0; k < run; ++k) {
+      const int cur = b + k;
+      if (DataBlockShared(cur) && DataBlockRefs(cur) == 1) {
+        continue;  // 只有自己用，共享标记只能是在索引里
+      }
+      unsigned long long hash = 0;
+      const int same = DedupFind(GetBlock(cur)->content, &hash);
+      if (same == 0) {
+        DedupInsert(hash, cur);
+      } else if (same != cur && ShareDataBlock(same)) {
+        if (mapBlocks(n, i + k, same, 1) == false) {
+          ReleaseDataBlock(same);
+          return saved;
+        }
+        saved += DataBlockRefs(cur) == 1;
+        ReleaseDataBlock(cur);
+      }
+    }
+    i += run;
+  }
+  PutInode(index, true);
+  return saved;
 }
 
 // 通过字节数组的抽象，这里实现了文件是一个一个entry的抽象
@@ -222,34 +1321,123 @@ int WriteEntry(int index, int p, int size, const char *buf) {
   return Write(index, pos, len, buf);
 }
 
+static bool namedDir(int dir) { return GetInode(dir)->flags & INODE_DIR_NAMES; }
+
+static int entriesPerBlock() { return GetSuperBlock()->block_size / sizeof(namedEntry); }
+
+// 带名字的目录项第 p 项的字节偏移，一项不跨块
+static int entryOffset(int p) {
+  const int per = entriesPerBlock();
+  return p / per * GetSuperBlock()->block_size + p % per * sizeof(namedEntry);
+}
+
+int DirEntries(int dir) {
+  const int length = GetInode(dir)->length;
+  if (!namedDir(dir)) {
+    return length / sizeof(dirEntry);
+  }
+  const int block_size = GetSuperBlock()->block_size;
+  return length / block_size * entriesPerBlock() + length % block_size / sizeof(namedEntry);
+}
+
+void FillDirEntry(namedEntry *e, int file_id, const char *name) {
+  memset(e, 0, sizeof(*e));
+  e->file_id = file_id;
+  if (file_id > 0) {
+    e->type = GetInode(file_id)->type;
+    e->name_len = strlen(name);
+    memcpy(e->name, name, e->name_len);
+    e->hash = NameHash(name);
+  }
+}
+
+int ReadDirEntries(int dir, int pos, int count, namedEntry *out) {
+  count = std::min(count, DirEntries(dir) - pos);
+  if (count <= 0) {
+    return 0;
+  }
+  if (!namedDir(dir)) {
+    for (int i = 0; i < count; ++i) {
+      dirEntry entry;
+      ReadEntry(dir, pos + i, sizeof(entry), (char *)&entry);
+      FillDirEntry(&out[i], entry.file_id,
+                   entry.file_id > 0 ? GetInode(entry.file_id)->file_name : "");
+    }
+    return count;
+  }
+
+  // 同一块里的项是连续的，每块读一次
+  const int per = entriesPerBlock();
+  for (int i = 0; i < count;) {
+    const int run = std::min(per - (pos + i) % per, count - i);
+    Read(dir, entryOffset(pos + i), run * sizeof(namedEntry), (char *)(out + i));
+    i += run;
+  }
+  return count;
+}
+
+bool WriteDirEntry(int dir, int pos, const namedEntry *e) {
+  if (!namedDir(dir)) {
+    dirEntry entry{e->file_id};
+    return WriteEntry(dir, pos, sizeof(entry), (const char *)&entry) == sizeof(entry);
+  }
+  return Write(dir, entryOffset(pos), sizeof(*e), (const char *)e) == sizeof(*e);
+}
+
+bool TruncateDir(int dir, int count) {
+  inode *n = GetInode(dir);
+  const int length = namedDir(dir) ? entryOffset(count) : count * (int)sizeof(dirEntry);
+  if (count < 0 || length >= n->length) {
+    return false;
+  }
+
+  transaction t;
+  const int block_size = GetSuperBlock()->block_size;
+  const int used = (n->length + block_size - 1) / block_size;
+  const int keep = (length + block_size - 1) / block_size;
+  if (keep < used) {
+    releaseRange(n, keep, used);
+  }
+  PreserveInode(dir);
+  n->length = length;
+  PutInode(dir, true);
+  return true;
+}
+
 // 删除一个文件，释放block块。
 bool RemoveFile(int index) {
+  transaction t;
+  PreserveInode(index);
+  appends.erase(index);  // 攒着的追加和预分配的块随文件一起丢掉
+  if (cluster_cache.id == index) {
+    ResetClusterCache();
+  }
   inode *n = GetInode(index);
+  const int block_size = GetSuperBlock()->block_size;
 
+  if (n->flags & INODE_EXTENTS) {
+    ExtentFree(n);
+    ReleaseInode(index);
+    return true;
+  }
+
+  // 只改元数据，块里的内容不清零
   for (int i = 0; i < MAX_FIRST_INDEX; ++i) {
     if (n->first_index[i] > 0) {
-      memset(GetBlock(n->first_index[i]), 0, BLOCK_SIZE);
-      PutBlock(n->first_index[i], true);
       ReleaseDataBlock(n->first_index[i]);
     }
   }
 
   if (n->type == FILE_TYPE && n->second_index > 0) {
     indexBlock *b = GetIndexBlock(n->second_index);
-    for (int i = 0; i < MAX_SECOND_INDEX; ++i) {
+    for (int i = 0; i < block_size / (int)sizeof(int); ++i) {
       if (b->data_block[i] > 0) {
-        memset(GetBlock(b->data_block[i]), 0, BLOCK_SIZE);
-        PutBlock(b->data_block[i], true);
         ReleaseDataBlock(b->data_block[i]);
       }
     }
-
-    memset(b, 0, BLOCK_SIZE);
-    PutBlock(n->second_index, true);
+    ReleaseDataBlock(n->second_index);
   }
 
-  memset(n, 0, INODE_SIZE);
-  PutInode(index, true);
-  // ReleaseDataBlock(index); // 修改之后，first_index[0]指向的块是inode节点，所以不要重复释放
+  ReleaseInode(index);
   return true;
 }
\ No newline at end of file
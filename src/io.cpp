@@ -0,0 +1,424 @@
+#include <errno.h>
+#include <limits.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "head.h"
+
+// 写回后端：缓冲池写回的块交给这里，调用者不等写完，只有在持久化点(IoSync)和
+// 可见性点(FlushBuffer)才等。提交时把内容拷一份，之后内存再改也不影响正在写的内容。
+// 写先攒在 pending 里，攒够一批一起提交：io_uring 一次 io_uring_enter 提交一批 SQE，
+// 线程池把一批请求分给几个线程 pwritev。同一位置在上次等待之后又要写，先等前一次写完，
+// 保证旧内容不会覆盖新内容。
+// 提交前按位置排序，物理上相邻的请求合并成一次向量写(pwritev / IORING_OP_WRITEV)，
+// 连续的一段块只要一个系统调用。
+
+io_backend_type io_backend = IO_BACKEND_AUTO;
+
+typedef struct ioRequest {
+  long long offset;
+  std::vector<char> data;
+} ioRequest;
+
+// 合并后的一次写：若干个首尾相接的请求
+typedef struct ioWrite {
+  long long offset;
+  long long length;
+  std::vector<ioRequest *> parts;
+  std::vector<iovec> iov;
+} ioWrite;
+
+// 一种后端就是一组函数
+typedef struct ioBackend {
+  const char *name;
+  bool (*open)();
+  void (*submit)(std::vector<ioWrite *> *batch);  // 接管 batch 中的写，写完后用 finish 释放
+  void (*wait)();                                // 等所有提交的写完成
+  void (*close)();
+} ioBackend;
+
+static const ioBackend *backend = nullptr;
+static std::vector<ioRequest *> pending;              // 还没提交的请求
+static std::unordered_map<long long, int> pending_index;  // offset -> pending 下标
+static std::unordered_set<long long> written;         // 上次等待之后提交过的位置
+static ioStat io_stat;
+
+// 写失败或者写了一半，退回逐个同步 pwrite，和原来的写法一样出错就断言。
+static void write_sync(const ioWrite *w) {
+  for (const ioRequest *r : w->parts) {
+    ssize_t ret = pwrite(fd, r->data.data(), r->data.size(), r->offset);
+    assert(ret == (ssize_t)r->data.size());
+  }
+}
+
+static void finish(ioWrite *w) {
+  for (ioRequest *r : w->parts) {
+    delete r;
+  }
+  delete w;
+}
+
+/* ----------------------同步---------------------- */
+static bool sync_open() { return true; }
+
+static void sync_submit(std::vector<ioWrite *> *batch) {
+  for (ioWrite *w : *batch) {
+    if (pwritev(fd, w->iov.data(), w->iov.size(), w->offset) != w->length) {
+      write_sync(w);
+    }
+    ++io_stat.syscalls;
+    finish(w);
+  }
+}
+
+static void sync_wait() {}
+static void sync_close() {}
+
+static const ioBackend sync_backend{"sync", sync_open, sync_submit, sync_wait, sync_close};
+
+/* ----------------------io_uring---------------------- */
+// 不依赖 liburing，直接用系统调用建环。
+static int ring_fd = -1;
+static unsigned ring_entries = 0;
+static void *sq_ptr = nullptr;
+static void *cq_ptr = nullptr;
+static size_t sq_size = 0;
+static size_t cq_size = 0;
+static io_uring_sqe *sqes = nullptr;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static io_uring_cqe *cqes = nullptr;
+static unsigned inflight = 0;     // 已经放进 SQ、还没收到完成的请求数
+static unsigned unsubmitted = 0;  // 放进 SQ、还没 io_uring_enter 的请求数
+
+static int uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+  ++io_stat.syscalls;
+  return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static void uring_close() {
+  if (ring_fd < 0) {
+    return;
+  }
+  if (sqes != nullptr) {
+    munmap(sqes, ring_entries * sizeof(io_uring_sqe));
+  }
+  if (cq_ptr != nullptr && cq_ptr != sq_ptr) {
+    munmap(cq_ptr, cq_size);
+  }
+  if (sq_ptr != nullptr) {
+    munmap(sq_ptr, sq_size);
+  }
+  close(ring_fd);
+  ring_fd = -1;
+  sq_ptr = cq_ptr = nullptr;
+  sqes = nullptr;
+}
+
+static bool uring_open() {
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring_fd = syscall(__NR_io_uring_setup, IO_QUEUE_DEPTH, &p);
+  if (ring_fd < 0) {
+    return false;
+  }
+
+  ring_entries = p.sq_entries;
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_size = cq_size = std::max(sq_size, cq_size);
+  }
+
+  sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    sq_ptr = nullptr;
+    uring_close();
+    return false;
+  }
+  cq_ptr = sq_ptr;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                  IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      cq_ptr = nullptr;
+      uring_close();
+      return false;
+    }
+  }
+  sqes = (io_uring_sqe *)mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe),
+                              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                              IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    sqes = nullptr;
+    uring_close();
+    return false;
+  }
+
+  char *sq = (char *)sq_ptr;
+  sq_head = (unsigned *)(sq + p.sq_off.head);
+  sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq + p.sq_off.array);
+  char *cq = (char *)cq_ptr;
+  cq_head = (unsigned *)(cq + p.cq_off.head);
+  cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+  inflight = unsubmitted = 0;
+  return true;
+}
+
+// 收割已经完成的请求，不阻塞。
+static void uring_reap() {
+  unsigned head = *cq_head;
+  const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const io_uring_cqe *cqe = &cqes[head & *cq_mask];
+    ioWrite *w = (ioWrite *)cqe->user_data;
+    if (cqe->res != w->length) {
+      write_sync(w);
+    }
+    finish(w);
+    --inflight;
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+// 提交 SQ 里还没提交的请求，min_complete 大于 0 时等到至少这么多个完成。
+static void uring_flush(unsigned min_complete) {
+  while (unsubmitted > 0 || min_complete > 0) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = uring_enter(unsubmitted, min_complete, flags);
+    if (ret < 0) {
+      assert(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+      uring_reap();
+      continue;
+    }
+    unsubmitted -= std::min<unsigned>(ret, unsubmitted);
+    break;
+  }
+  uring_reap();
+}
+
+static void uring_submit(std::vector<ioWrite *> *batch) {
+  uring_reap();
+  for (ioWrite *w : *batch) {
+    // SQ 或者在途请求满了，先等一个完成
+    while (inflight >= ring_entries) {
+      uring_flush(1);
+    }
+
+    const unsigned tail = *sq_tail;
+    const unsigned i = tail & *sq_mask;
+    io_uring_sqe *sqe = &sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)w->iov.data();
+    sqe->len = w->iov.size();
+    sqe->off = w->offset;
+    sqe->user_data = (unsigned long long)w;
+    sq_array[i] = i;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++inflight;
+    ++unsubmitted;
+  }
+  uring_flush(0);
+}
+
+static void uring_wait() {
+  while (inflight > 0) {
+    uring_flush(inflight);
+  }
+}
+
+static const ioBackend uring_backend{"io_uring", uring_open, uring_submit, uring_wait,
+                                     uring_close};
+
+/* ----------------------线程池---------------------- */
+// 没有 io_uring 的内核上，几个线程各自 pwritev，同样做到调用者不等、多个写同时在途。
+static std::vector<std::thread> workers;
+static std::deque<ioWrite *> queue;
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;  // 有新请求或者要退出
+static std::condition_variable done_cv;   // 有请求写完
+static int outstanding = 0;               // 提交了还没写完的请求数
+static bool stopping = false;
+
+static void worker() {
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  while (true) {
+    queue_cv.wait(lock, [] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return;
+    }
+    ioWrite *w = queue.front();
+    queue.pop_front();
+    lock.unlock();
+
+    if (pwritev(fd, w->iov.data(), w->iov.size(), w->offset) != w->length) {
+      write_sync(w);
+    }
+    finish(w);
+
+    lock.lock();
+    ++io_stat.syscalls;
+    if (--outstanding < IO_QUEUE_DEPTH) {
+      done_cv.notify_all();
+    }
+  }
+}
+
+static bool threads_open() {
+  stopping = false;
+  outstanding = 0;
+  for (int i = 0; i < IO_THREADS; ++i) {
+    workers.emplace_back(worker);
+  }
+  return true;
+}
+
+static void threads_submit(std::vector<ioWrite *> *batch) {
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  for (ioWrite *w : *batch) {
+    done_cv.wait(lock, [] { return outstanding < IO_QUEUE_DEPTH; });
+    queue.push_back(w);
+    ++outstanding;
+    queue_cv.notify_one();
+  }
+}
+
+static void threads_wait() {
+  std::unique_lock<std::mutex> lock(queue_mutex);
+  done_cv.wait(lock, [] { return outstanding == 0; });
+}
+
+static void threads_close() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    stopping = true;
+  }
+  queue_cv.notify_all();
+  for (auto &t : workers) {
+    t.join();
+  }
+  workers.clear();
+}
+
+static const ioBackend threads_backend{"threads", threads_open, threads_submit, threads_wait,
+                                       threads_close};
+
+/* ----------------------对外接口---------------------- */
+void IoOpen() {
+  IoClose();
+  // 下标和 io_backend_type 对应，AUTO 先试 io_uring
+  const ioBackend *candidates[] = {&sync_backend, &uring_backend, &threads_backend,
+                                   &uring_backend};
+  backend = candidates[io_backend];
+  if (backend->open() == false) {
+    LOG("%s 不可用，改用线程池\n", backend->name);
+    backend = &threads_backend;
+    backend->open();
+  }
+  LOG("写回后端 %s\n", backend->name);
+}
+
+void IoClose() {
+  if (backend == nullptr) {
+    return;
+  }
+  IoWait();
+  backend->close();
+  backend = nullptr;
+}
+
+void IoWrite(long long offset, const char *buf, int len) {
+  if (backend == nullptr) {
+    ssize_t ret = pwrite(fd, buf, len, offset);
+    assert(ret == len);
+    ++io_stat.syscalls;
+    return;
+  }
+
+  // 还没提交的同一位置直接换成新内容
+  auto it = pending_index.find(offset);
+  if (it != pending_index.end() && (int)pending[it->second]->data.size() == len) {
+    memcpy(pending[it->second]->data.data(), buf, len);
+    return;
+  }
+
+  // 同一位置的上一次写可能还在途，或者还没提交但长度不同，先等它写完
+  if (written.count(offset) > 0 || it != pending_index.end()) {
+    IoWait();
+  }
+
+  pending_index[offset] = pending.size();
+  pending.push_back(new ioRequest{offset, std::vector<char>(buf, buf + len)});
+  ++io_stat.requests;
+  io_stat.bytes += len;
+  if ((int)pending.size() >= IO_BATCH_SIZE) {
+    IoSubmit();
+  }
+}
+
+void IoSubmit() {
+  if (backend == nullptr || pending.empty()) {
+    return;
+  }
+  // 按位置排序，首尾相接的合并成一次写
+  std::sort(pending.begin(), pending.end(),
+            [](const ioRequest *a, const ioRequest *b) { return a->offset < b->offset; });
+  std::vector<ioWrite *> batch;
+  for (ioRequest *r : pending) {
+    written.insert(r->offset);
+    ioWrite *w = batch.empty() ? nullptr : batch.back();
+    if (w == nullptr || w->offset + w->length != r->offset || (int)w->iov.size() >= IOV_MAX ||
+        w->length + (long long)r->data.size() > IO_MAX_WRITE) {
+      w = new ioWrite{r->offset, 0, {}, {}};
+      batch.push_back(w);
+    }
+    w->length += r->data.size();
+    w->parts.push_back(r);
+    w->iov.push_back(iovec{r->data.data(), r->data.size()});
+  }
+
+  ++io_stat.batches;
+  io_stat.writes += batch.size();
+  backend->submit(&batch);
+  pending.clear();
+  pending_index.clear();
+}
+
+void IoWait() {
+  if (backend == nullptr) {
+    return;
+  }
+  IoSubmit();
+  backend->wait();
+  written.clear();
+  ++io_stat.waits;
+}
+
+void IoSync() {
+  IoWait();
+  fdatasync(fd);
+}
+
+const char *IoBackendName() { return backend != nullptr ? backend->name : "none"; }
+
+const ioStat *GetIoStat() { return &io_stat; }
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cassert>
+#include <vector>
+#include "head.h"
+
+// 重做日志 + 组提交。
+// 高级操作用 BeginTransaction/CommitTransaction 包起来，事务内 Put 的元数据帧被缓冲池标记为 logged，
+// 提交时不立刻写盘，而是攒成一组。组提交的顺序：
+//   1. 写回普通数据帧，等写回后端写完再 fdatasync(顺带保证上一组的原位写回已经落盘)
+//   2. 把本组所有 logged 帧的最新内容写进日志区，再写日志头，fdatasync
+//   3. 把这些帧写回原位
+// 崩溃后 OpenFileSystem 调用 ReplayJournal，校验和正确的日志整体重放，否则整体丢弃。
+// 一组记录必须整个放进日志区。删除大目录、压缩目录这类改动很多的操作在中间一致的地方调用
+// JournalCheckpoint，快装不下时提前组提交，这样单个事务不会超过日志区。
+// 映射在日志模式下是 MAP_PRIVATE 的，没提交的修改不会被内核提前写回文件。
+
+typedef struct journalHeader {
+  unsigned int magic;     // JOURNAL_MAGIC 表示日志有效
+  unsigned int sequence;  // 组提交序号
+  int length;             // 记录区字节数
+  int records;            // 记录条数
+  unsigned int checksum;  // 记录区校验和
+} journalHeader;
+
+typedef struct journalRecord {
+  long long offset;  // 记录要写回的磁盘位置
+  int length;        // 后面紧跟的数据长度
+  int reserved;
+} journalRecord;
+
+bool use_journal = true;
+
+static int depth = 0;                // 事务嵌套深度，只有最外层提交才算一次
+static int group_transactions = 0;   // 当前组里已经提交的事务数
+static unsigned int sequence = 0;    // 组提交序号
+static journalStat journal_stat;
+
+// 日志区第一块放日志头，之后是记录区。
+static long long journal_offset() { return GetSuperBlock()->journal_offset; }
+
+static long long journal_capacity() {
+  superBlock *super = GetSuperBlock();
+  return (long long)(super->journal_blocks - 1) * super->block_size;
+}
+
+static unsigned int checksum(const char *buf, int len) {
+  unsigned int h = 2166136261u;  // FNV-1a
+  for (int i = 0; i < len; ++i) {
+    h = (h ^ (unsigned char)buf[i]) * 16777619u;
+  }
+  return h;
+}
+
+bool JournalActive() { return use_journal && io_mode == IO_PWRITE; }
+
+// 等待日志的帧写进日志要多少字节
+static long long logged_bytes() {
+  int count = 0;
+  long long bytes = BufferLoggedBytes(&count);
+  return bytes + count * sizeof(journalRecord);
+}
+
+void BeginTransaction() {
+  // 给新事务留出足够的日志空间，要在进入事务之前组提交
+  if (depth == 0 && JournalActive() && logged_bytes() > journal_capacity() / 4) {
+    FlushJournal();
+  }
+  ++depth;
+}
+
+void CommitTransaction() {
+  assert(depth > 0);
+  if (--depth > 0 || !JournalActive()) {
+    return;
+  }
+
+  ++journal_stat.transactions;
+  ++group_transactions;
+
+  if (group_transactions >= GROUP_COMMIT_SIZE || BufferFull()) {
+    FlushJournal();
+  }
+}
+
+void JournalCheckpoint() {
+  if (depth == 0 || !JournalActive() || logged_bytes() <= journal_capacity() / 2) {
+    return;
+  }
+  const int saved = depth;
+  depth = 0;
+  FlushJournal();
+  depth = saved;
+  ++journal_stat.checkpoints;
+}
+
+bool FlushJournal() {
+  if (depth > 0 || !JournalActive()) {
+    return true;
+  }
+
+  std::vector<std::pair<long long, int>> ranges;
+  BufferLogged(&ranges);
+  if (ranges.empty()) {
+    group_transactions = 0;
+    return true;
+  }
+
+  // 1. 有序写：数据先落盘，日志里的元数据才能指向它。异步的原位写回也在这里等完
+  BufferWriteBack(false);
+  IoSync();
+  BufferDropClean();
+
+  // 2. 组装日志记录区
+  std::vector<char> stream;
+  for (auto &r : ranges) {
+    journalRecord record{r.first, r.second, 0};
+    stream.insert(stream.end(), (char *)&record, (char *)&record + sizeof(record));
+    stream.insert(stream.end(), memory + r.first, memory + r.first + r.second);
+  }
+
+  if ((long long)stream.size() > journal_capacity()) {
+    // 两个检查点之间的改动就超过了日志区，只能放弃原子性直接写回，告诉调用者
+    fprintf(stderr, "日志区不足，%d字节没有原子性地直接写回\n", (int)stream.size());
+    ++journal_stat.overflows;
+    BufferWriteBack(true);
+    group_transactions = 0;
+    return false;
+  }
+
+  journalHeader header{JOURNAL_MAGIC, ++sequence, (int)stream.size(), (int)ranges.size(),
+                       checksum(stream.data(), stream.size())};
+  ssize_t ret = pwrite(fd, stream.data(), stream.size(), journal_offset() + GetSuperBlock()->block_size);
+  assert(ret == (ssize_t)stream.size());
+  ret = pwrite(fd, &header, sizeof(header), journal_offset());
+  assert(ret == sizeof(header));
+  fdatasync(fd);
+
+  ++journal_stat.commits;
+  journal_stat.records += ranges.size();
+  journal_stat.bytes += stream.size();
+  LOG("组提交%u: %d个事务 %d条记录\n", sequence, group_transactions, (int)ranges.size());
+
+  // 3. 原位写回，异步提交。下一次组提交开始时的 IoSync 保证它们在日志被覆盖前落盘
+  BufferWriteBack(true);
+  group_transactions = 0;
+  return true;
+}
+
+bool ReplayJournal() {
+  journalHeader header;
+  if (pread(fd, &header, sizeof(header), journal_offset()) != sizeof(header) ||
+      header.magic != JOURNAL_MAGIC) {
+    return false;
+  }
+
+  sequence = header.sequence;
+  std::vector<char> stream(
+      header.length > 0 && header.length <= journal_capacity() ? header.length : 0);
+  if (stream.empty() ||
+      pread(fd, stream.data(), stream.size(), journal_offset() + GetSuperBlock()->block_size) !=
+          (ssize_t)stream.size() ||
+      checksum(stream.data(), stream.size()) != header.checksum) {
+    // 日志没有写完整就崩溃了，这一组事务整体作废。
+    LOG("日志%u不完整，丢弃\n", header.sequence);
+    ClearJournal();
+    return false;
+  }
+
+  int pos = 0;
+  for (int i = 0; i < header.records; ++i) {
+    journalRecord record;
+    memcpy(&record, stream.data() + pos, sizeof(record));
+    pos += sizeof(record);
+    ssize_t ret = pwrite(fd, stream.data() + pos, record.length, record.offset);
+    assert(ret == record.length);
+    pos += record.length;
+  }
+
+  fdatasync(fd);
+  ClearJournal();
+  fprintf(stderr, "重放日志%u: %d条记录\n", header.sequence, header.records);
+  return true;
+}
+
+void ClearJournal() {
+  journalHeader header;
+  memset(&header, 0, sizeof(header));
+  ssize_t ret = pwrite(fd, &header, sizeof(header), journal_offset());
+  assert(ret == sizeof(header));
+  fdatasync(fd);
+  depth = 0;
+  group_transactions = 0;
+}
+
+const journalStat *GetJournalStat() { return &journal_stat; }
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "head.h"
+#include "print.h"
+
+// 整个文件系统的快照。
+// 建快照只把当前纪元记进快照表再把纪元加一，不复制任何东西。每个 inode 记着它最后一次保留(或新建)时
+// 的纪元，比当前纪元小说明最新的快照之后还没改过，第一次修改前由 PreserveInode 复制一份 inode，
+// 数据块和目录块按 reflink 共享，对照表记在最新的快照里。
+// 查快照 s 中的 inode 时从 s 开始往后找第一个保留过它的快照，那一份就是它在 s 时的样子；都没有说明
+// s 之后没改过，就是当前的 inode。找到的 inode 纪元比 s 大，说明 s 时它还不存在。
+
+typedef struct snapshotState {
+  snapshotEntry entry;
+  std::unordered_map<int, int> map;  // 当前的 inode -> 保留下来的旧版本
+} snapshotState;
+
+static std::vector<snapshotState> snapshots;
+static bool loaded = false;
+static bool rolling_back = false;  // 回滚时删改 inode 不再保留
+
+void ResetSnapshots() {
+  snapshots.clear();
+  loaded = false;
+}
+
+// 第一次用到时从快照表和对照表文件读进内存
+static void load() {
+  if (loaded) {
+    return;
+  }
+  loaded = true;
+  const superBlock *super = GetSuperBlock();
+  if (super->snapshot_id <= 0) {
+    return;
+  }
+
+  const int count = GetInode(super->snapshot_id)->length / sizeof(snapshotEntry);
+  snapshots.resize(count);
+  for (int i = 0; i < count; ++i) {
+    snapshotState *s = &snapshots[i];
+    ReadEntry(super->snapshot_id, i, sizeof(snapshotEntry), (char *)&s->entry);
+    const int len = GetInode(s->entry.map_id)->length / sizeof(snapshotMap);
+    std::vector<snapshotMap> items(len);
+    if (len > 0) {
+      Read(s->entry.map_id, 0, len * sizeof(snapshotMap), (char *)items.data());
+    }
+    for (const snapshotMap &m : items) {
+      s->map.emplace(m.live, m.copy);
+    }
+  }
+}
+
+static int find(const char *name) {
+  load();
+  for (size_t i = 0; i < snapshots.size(); ++i) {
+    if (strncmp(snapshots[i].entry.name, name, MAX_NAME_LENGTH) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// 快照和对照表用的内部文件，不在任何目录里
+static int internalFile(const char *name) {
+  int index = NewFile(FILE_TYPE, name, "root");
+  if (index <= 0) {
+    return -1;
+  }
+  GetInode(index)->flags |= INODE_INTERNAL;
+  PutInode(index, true);
+  return index;
+}
+
+// 第 k 个快照中 index 号 inode 对应的 inode，那时不存在返回 -1
+static int resolve(int k, int index) {
+  const int epoch = snapshots[k].entry.epoch;
+  for (size_t j = k; j < snapshots.size(); ++j) {
+    auto it = snapshots[j].map.find(index);
+    if (it != snapshots[j].map.end()) {
+      return *InodeEpoch(it->second) > epoch ? -1 : it->second;
+    }
+  }
+
+  if (index <= 0 || !InodeUsed(index) || (GetInode(index)->flags & INODE_INTERNAL) ||
+      *InodeEpoch(index) > epoch) {
+    return -1;
+  }
+  return index;
+}
+
+// 快照中目录 dir 里指向 r 的目录项的名字。老的目录项名字在 inode 里，要看快照里的那个 inode
+static const char *entryName(int dir, const namedEntry &entry, int r) {
+  return (GetInode(dir)->flags & INODE_DIR_NAMES) ? entry.name : GetInode(r)->file_name;
+}
+
+void PreserveInode(int index) {
+  superBlock *super = GetSuperBlock();
+  if (rolling_back || super->snapshot_id <= 0 || index <= 0) {
+    return;
+  }
+  inode *n = GetInode(index);
+  const int epoch = *InodeEpoch(index);
+  if ((n->flags & INODE_INTERNAL) || epoch >= super->epoch) {
+    return;  // 最新的快照之后已经保留过，或者是之后新建的
+  }
+
+  load();
+  transaction t;
+  *InodeEpoch(index) = super->epoch;  // 先改掉，复制过程中再修改不会重复保留
+  PutEpoch(index);
+
+  int copy = NewFile(n->type, n->file_name, n->owner_name);
+  if (copy <= 0) {
+    fprintf(stderr, "inode不足，快照中的%s会看到之后的修改\n", n->file_name);
+    return;
+  }
+  inode *c = GetInode(copy);
+  c->link_cnt = n->link_cnt;
+  if (n->type != FILE_TYPE) {
+    c->link_inode = n->link_inode;  // 目录的上一级、链接的源文件，普通文件是二级索引块不能复制
+  }
+  if (CloneBlocks(n, c) == false) {
+    RemoveFile(copy);
+    fprintf(stderr, "空间不足，快照中的%s会看到之后的修改\n", n->file_name);
+    return;
+  }
+  c->flags |= INODE_INTERNAL;
+  PutInode(copy, true);
+  *InodeEpoch(copy) = epoch;
+  PutEpoch(copy);
+
+  snapshotState *s = &snapshots.back();
+  s->map.emplace(index, copy);
+  snapshotMap m{index, copy};
+  Write(s->entry.map_id, GetInode(s->entry.map_id)->length, sizeof(m), (const char *)&m);
+}
+
+// 快照和回滚涉及所有用户的文件，只有 root(所有用户的祖先)可以做
+static bool allowed() {
+  if (Validate("root", GetCurrentUser()->user_name) == false) {
+    fprintf(stderr, "无权限，只有root可以建立和回滚快照\n");
+    return false;
+  }
+  return true;
+}
+
+bool CreateSnapshot(const char *name) {
+  if (allowed() == false) {
+    return false;
+  }
+  if (strlen(name) >= MAX_NAME_LENGTH) {
+    fprintf(stderr, "快照名过长\n");
+    return false;
+  }
+  if (find(name) >= 0) {
+    fprintf(stderr, "快照已存在\n");
+    return false;
+  }
+
+  transaction t;
+  FlushAppend(0);  // 攒着的追加是快照之前写的
+  superBlock *super = GetSuperBlock();
+  if (super->snapshot_id <= 0) {
+    int table = internalFile(".snapshots");
+    if (table <= 0) {
+      return false;
+    }
+    super->snapshot_id = table;
+    PutSuperBlock(true);
+  }
+
+  snapshotState s;
+  memset(&s.entry, 0, sizeof(s.entry));
+  memcpy(s.entry.name, name, strlen(name));
+  s.entry.epoch = super->epoch;
+  s.entry.map_id = internalFile(name);
+  if (s.entry.map_id <= 0) {
+    return false;
+  }
+  Write(super->snapshot_id, GetInode(super->snapshot_id)->length, sizeof(s.entry),
+        (const char *)&s.entry);
+  ++super->epoch;
+  PutSuperBlock(true);
+  snapshots.push_back(s);
+  return true;
+}
+
+void ShowSnapshots() {
+  load();
+  for (const snapshotState &s : snapshots) {
+    PRINT_FONT_GRE;
+    fprintf(stdout, "[name]%s ", s.entry.name);
+    PRINT_FONT_RED;
+    fprintf(stdout, "[epoch]%d [preserved]%zu\n", s.entry.epoch, s.map.size());
+    PRINT_FONT_BLA;
+  }
+  fprintf(stdout, "\n");
+}
+
+int SnapshotInode(const char *name, int index) {
+  const int k = find(name);
+  return k < 0 ? -1 : resolve(k, index);
+}
+
+int SnapshotLookup(const char *name, const char *path) {
+  const int k = find(name);
+  if (k < 0) {
+    return -1;
+  }
+
+  int dir = resolve(k, GetSuperBlock()->root_dir_id);
+  std::string rest = path;
+  size_t begin = 0;
+  while (dir > 0 && begin < rest.size()) {
+    size_t end = rest.find('/', begin);
+    if (end == std::string::npos) {
+      end = rest.size();
+    }
+    const std::string part = rest.substr(begin, end - begin);
+    begin = end + 1;
+    if (part.empty() || part == ".") {
+      continue;
+    }
+
+    inode *d = GetInode(dir);
+    if (d->type != DIR_TYPE) {
+      return -1;
+    }
+    if (part == "..") {
+      dir = d->last_dir > 0 ? resolve(k, d->last_dir) : dir;
+      continue;
+    }
+
+    int next = -1;
+    const int len = DirEntries(dir);
+    for (int i = 0; i < len && next < 0; ++i) {
+      namedEntry entry;
+      ReadDirEntries(dir, i, 1, &entry);
+      int r = entry.file_id > 0 ? resolve(k, entry.file_id) : -1;
+      if (r > 0 && strcmp(entryName(dir, entry, r), part.c_str()) == 0) {
+        next = r;
+      }
+    }
+    dir = next;
+  }
+  return dir;
+}
+
+void SnapshotList(const char *name, const char *path) {
+  const int k = find(name);
+  const int dir = SnapshotLookup(name, path);
+  if (dir <= 0 || GetInode(dir)->type != DIR_TYPE) {
+    fprintf(stderr, "快照中无此目录\n");
+    return;
+  }
+
+  const int len = DirEntries(dir);
+  for (int i = 0; i < len; ++i) {
+    namedEntry entry;
+    ReadDirEntries(dir, i, 1, &entry);
+    const int r = entry.file_id > 0 ? resolve(k, entry.file_id) : -1;
+    if (r <= 0) {
+      continue;
+    }
+
+    inode *n = GetInode(r);
+    int source = n->type == LINK_TYPE ? resolve(k, n->link_inode) : -1;
+    inode *nn = source > 0 ? GetInode(source) : nullptr;
+    PRINT_FONT_YEL;
+    fprintf(stdout, "[type]%s ", TYPE2NAME[n->type]);
+    PRINT_FONT_GRE;
+    fprintf(stdout, "[name]%s ", entryName(dir, entry, r));
+    PRINT_FONT_RED;
+    fprintf(stdout, "[owner]%s [size]%d [inode]%d [link]%d\n", n->owner_name,
+            (nn != nullptr ? nn->length : n->length), entry.file_id,
+            (nn != nullptr ? nn->link_cnt : n->link_cnt));
+    PRINT_FONT_BLA;
+  }
+  fprintf(stdout, "\n");
+}
+
+void SnapshotRead(const char *name, const char *path) {
+  const int k = find(name);
+  int index = SnapshotLookup(name, path);
+  if (index > 0 && GetInode(index)->type == LINK_TYPE) {
+    index = resolve(k, GetInode(index)->link_inode);  // 链接指向快照里的源文件
+  }
+  if (index <= 0 || GetInode(index)->type != FILE_TYPE) {
+    fprintf(stderr, "快照中无此文件\n");
+    return;
+  }
+
+  const int length = GetInode(index)->length;
+  std::vector<char> buf(length);
+  if (length > 0) {
+    Read(index, 0, length, buf.data());
+  }
+  fwrite(buf.data(), 1, buf.size(), stdout);
+  fprintf(stdout, "\n");
+}
+
+// 在快照之后改过的 inode 换回保留的旧版本，之后新建的删掉，之后的快照和用不到的旧版本一起丢掉。
+// 快照本身留下，对照表清空，回滚之后还可以再回到它。
+bool RollbackSnapshot(const char *name) {
+  if (allowed() == false) {
+    return false;
+  }
+  const int k = find(name);
+  if (k < 0) {
+    fprintf(stderr, "不存在的快照\n");
+    return false;
+  }
+
+  transaction t;
+  DropAppend(0);
+  rolling_back = true;
+  superBlock *super = GetSuperBlock();
+  const int epoch = snapshots[k].entry.epoch;
+
+  // 每个之后改过的 inode 回到哪个旧版本，-1 表示快照时还不存在
+  std::map<int, int> plan;
+  std::unordered_set<int> sources;
+  for (size_t j = k; j < snapshots.size(); ++j) {
+    for (const auto &item : snapshots[j].map) {
+      if (plan.count(item.first) == 0) {
+        const int r = resolve(k, item.first);
+        plan[item.first] = r;
+        if (r > 0) {
+          sources.insert(r);
+        }
+      }
+    }
+  }
+
+  for (size_t j = k; j < snapshots.size(); ++j) {
+    for (const auto &item : snapshots[j].map) {
+      if (sources.count(item.second) == 0) {
+        RemoveFile(item.second);
+      }
+    }
+    if (j > (size_t)k) {
+      RemoveFile(snapshots[j].entry.map_id);
+    }
+  }
+
+  // 旧版本先拿出来，腾出编号；块的所有权跟着 inode 走，不用动
+  std::vector<std::pair<inode, int>> restored;
+  for (const auto &item : plan) {
+    if (item.second > 0) {
+      inode n = *GetInode(item.second);
+      n.id = item.first;
+      n.flags &= ~INODE_INTERNAL;
+      restored.emplace_back(n, *InodeEpoch(item.second));
+      ReleaseInode(item.second);
+    }
+  }
+
+  for (int i = 1; i < super->inode_count; ++i) {
+    if (InodeUsed(i) && (GetInode(i)->flags & INODE_INTERNAL) == 0 &&
+        (plan.count(i) > 0 || *InodeEpoch(i) > epoch)) {
+      RemoveFile(i);
+    }
+  }
+
+  for (const auto &item : restored) {
+    const int index = item.first.id;
+    if (InodeUsed(index)) {
+      fprintf(stderr, "inode %d 被占用，无法恢复\n", index);
+      continue;
+    }
+    InodeBitmapUse(index);
+    *GetInode(index) = item.first;
+    PutInode(index, true);
+    *InodeEpoch(index) = item.second;
+    PutEpoch(index);
+  }
+
+  // 之后的快照从表里去掉，这个快照的对照表清空。多出来的块留着，下次写的时候接着用
+  inode *table = GetInode(super->snapshot_id);
+  table->length = (k + 1) * sizeof(snapshotEntry);
+  PutInode(table->id, true);
+  inode *map = GetInode(snapshots[k].entry.map_id);
+  map->length = 0;
+  PutInode(map->id, true);
+  snapshots.resize(k + 1);
+  snapshots[k].map.clear();
+  super->epoch = epoch + 1;
+  PutSuperBlock(true);
+
+  open_file.clear();
+  open_file.insert(super->user_info_id);
+  current_dir_index = super->root_dir_id;
+  ResetDentryCache();
+  ResetDirSlots();
+  rolling_back = false;
+  return true;
+}
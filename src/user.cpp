@@ -137,6 +137,7 @@ bool Validate(const char *owner, const char *worker) {
 
 // 新增用户就是在user_info中添加一个userEntry。
 bool UserAdd(const char *name, const char *passwd, const char *parent) {
+  transaction t;
   if (exist(name) >= 0) {
     fprintf(stderr, "该用户已存在.\n");
     return false;
@@ -165,6 +166,7 @@ bool UserAdd(const char *name, const char *passwd, const char *parent) {
 // 删除用户就是把user_info中对应的userEntry清空，并把它的孩子的父亲改为它的父亲。
 // 但是需要判断是否允许删除。
 bool UserDel(const char *name) {
+  transaction t;
   int index = exist(name);
 
   if (index < 0) {
@@ -5,20 +5,21 @@
 #include <cassert>
 #include <iostream>
 #include <string>
+#include <vector>
 #include "head.h"
 
-char buf[MAX_FILE_SIZE];
-
 int main() {
   FormatFileSystem(root_path);
   LogIn("root", "root");
   need_log = false;
+  const int max_file_size = MaxFileSize();
+  std::vector<char> buf(max_file_size);
 
-  for (int i = 0; i < MAX_BLOCK_NUMBER; ++i) {
+  for (int i = 0; i < GetSuperBlock()->block_count; ++i) {
     std::string s = std::to_string(i);
     CreateFile(s.c_str());
     std::cout << i << std::endl;
-    assert(Append(Open(s.c_str()), MAX_FILE_SIZE, buf) == MAX_FILE_SIZE);
+    assert(Append(Open(s.c_str()), max_file_size, buf.data()) == max_file_size);
     ReadFile(s.c_str());
   }
 
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 追加缓存：小追加合并写下去，读之前先写下去，关闭时还回多预分配的块；Fallocate 不改变长度。
+int main() {
+  need_log = false;
+  geometry geo{64 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+
+  CreateFile("x");  // 先让根目录有内容块
+  CreateFile("log");
+  const int free_blocks = super->free_blocks;
+  int index = Open("log");
+
+  // 一百万字节，每次 27 字节
+  std::string expect;
+  constexpr char line[] = "abcdefghijklmnopqrstuvwxyz";
+  while (expect.size() < 1000000) {
+    assert(Append(index, sizeof(line), line) == (int)sizeof(line));
+    expect.append(line, sizeof(line));
+  }
+  const appendStat *stat = GetAppendStat();
+  printf("追加%lld次，写下去%lld次，预分配%lld块\n", stat->appends, stat->flushes,
+         stat->preallocated);
+  assert(stat->flushes < stat->appends / 100);
+
+  // 读的时候能看到还攒着的内容
+  std::vector<char> out(expect.size());
+  assert(Read(index, 0, out.size(), out.data()) == (int)out.size());
+  assert(std::string(out.begin(), out.end()) == expect);
+  assert(GetInode(index)->length == (int)expect.size());
+
+  // 文件预分配了块，关闭时只留下用到的
+  const int used = (expect.size() + 4095) / 4096;
+  assert(free_blocks - super->free_blocks > used);
+  assert(CloseFile("log"));
+  assert(free_blocks - super->free_blocks == used);
+  assert(ExtentCount(GetInode(index)) == 1);
+
+  // 关掉缓存后照常直接写
+  SetAppendCache(0, 0);
+  OpenFile("log");
+  const long long flushes = stat->flushes;
+  assert(Append(index, sizeof(line), line) == (int)sizeof(line));
+  assert(stat->flushes == flushes);
+  assert(GetInode(index)->length == (int)(expect.size() + sizeof(line)));
+  SetAppendCache(DEFAULT_APPEND_SIZE, DEFAULT_APPEND_DELAY);
+
+  // Fallocate 分配块但不改变长度，之后的写直接落在预分配的块上
+  CreateFile("pre");
+  int pre = Open("pre");
+  const int before = super->free_blocks;
+  assert(Fallocate(pre, 0, 1 << 20));
+  assert(GetInode(pre)->length == 0);
+  assert(before - super->free_blocks == 256);
+  std::string content(1 << 20, 'p');
+  assert(Write(pre, 0, content.size(), content.data()) == (int)content.size());
+  assert(before - super->free_blocks == 256);
+  assert(ExtentCount(GetInode(pre)) == 1);
+
+  // 没关闭就关文件系统，攒着的内容也要写下去
+  assert(Append(pre, 5, "hello") == 5);
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  pre = OpenFile("pre");
+  char tail[5];
+  assert(Read(pre, 1 << 20, 5, tail) == 5);
+  assert(memcmp(tail, "hello", 5) == 0);
+
+  assert(DeleteFile("pre"));
+  assert(DeleteFile("log"));
+  assert(GetSuperBlock()->free_blocks == free_blocks);
+  CloseFileSystem();
+  printf("追加测试通过\n");
+  return 0;
+}
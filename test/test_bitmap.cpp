@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 位图分配器：连续分配、大文件的块连续、删除后归还、重新打开后状态不变、能用满所有块。
+int main() {
+  need_log = false;
+  geometry geo{64 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+
+  int len = 0;
+  int start = AllocExtent(64, &len);
+  assert(start > 0 && len == 64);
+  for (int i = 0; i < len; ++i) {
+    assert(BitmapUsed(start + i));
+  }
+  for (int i = 0; i < len; ++i) {
+    ReleaseDataBlock(start + i);
+    assert(!BitmapUsed(start + i));
+  }
+
+  // 一次追加 1MB，数据块应该是连续的，整个文件只有一个区段
+  CreateFile("big");
+  int index = Open("big");
+  std::string content(1 << 20, 'x');
+  assert(Append(index, content.size(), content.data()) == (int)content.size());
+
+  inode *n = GetInode(index);
+  std::vector<int> blocks;
+  for (int i = 0; i < (int)content.size() / 4096; ++i) {
+    blocks.push_back(LookupBlock(n, i));
+  }
+  int breaks = 0;
+  for (size_t i = 1; i < blocks.size(); ++i) {
+    breaks += blocks[i] != blocks[i - 1] + 1;
+  }
+  printf("1MB 文件 %d 块，不连续 %d 处\n", (int)blocks.size(), breaks);
+  assert(breaks == 0 && ExtentCount(n) == 1);
+
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  assert(GetSuperBlock()->allocator == ALLOC_BITMAP);
+  for (int b : blocks) {
+    assert(BitmapUsed(b));
+  }
+
+  LogIn("root", "root");
+  assert(DeleteFile("big"));
+  for (int b : blocks) {
+    assert(!BitmapUsed(b));
+  }
+
+  // 能把剩下的块都分配出去
+  int used = 0;
+  for (int i = 1; i < GetSuperBlock()->block_count; ++i) {
+    used += BitmapUsed(i);
+  }
+  int count = 0;
+  for (int b = AllocExtent(1000, &len); b > 0; b = AllocExtent(1000, &len)) {
+    count += len;
+  }
+  assert(count == GetSuperBlock()->block_count - 1 - used);
+  CloseFileSystem();
+  printf("位图测试通过\n");
+  return 0;
+}
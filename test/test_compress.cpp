@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 压缩存储：压得下的内容占的块明显变少，读出来和写进去的一样；任意位置的小块读写、追加、
+// 空洞和拷贝都照常；压不下去的内容原样存储，不多占块；删光之后块全部还回，重新打开照样可读；
+// 别的用户改不了文件的存储方式，快照里的旧版本也不跟着变。
+
+// 有重复但不完全重复的文本
+static std::string text(int len, int seed) {
+  static const char *words[] = {"天地", "玄黄", "宇宙", "洪荒", "日月", "盈昃", "辰宿", "列张"};
+  std::string s;
+  unsigned int x = seed + 1;
+  while ((int)s.size() < len) {
+    x = x * 1103515245 + 12345;
+    s += words[(x >> 16) % 8];
+    if ((x >> 8) % 7 == 0) {
+      s += std::to_string(x % 1000) + "\n";
+    }
+  }
+  s.resize(len);
+  return s;
+}
+
+// 伪随机字节，压不下去
+static std::string noise(int len, int seed) {
+  std::string s(len, 0);
+  unsigned long long x = seed + 1;
+  for (int i = 0; i < len; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    s[i] = x >> 56;
+  }
+  return s;
+}
+
+static std::string read_all(int index) {
+  std::string s(GetInode(index)->length, 0);
+  assert(Read(index, 0, s.size(), s.data()) == (int)s.size());
+  return s;
+}
+
+static int write_file(const char *name, const std::string &s) {
+  assert(CreateFile(name));
+  int index = Open(name);
+  assert(GetInode(index)->flags & INODE_COMPRESSED);
+  assert(Write(index, 0, s.size(), s.data()) == (int)s.size());
+  return index;
+}
+
+static void codec() {
+  for (int len : {0, 1, 3, 4, 15, 16, 300, 4096, 65536}) {
+    const std::string data = text(len, len);
+    std::string packed(len + len / 128 + 16, 0);
+    const int size = LzCompress(data.data(), len, packed.data(), packed.size());
+    assert(size > 0);
+    std::string out(len, 0);
+    assert(LzDecompress(packed.data(), size, out.data(), len) == len);
+    assert(out == data);
+    // 截断的或放不下的都报错，不越界
+    if (len > 0) {
+      assert(LzDecompress(packed.data(), size, out.data(), len - 1) < 0);
+    }
+  }
+  const std::string data = noise(4096, 1);
+  std::string packed(4096, 0);
+  assert(LzCompress(data.data(), data.size(), packed.data(), 4000) == 0);
+}
+
+int main() {
+  need_log = false;
+  codec();
+
+  geometry geo{64 << 20, 4096, 0, 0, ALLOC_BITMAP, true};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+
+  // 1MB 文本
+  const std::string data = text(1 << 20, 0);
+  int a = write_file("a", data);
+  const int used = free_blocks - super->free_blocks;
+  printf("1MB 文本占 %d 块\n", used);
+  assert(used < 256 * 3 / 4);
+  assert(read_all(a) == data);
+
+  // 跨簇的小块读
+  char buf[100];
+  for (int pos : {0, 65536 - 50, 300001, (1 << 20) - 100}) {
+    assert(Read(a, pos, 100, buf) == 100);
+    assert(memcmp(buf, data.data() + pos, 100) == 0);
+  }
+
+  // 跨簇改写
+  std::string changed = data;
+  const std::string patch = noise(5000, 2);
+  assert(Write(a, 65536 - 2000, patch.size(), patch.data()) == (int)patch.size());
+  memcpy(changed.data() + 65536 - 2000, patch.data(), patch.size());
+  assert(read_all(a) == changed);
+
+  // 小块追加
+  for (int i = 0; i < 100; ++i) {
+    const std::string line = "第" + std::to_string(i) + "行\n";
+    assert(Append(a, line.size(), line.data()) == (int)line.size());
+    changed += line;
+  }
+  FlushAppend(a);
+  assert(read_all(a) == changed);
+
+  // 空洞读出零，按簇找数据
+  assert(CreateFile("h"));
+  int h = Open("h");
+  const int far = 10 * COMPRESS_CLUSTER * 4096 + 123;
+  assert(Write(h, far, 10000, data.data()) == 10000);
+  assert(SeekData(h, 0) == 10 * COMPRESS_CLUSTER * 4096);
+  assert(SeekData(h, far + 5000) == far + 5000);
+  assert(SeekHole(h, far) == GetInode(h)->length);
+  assert(Read(h, 4096, 100, buf) == 100);
+  assert(buf[0] == 0 && buf[99] == 0);
+  assert(Read(h, far, 100, buf) == 100 && memcmp(buf, data.data(), 100) == 0);
+
+  // 压不下去的原样存储，不多占块
+  int before = super->free_blocks;
+  const long long raw = GetCompressStat()->raw;
+  const std::string random = noise(1 << 20, 3);
+  int r = write_file("r", random);
+  assert(before - super->free_blocks == 256);
+  assert(GetCompressStat()->raw - raw == 16);
+  assert(read_all(r) == random);
+
+  // 拷贝共享块，改副本不影响原文件
+  assert(CreateDir("d"));
+  before = super->free_blocks;
+  assert(Copy("a", "d"));
+  assert(before - super->free_blocks <= 2);  // 目录内容块，每簇一段，区段树还有叶子块
+  NextDir("d");
+  int copy = Open("a");
+  assert(GetInode(copy)->flags & INODE_COMPRESSED);
+  assert(read_all(copy) == changed);
+  assert(Write(copy, 7, 5, "hello") == 5);
+  LastDir();
+  assert(read_all(a) == changed);
+  std::string copied = changed;
+  memcpy(copied.data() + 7, "hello", 5);
+
+  // 重新打开照样可读
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  assert(read_all(Open("a")) == changed);
+  assert(read_all(Open("r")) == random);
+  NextDir("d");
+  assert(read_all(Open("a")) == copied);
+  assert(DeleteFile("a"));
+  LastDir();
+
+  for (const char *name : {"a", "h", "r"}) {
+    assert(DeleteFile(name));
+  }
+  assert(DeleteDir("d"));
+  printf("剩余 %d 块，原来 %d 块\n", super->free_blocks, free_blocks);
+  assert(super->free_blocks == free_blocks);
+
+  // 只有有权限的用户能改存储方式；改之前保留快照里的版本
+  assert(CreateFile("e"));
+  const int e = Open("e");
+  assert(GetInode(e)->flags & INODE_COMPRESSED);
+  assert(UserAdd("bob", "bob", "root"));
+  assert(LogIn("bob", "bob"));
+  assert(!SetCompression(e, false));
+  assert(LogIn("root", "root"));
+  assert(GetInode(e)->flags & INODE_COMPRESSED);
+  assert(CreateSnapshot("s"));
+  assert(SetCompression(e, false));
+  assert(!(GetInode(e)->flags & INODE_COMPRESSED));
+  const int old = SnapshotInode("s", e);
+  assert(old > 0 && old != e && (GetInode(old)->flags & INODE_COMPRESSED));
+
+  const compressStat *stat = GetCompressStat();
+  printf("压缩 %lld 簇，原样 %lld 簇，%lld 字节压到 %lld 字节\n", stat->compressed, stat->raw,
+         stat->bytes_in, stat->bytes_out);
+  CloseFileSystem();
+  printf("压缩测试通过\n");
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 目录项缓存：重复查找同一个名字只查一次目录，找不到的名字也缓存；建、删、改名、链接、
+// 移动、删目录之后缓存跟着变，不会看到旧的结果；槽数固定，名字比槽多时照样找得对；
+// 回滚快照、重新打开之后清空。
+
+static const dentryStat *dstat = GetDentryStat();
+
+// 查找 name，返回 inode 编号，misses 返回查了几次目录
+static int lookup(const char *name, long long *misses) {
+  const long long before = dstat->misses;
+  const int index = Open(name);
+  *misses = dstat->misses - before;
+  return index;
+}
+
+int main() {
+  need_log = false;
+  geometry geo{64 << 20, 1024, 20000, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  assert(CreateDir("d"));
+  assert(CreateDir("sub"));
+  NextDir("d");
+  for (int i = 0; i < 100; ++i) {
+    assert(CreateFile(("f" + std::to_string(i)).c_str()));
+  }
+
+  // 建的时候已经记下，第一次打开就命中
+  long long misses = 0;
+  const long long hits = dstat->hits;
+  const int f1 = lookup("f1", &misses);
+  assert(f1 > 0 && misses == 0 && dstat->hits == hits + 1);
+
+  // 找不到的名字：第一次查目录，之后命中
+  const long long negatives = dstat->negatives;
+  assert(lookup("nope", &misses) < 0 && misses == 1);
+  assert(lookup("nope", &misses) < 0 && misses == 0 && dstat->negatives == negatives + 1);
+
+  // 建文件改掉缓存着的没有
+  const long long invalidations = dstat->invalidations;
+  assert(CreateFile("nope"));
+  assert(dstat->invalidations == invalidations + 1);
+  assert(lookup("nope", &misses) > 0 && misses == 0);
+
+  // 删除、改名、链接
+  assert(DeleteFile("nope"));
+  assert(lookup("nope", &misses) < 0 && misses == 0);
+  assert(Rename("f2", "g2"));
+  assert(lookup("f2", &misses) < 0 && misses == 0);
+  assert(lookup("g2", &misses) > 0 && misses == 0);
+  assert(Link("f3", "h3"));
+  assert(lookup("h3", &misses) == Open("f3") && misses == 0);
+
+  // 移动到 .. 下的目录：两边都改
+  LastDir();
+  NextDir("sub");
+  assert(lookup("f4", &misses) < 0);
+  LastDir();
+  NextDir("d");
+  const int f4 = Open("f4");
+  assert(Move("f4", ".."));
+  assert(lookup("f4", &misses) < 0 && misses == 0);
+  LastDir();
+  assert(lookup("f4", &misses) == f4 && misses == 0);
+  assert(Move("f4", "sub"));
+  NextDir("sub");
+  assert(lookup("f4", &misses) == f4 && misses == 0);
+  LastDir();
+
+  // 删掉目录之后它下面的项都丢掉，复用它的 inode 编号的新目录看不到旧的项
+  const int sub = Open("sub");
+  assert(DentryLookup(sub, "f4", nullptr) == f4);
+  assert(DeleteDir("sub"));
+  assert(DentryLookup(sub, "f4", nullptr) == DENTRY_MISS);
+
+  // 名字比槽多：互相顶掉，但结果总是对的
+  assert(CreateDir("big"));
+  NextDir("big");
+  const int big = 2 * DENTRY_SLOTS;
+  for (int i = 0; i < big; ++i) {
+    assert(CreateFile(("b" + std::to_string(i)).c_str()));
+  }
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < big; ++i) {
+      const std::string name = "b" + std::to_string(i);
+      const int index = Open(name.c_str());
+      assert(index > 0 && name == GetInode(index)->file_name);
+      assert(Open(("x" + std::to_string(i)).c_str()) < 0);
+    }
+  }
+  LastDir();
+
+  // 关掉之后查找不用缓存
+  use_dentry_cache = false;
+  NextDir("d");
+  const long long total = dstat->hits + dstat->negatives + dstat->misses;
+  assert(Open("f5") > 0 && Open("nope") < 0);
+  assert(dstat->hits + dstat->negatives + dstat->misses == total);
+  use_dentry_cache = true;
+  LastDir();
+
+  // 回滚快照后清空
+  assert(CreateSnapshot("s"));
+  NextDir("d");
+  assert(CreateFile("later"));
+  assert(Open("later") > 0);
+  LastDir();
+  assert(RollbackSnapshot("s"));
+  NextDir("d");
+  assert(lookup("later", &misses) < 0 && misses == 1);
+  assert(lookup("f6", &misses) > 0 && misses == 1);
+  LastDir();
+
+  // 重新打开后清空
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  NextDir("d");
+  assert(lookup("f7", &misses) > 0 && misses == 1);
+  assert(lookup("f7", &misses) > 0 && misses == 0);
+  LastDir();
+
+  printf("命中%lld次，命中没有%lld次，没命中%lld次，失效%lld次\n", dstat->hits, dstat->negatives,
+         dstat->misses, dstat->invalidations);
+  CloseFileSystem();
+  printf("目录项缓存测试通过\n");
+  return 0;
+}
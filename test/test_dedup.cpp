@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 去重：打开 dedup_blocks 后写和已有块内容相同的整块不占新块，改其中一份不影响另一份，
+// 删光之后块全部还回；关掉时写的重复内容可以用离线去重收回；索引在镜像里，重新打开后还能用。
+
+// 伪随机内容，各块互不相同
+static std::string content(int len, int seed) {
+  std::string s(len, 0);
+  unsigned long long x = seed + 1;
+  for (int i = 0; i < len; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    s[i] = 'a' + (x >> 33) % 26;
+  }
+  return s;
+}
+
+static std::string read_all(int index) {
+  std::string s(GetInode(index)->length, 0);
+  assert(Read(index, 0, s.size(), s.data()) == (int)s.size());
+  return s;
+}
+
+static int write_file(const char *name, const std::string &s) {
+  CreateFile(name);
+  int index = Open(name);
+  assert(Write(index, 0, s.size(), s.data()) == (int)s.size());
+  return index;
+}
+
+int main() {
+  need_log = false;
+  geometry geo{128 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  superBlock *super = GetSuperBlock();
+
+  // 建好索引
+  dedup_blocks = true;
+  write_file("warm", content(4096, 100));
+  assert(DeleteFile("warm"));
+  assert(super->dedup_id > 0);
+  const int free_blocks = super->free_blocks;
+
+  // 第二份不占块，改一块只多一块，另一份不变
+  const std::string data = content(1 << 20, 0);
+  int a = write_file("a", data);
+  assert(free_blocks - super->free_blocks == 256);
+  int b = write_file("b", data);
+  printf("写第二份用了%d块\n", free_blocks - super->free_blocks - 256);
+  assert(free_blocks - super->free_blocks == 256);
+  assert(read_all(b) == data);
+  assert(LookupBlock(GetInode(a), 3) == LookupBlock(GetInode(b), 3));
+
+  assert(Write(b, 3 * 4096 + 5, 5, "hello") == 5);
+  assert(free_blocks - super->free_blocks == 257);
+  std::string changed = data;
+  memcpy(changed.data() + 3 * 4096 + 5, "hello", 5);
+  assert(read_all(b) == changed);
+  assert(read_all(a) == data);
+
+  // 文件内部的重复块也共享
+  const std::string block = content(4096, 5);
+  int c = write_file("c", block + block + block);
+  assert(free_blocks - super->free_blocks == 258);
+  assert(DataBlockRefs(LookupBlock(GetInode(c), 0)) == 3);
+
+  assert(DeleteFile("a"));
+  assert(read_all(b) == changed);
+  assert(DeleteFile("b"));
+  assert(DeleteFile("c"));
+  assert(super->free_blocks == free_blocks);
+
+  // 关掉去重写三份，离线去重收回两份
+  dedup_blocks = false;
+  write_file("p", data);
+  write_file("q", data);
+  write_file("r", data);
+  assert(free_blocks - super->free_blocks == 3 * 256);
+  const int saved = DedupAll();
+  printf("离线去重省下%d块\n", saved);
+  assert(saved == 2 * 256);
+  assert(free_blocks - super->free_blocks == 256);
+  assert(read_all(Open("q")) == data);
+
+  // 重新打开，索引还在，写时去重照样命中
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  dedup_blocks = true;
+  int s = write_file("s", data);
+  assert(free_blocks - super->free_blocks == 256);
+  assert(read_all(s) == data);
+
+  // 原地改在索引里的块也要复制，其他文件看不到
+  assert(Write(Open("p"), 0, 5, "world") == 5);
+  assert(read_all(s) == data && read_all(Open("r")) == data);
+  for (const char *name : {"p", "q", "r", "s"}) {
+    assert(DeleteFile(name));
+  }
+  assert(super->free_blocks == free_blocks);
+  dedup_blocks = false;
+
+  CloseFileSystem();
+  printf("去重测试通过\n");
+  return 0;
+}
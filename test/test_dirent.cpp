@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 带名字的目录项：名字、类型、散列都在目录块里，一项不跨块；硬链接是指向同一个 inode 的
+// 另一个目录项，各有各的名字，删掉一个名字另一个照样能用；改名、移动、拷贝之后名字以目录项为准；
+// 老的目录项格式照常读写；快照看到的是当时目录项里的名字；删光之后块和 inode 全部还回。
+
+static std::string read_all(int index) {
+  std::string s(GetInode(index)->length, 0);
+  assert(Read(index, 0, s.size(), s.data()) == (int)s.size());
+  return s;
+}
+
+// 当前目录里的名字，按目录项的顺序，跳过删掉的
+static std::string names() {
+  std::string s;
+  const int len = DirEntries(current_dir_index);
+  for (int i = 0; i < len; ++i) {
+    namedEntry e;
+    assert(ReadDirEntries(current_dir_index, i, 1, &e) == 1);
+    if (e.file_id > 0) {
+      assert(e.name_len == strlen(e.name) && e.hash == NameHash(e.name));
+      s += std::string(e.name) + " ";
+    }
+  }
+  return s;
+}
+
+int main() {
+  need_log = false;
+  geometry geo{16 << 20, 1024, 4096, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  const int free_inodes = super->free_inodes;
+  assert(GetInode(super->root_dir_id)->flags & INODE_DIR_NAMES);
+
+  // 一块放 1024 / 44 项，一项不跨块，多读一次也能整块读出来
+  assert(CreateDir("d"));
+  NextDir("d");
+  const int d = current_dir_index;
+  const int per = 1024 / sizeof(namedEntry);
+  for (int i = 0; i < 3 * per; ++i) {
+    assert(CreateFile(("f" + std::to_string(i)).c_str()));
+  }
+  assert(DirEntries(d) == 3 * per);
+  assert(GetInode(d)->length == 2 * 1024 + per * (int)sizeof(namedEntry));
+  namedEntry batch[DIR_BATCH];
+  assert(ReadDirEntries(d, per - 1, 2, batch) == 2);
+  assert(strcmp(batch[0].name, ("f" + std::to_string(per - 1)).c_str()) == 0);
+  assert(strcmp(batch[1].name, ("f" + std::to_string(per)).c_str()) == 0);
+  assert(batch[1].type == FILE_TYPE && batch[1].file_id == Open(batch[1].name));
+  assert(ReadDirEntries(d, 3 * per - 1, DIR_BATCH, batch) == 1);
+
+  // 硬链接：同一个 inode，不同的名字，不占 inode
+  int a = Open("f0");
+  assert(Write(a, 0, 5, "hello") == 5);
+  const int inodes = super->free_inodes;
+  assert(Link("f0", "link"));
+  assert(!Link("f0", "f1"));
+  assert(super->free_inodes == inodes);
+  assert(Open("link") == a && GetInode(a)->link_cnt == 2);
+  assert(DeleteFile("f0"));
+  assert(Open("f0") < 0 && Open("link") == a && GetInode(a)->link_cnt == 1);
+  assert(read_all(a) == "hello");
+
+  // 改名只改这个目录项
+  assert(Link("link", "other"));
+  assert(Rename("link", "renamed"));
+  assert(Open("link") < 0 && Open("renamed") == a && Open("other") == a);
+
+  // 移动和拷贝用目录项里的名字
+  assert(CreateDir("sub"));
+  assert(Move("other", "sub"));
+  assert(Copy("renamed", "sub"));
+  NextDir("sub");
+  assert(names() == "other renamed ");
+  assert(Open("other") == a && Open("renamed") != a);
+  assert(read_all(Open("renamed")) == "hello");
+  LastDir();
+
+  // 老的目录项：名字在 inode 里，链接要占一个 inode
+  use_dir_names = false;
+  assert(CreateDir("old"));
+  use_dir_names = true;
+  NextDir("old");
+  assert(!(GetInode(current_dir_index)->flags & INODE_DIR_NAMES));
+  for (int i = 0; i < 40; ++i) {
+    assert(CreateFile(("o" + std::to_string(i)).c_str()));
+  }
+  assert(DirEntries(current_dir_index) == 40);
+  assert(GetInode(current_dir_index)->length == 40 * (int)sizeof(dirEntry));
+  assert(Link("o1", "ol"));
+  assert(GetInode(Open("ol"))->type == LINK_TYPE);
+  assert(Rename("o2", "p2"));
+  assert(Open("o2") < 0 && Open("p2") > 0);
+  assert(DeleteFile("o3"));
+  LastDir();
+  // 从带名字的目录移进老目录，名字记到 inode 里
+  assert(Move("renamed", "old"));
+  NextDir("old");
+  assert(Open("renamed") == a && strcmp(GetInode(a)->file_name, "renamed") == 0);
+  LastDir();
+  LastDir();
+
+  // 重新打开
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  NextDir("d");
+  assert(Open("f1") > 0 && Open("f0") < 0);
+  NextDir("sub");
+  assert(Open("other") == a);
+  LastDir();
+  NextDir("old");
+  assert(Open("o1") > 0 && Open("ol") > 0 && Open("renamed") == a);
+  LastDir();
+  LastDir();
+
+  // 删光之后块和 inode 全部还回
+  assert(DeleteDir("d"));
+  printf("剩余%d块%d个inode，原来%d块%d个inode\n", super->free_blocks, super->free_inodes,
+         free_blocks, free_inodes);
+  assert(super->free_blocks == free_blocks && super->free_inodes == free_inodes);
+
+  // 快照里是当时的名字
+  assert(CreateDir("s"));
+  NextDir("s");
+  assert(CreateFile("f1"));
+  assert(Link("f1", "g1"));
+  LastDir();
+  assert(CreateSnapshot("snap"));
+  NextDir("s");
+  assert(Rename("f1", "changed"));
+  LastDir();
+  assert(SnapshotLookup("snap", "s/f1") > 0 && SnapshotLookup("snap", "s/changed") < 0);
+  assert(SnapshotLookup("snap", "s/g1") == SnapshotLookup("snap", "s/f1"));
+  assert(RollbackSnapshot("snap"));
+  NextDir("s");
+  assert(Open("f1") > 0 && Open("g1") == Open("f1") && Open("changed") < 0);
+  LastDir();
+  CloseFileSystem();
+  printf("目录项测试通过\n");
+  return 0;
+}
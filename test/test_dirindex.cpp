@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 目录散列索引：目录项多了之后自动建索引，增删改名、移动、链接之后索引和目录项一致；
+// 重新打开、快照回滚之后照样能用；小块时桶会分裂、根会加倍；老的索引方式的目录按顺序找。
+
+// 当前目录下 [0, n) 号文件，alive 为假的应该找不到
+static void check(const std::string &prefix, int n, bool (*alive)(int)) {
+  for (int i = 0; i < n; ++i) {
+    const std::string name = prefix + std::to_string(i);
+    const int index = Open(name.c_str());
+    if (alive(i)) {
+      assert(index > 0);
+      assert(name == GetInode(index)->file_name);
+    } else {
+      assert(index < 0);
+    }
+  }
+}
+
+static bool all(int) { return true; }
+static bool odd(int i) { return i % 2 == 1; }
+
+int main() {
+  need_log = false;
+  geometry geo{64 << 20, 1024, 20000, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+
+  constexpr int N = 5000;
+  assert(CreateDir("d"));
+  NextDir("d");
+  const int d = current_dir_index;
+  for (int i = 0; i < N; ++i) {
+    assert(CreateFile(("f" + std::to_string(i)).c_str()));
+  }
+  assert(GetInode(d)->flags & INODE_DIR_INDEX);
+  const dirIndexStat *stat = GetDirIndexStat();
+  printf("建索引%lld次，分裂%lld次\n", stat->builds, stat->splits);
+  assert(stat->builds == 1 && stat->splits > 0 && stat->drops == 0);
+  check("f", N, all);
+  assert(Open("nothing") < 0);
+
+  // 查找只用索引
+  const long long lookups = stat->lookups;
+  assert(Open("f1234") > 0);
+  assert(stat->lookups == lookups + 1 && stat->hits > 0);
+
+  // 删掉一半，改名，重名的不能建
+  for (int i = 0; i < N; i += 2) {
+    assert(DeleteFile(("f" + std::to_string(i)).c_str()));
+  }
+  check("f", N, odd);
+  assert(CreateFile("f0"));
+  assert(!CreateFile("f1"));
+  assert(Rename("f1", "g1"));
+  assert(Open("f1") < 0 && Open("g1") > 0);
+  assert(!Rename("f3", "g1"));
+  assert(Link("f3", "h3"));
+  assert(Open("h3") == Open("f3"));  // 硬链接是指向同一个 inode 的另一个目录项
+
+  // 移动和拷贝到上一级，两边的索引都要更新
+  assert(Move("f5", ".."));
+  assert(Copy("f7", ".."));
+  assert(Open("f5") < 0 && Open("f7") > 0);
+  LastDir();
+  assert(Open("f5") > 0 && Open("f7") > 0);
+
+  // 重新打开
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  NextDir("d");
+  assert(current_dir_index == d && (GetInode(d)->flags & INODE_DIR_INDEX));
+  assert(Open("f0") > 0 && Open("g1") > 0 && Open("h3") > 0 && Open("f2") < 0);
+  for (int i = 9; i < N; i += 2) {
+    assert(Open(("f" + std::to_string(i)).c_str()) > 0);
+  }
+
+  LastDir();
+
+  // 老的索引方式的目录没有索引，照样能找
+  use_extents = false;
+  assert(CreateDir("old"));
+  use_extents = true;
+  NextDir("old");
+  for (int i = 0; i < 100; ++i) {
+    assert(CreateFile(("o" + std::to_string(i)).c_str()));
+  }
+  assert(!(GetInode(current_dir_index)->flags & INODE_DIR_INDEX));
+  check("o", 100, all);
+  LastDir();
+
+  // 删光之后块全部还回，包括索引块
+  assert(DeleteDir("old"));
+  assert(DeleteDir("d"));
+  assert(DeleteFile("f5"));
+  assert(DeleteFile("f7"));
+  assert(super->free_blocks == free_blocks);
+
+  // 快照之后改动目录，回滚后索引回到快照时的样子
+  assert(CreateDir("s"));
+  NextDir("s");
+  for (int i = 0; i < 100; ++i) {
+    assert(CreateFile(("f" + std::to_string(i)).c_str()));
+  }
+  assert(GetInode(current_dir_index)->flags & INODE_DIR_INDEX);
+  assert(CreateSnapshot("s"));
+  assert(DeleteFile("f9"));
+  assert(Rename("f11", "x11"));
+  assert(CreateFile("new"));
+  assert(RollbackSnapshot("s"));
+  NextDir("s");
+  assert(Open("f9") > 0 && Open("f11") > 0 && Open("x11") < 0 && Open("new") < 0);
+  check("f", 100, all);
+  assert(CreateFile("new"));
+  assert(Open("new") > 0);
+
+  CloseFileSystem();
+  printf("目录索引测试通过\n");
+  return 0;
+}
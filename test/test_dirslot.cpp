@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 目录空位：新的目录项先放进删掉的项留下的空位，目录不变长；删掉的项多了压缩目录，
+// 还回后面的块和散列索引，搬动过的项按索引、目录项缓存和按顺序找都找得到；老的目录项格式一样；
+// 重新打开后重新扫出空位；快照里还是压缩前的目录。
+
+static const dirSlotStat *sstat = GetDirSlotStat();
+
+static std::string name(int i) { return "f" + std::to_string(i); }
+
+// 目录 dir 里的每一项都能按名字找到，位置和目录项一致，返回有效的项数
+static int check_dir(int dir) {
+  int live = 0;
+  const int len = DirEntries(dir);
+  for (int i = 0; i < len; ++i) {
+    namedEntry e;
+    assert(ReadDirEntries(dir, i, 1, &e) == 1);
+    if (e.file_id <= 0) {
+      continue;
+    }
+    ++live;
+    for (int round = 0; round < 2; ++round) {
+      int pos = -1;
+      assert(Open(e.name, &pos) == e.file_id && pos == i);
+      ResetDentryCache();  // 第二遍不经过缓存
+    }
+  }
+  return live;
+}
+
+int main() {
+  need_log = false;
+  geometry geo{16 << 20, 1024, 4096, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+  assert(CreateDir("d"));
+  const int free_blocks = super->free_blocks;
+  NextDir("d");
+  const int d = current_dir_index;
+  const int per = 1024 / sizeof(namedEntry);
+  const int n = 4 * per;
+  for (int i = 0; i < n; ++i) {
+    assert(CreateFile(name(i).c_str()));
+  }
+  const int length = GetInode(d)->length;
+
+  // 删一个再建一个，放进原来的位置，目录不变长
+  int pos = -1;
+  assert(Open(name(5).c_str(), &pos) > 0 && pos == 5);
+  assert(DeleteFile(name(5).c_str()));
+  const long long reused = sstat->reused;
+  assert(CreateFile("new5"));
+  assert(Open("new5", &pos) > 0 && pos == 5);
+  assert(sstat->reused == reused + 1 && GetInode(d)->length == length);
+
+  // 最前面的空位先用
+  assert(DeleteFile(name(30).c_str()));
+  assert(DeleteFile(name(10).c_str()));
+  assert(CreateFile("new10"));
+  assert(Open("new10", &pos) > 0 && pos == 10);
+  assert(CreateFile("new30"));
+  assert(Open("new30", &pos) > 0 && pos == 30);
+  assert(DirEntries(d) == n && check_dir(d) == n);
+
+  // 重新打开后重新扫出空位
+  assert(DeleteFile(name(7).c_str()));
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  NextDir("/d");
+  assert(CreateFile("new7"));
+  assert(Open("new7", &pos) > 0 && pos == 7);
+
+  // 删掉前面的大半，够多时压缩：末尾的项搬到前面，还回后面的块
+  const long long compactions = sstat->compactions;
+  for (int i = 0; i < 3 * per; ++i) {
+    if (i != 5 && i != 7 && i != 10 && i != 30) {
+      assert(DeleteFile(name(i).c_str()));
+    }
+  }
+  assert(sstat->compactions > compactions && sstat->moved > 0);
+  const int live = n - 3 * per + 4;
+  assert(check_dir(d) == live);
+  assert(DirEntries(d) < n && GetInode(d)->length < length);
+  printf("剩%d项，目录%d项%d字节，原来%d项%d字节\n", live, DirEntries(d), GetInode(d)->length, n,
+         length);
+  assert(Open("new5") > 0 && Open(name(n - 1).c_str()) > 0 && Open(name(0).c_str()) < 0);
+
+  // 压缩后新建的还是先用空位，再追加
+  for (int i = 0; i < per; ++i) {
+    assert(CreateFile(("g" + std::to_string(i)).c_str()));
+  }
+  assert(check_dir(d) == live + per);
+
+  // 删光之后只剩不够压缩的几个空位，散列索引也去掉了，最多占一块
+  for (int i = 0; i < DirEntries(d); ++i) {
+    namedEntry e;
+    assert(ReadDirEntries(d, i, 1, &e) == 1);
+    if (e.file_id > 0) {
+      assert(DeleteFile(e.name));
+      i = -1;  // 压缩时项会搬动，从头再找
+    }
+  }
+  assert(DirEntries(d) < DIR_COMPACT_MIN && GetInode(d)->length <= 1024);
+  assert(!(GetInode(d)->flags & INODE_DIR_INDEX));
+  printf("压缩%lld次，搬动%lld项，还回%lld块，空位复用%lld次\n", sstat->compactions,
+         sstat->moved, sstat->freed_blocks, sstat->reused);
+  LastDir();
+  assert(super->free_blocks == free_blocks - 1);
+
+  // 老的目录项：一样复用，删的再多也不会到块数上限
+  use_dir_names = false;
+  assert(CreateDir("old"));
+  use_dir_names = true;
+  NextDir("old");
+  const int old = current_dir_index;
+  for (int i = 0; i < 100; ++i) {
+    assert(CreateFile(name(i).c_str()));
+  }
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < 100; i += 2) {
+      assert(DeleteFile(name(i).c_str()));
+    }
+    for (int i = 0; i < 100; i += 2) {
+      assert(CreateFile(name(i).c_str()));
+    }
+  }
+  assert(DirEntries(old) == 100 && check_dir(old) == 100);
+  for (int i = 0; i < 80; ++i) {
+    assert(DeleteFile(name(i).c_str()));
+  }
+  assert(DirEntries(old) < 100 && check_dir(old) == 20);
+  LastDir();
+
+  // 关掉时追加，不压缩
+  use_dir_slots = false;
+  NextDir("old");
+  const int entries = DirEntries(old);
+  assert(DeleteFile(name(80).c_str()));
+  assert(CreateFile("x"));
+  assert(DirEntries(old) == entries + 1);
+  use_dir_slots = true;
+  LastDir();
+
+  assert(DeleteDir("old") && DeleteDir("d"));
+
+  // 快照里是压缩前的目录，回滚后原样回来
+  assert(CreateDir("s"));
+  for (int i = 0; i < n; ++i) {
+    assert(CreateFile(("s/" + name(i)).c_str()));
+  }
+  assert(CreateSnapshot("before"));
+  for (int i = 0; i < n - 1; ++i) {
+    assert(DeleteFile(("/s/" + name(i)).c_str()));
+  }
+  NextDir("s");
+  assert(DirEntries(current_dir_index) < n && check_dir(current_dir_index) == 1);
+  LastDir();
+  assert(SnapshotLookup("before", "s/f0") > 0 && SnapshotLookup("before", "s/f1") > 0);
+  assert(RollbackSnapshot("before"));
+  NextDir("s");
+  assert(DirEntries(current_dir_index) == n && check_dir(current_dir_index) == n);
+  LastDir();
+  CloseFileSystem();
+  printf("目录空位测试通过\n");
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 区段树：大文件超过老的二级索引上限、交错写出很多区段让树长高、打洞后树变矮、删除后块全部还回、
+// 关掉 use_extents 时仍按老的索引方式工作。
+static void fill(std::vector<char> &buf, int seed) {
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = 'a' + (i / 4096 + seed) % 26;
+  }
+}
+
+// 写一个 320MB 的文件，比二级索引的 4MB 上限大得多。
+static void check_big() {
+  const superBlock *super = GetSuperBlock();
+  CreateFile("big");
+  const int free_blocks = super->free_blocks;  // 根目录的内容块已经分配
+  int index = Open("big");
+  std::vector<char> buf(16 << 20);
+  for (int i = 0; i < 20; ++i) {
+    fill(buf, i);
+    assert(Append(index, buf.size(), buf.data()) == (int)buf.size());
+  }
+  inode *n = GetInode(index);
+  assert(n->length == 20 * (16 << 20));
+  printf("320MB 文件 %d 个区段，深度 %d\n", ExtentCount(n), ExtentDepth(n));
+
+  std::vector<char> expect(buf.size());
+  for (int i = 0; i < 20; ++i) {
+    fill(expect, i);
+    assert(Read(index, i * (int)buf.size(), buf.size(), buf.data()) == (int)buf.size());
+    assert(buf == expect);
+  }
+  assert(DeleteFile("big"));
+  assert(super->free_blocks == free_blocks);
+}
+
+// 两个文件交替逐块追加，区段不能合并，树要分裂长高。关掉追加缓存，每次追加都直接分配。
+static void check_deep() {
+  SetAppendCache(0, 0);
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  CreateFile("x");
+  CreateFile("y");
+  int x = Open("x");
+  int y = Open("y");
+  constexpr int blocks = 3000;
+  std::vector<char> buf(4096);
+  for (int i = 0; i < blocks; ++i) {
+    fill(buf, i);
+    assert(Append(x, buf.size(), buf.data()) == (int)buf.size());
+    assert(Append(y, buf.size(), buf.data()) == (int)buf.size());
+  }
+  inode *n = GetInode(x);
+  printf("交错写 %d 块：%d 个区段，深度 %d\n", blocks, ExtentCount(n), ExtentDepth(n));
+  assert(ExtentCount(n) == blocks && ExtentDepth(n) >= 2);
+
+  // 覆盖写中间的块，映射不变
+  fill(buf, 7);
+  assert(Write(x, 1234 * 4096, buf.size(), buf.data()) == (int)buf.size());
+  assert(ExtentCount(n) == blocks);
+
+  std::vector<char> expect(4096);
+  for (int i = 0; i < blocks; ++i) {
+    fill(expect, i == 1234 ? 7 : i);
+    assert(Read(x, i * 4096, buf.size(), buf.data()) == (int)buf.size());
+    assert(buf == expect);
+  }
+
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  x = Open("x");
+  fill(expect, blocks - 1);
+  assert(Read(x, (blocks - 1) * 4096, buf.size(), buf.data()) == (int)buf.size());
+  assert(buf == expect);
+
+  assert(DeleteFile("x"));
+  assert(DeleteFile("y"));
+  assert(GetSuperBlock()->free_blocks == free_blocks);
+  SetAppendCache(DEFAULT_APPEND_SIZE, DEFAULT_APPEND_DELAY);
+}
+
+// 交错写出一棵深的树，中间打一个大洞再全部去掉：空了的节点还回去，树变矮，块全部还回。
+static void check_shrink() {
+  SetAppendCache(0, 0);
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  CreateFile("x");
+  CreateFile("y");
+  int x = Open("x");
+  int y = Open("y");
+  constexpr int blocks = 3000;
+  std::vector<char> buf(4096);
+  for (int i = 0; i < blocks; ++i) {
+    fill(buf, i);
+    assert(Append(x, buf.size(), buf.data()) == (int)buf.size());
+    assert(Append(y, buf.size(), buf.data()) == (int)buf.size());
+  }
+  inode *n = GetInode(x);
+  const int depth = ExtentDepth(n);
+  assert(depth >= 2);
+
+  // 中间打洞，两头还在
+  const int used = free_blocks - super->free_blocks;
+  assert(ExtentUnmap(n, 10, blocks - 20));
+  printf("打洞后 %d 个区段，深度 %d -> %d，还回 %d 块\n", ExtentCount(n), depth,
+         ExtentDepth(n), super->free_blocks - (free_blocks - used));
+  assert(ExtentCount(n) == 20 && ExtentDepth(n) < depth);
+  std::vector<char> expect(4096);
+  for (int i : {0, 9, blocks - 10, blocks - 1}) {
+    fill(expect, i);
+    assert(Read(x, i * 4096, buf.size(), buf.data()) == (int)buf.size());
+    assert(buf == expect);
+  }
+
+  // 全部去掉：树只剩空的根，x 占的块都还回去了
+  const int free_y = super->free_blocks;
+  assert(ExtentUnmap(GetInode(y), 0, blocks));
+  assert(ExtentUnmap(n, 0, blocks));
+  assert(ExtentCount(n) == 0 && ExtentDepth(n) == 0 && ExtentDepth(GetInode(y)) == 0);
+  assert(super->free_blocks > free_y);
+  assert(DeleteFile("x"));
+  assert(DeleteFile("y"));
+  assert(super->free_blocks == free_blocks);
+  SetAppendCache(DEFAULT_APPEND_SIZE, DEFAULT_APPEND_DELAY);
+}
+
+// 不用区段树时，文件大小仍受二级索引限制。
+static void check_legacy() {
+  use_extents = false;
+  CreateFile("old");
+  use_extents = true;
+  int index = Open("old");
+  assert((GetInode(index)->flags & INODE_EXTENTS) == 0);
+  std::vector<char> buf(MaxFileSize() + 4096);
+  fill(buf, 0);
+  assert(Append(index, buf.size(), buf.data()) == MaxFileSize());
+  std::vector<char> out(MaxFileSize());
+  assert(Read(index, 0, out.size(), out.data()) == (int)out.size());
+  assert(std::equal(out.begin(), out.end(), buf.begin()));
+  assert(DeleteFile("old"));
+}
+
+int main() {
+  need_log = false;
+  geometry geo{1LL << 30, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  check_big();
+  check_deep();
+  check_shrink();
+  check_legacy();
+  CloseFileSystem();
+  printf("区段测试通过\n");
+  return 0;
+}
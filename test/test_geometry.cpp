@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <cassert>
+#include <vector>
+#include "head.h"
+
+// 按给定几何格式化，写满一个最大文件，重新打开后几何信息和内容都要保持不变。
+static void check(const geometry &geo) {
+  assert(FormatFileSystem(root_path, &geo));
+  const superBlock *super = GetSuperBlock();
+  assert(super->block_size == geo.block_size);
+  assert(super->disk_size == geo.disk_size);
+  printf("块大小%d 块数%d inode数%d 最大文件%d字节\n", super->block_size, super->block_count,
+         super->inode_count, MaxFileSize());
+
+  LogIn("root", "root");
+  CreateFile("a");
+  std::vector<char> buf(MaxFileSize());
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = 'a' + i % 26;
+  }
+  assert(Append(Open("a"), buf.size(), buf.data()) == (int)buf.size());
+  CloseFileSystem();
+
+  assert(OpenFileSystem(root_path));
+  assert(GetSuperBlock()->block_size == geo.block_size);
+  LogIn("root", "root");
+  std::vector<char> out(buf.size());
+  assert(Read(Open("a"), 0, out.size(), out.data()) == (int)out.size());
+  assert(out == buf);
+  CloseFileSystem();
+}
+
+// 格式化时不构造成组链接，空闲块从尾部逐组取出；分配完、全部释放后应该能再分配同样多块。
+static void check_alloc() {
+  geometry geo{8 << 20, 1024, 0, 0};
+  assert(FormatFileSystem(root_path, &geo));
+  std::vector<int> blocks;
+  for (int b = AllocDataBlock(); b > 0; b = AllocDataBlock()) {
+    blocks.push_back(b);
+  }
+  // 只有用户表的内容占了一块，根目录还是空的
+  assert((int)blocks.size() == GetSuperBlock()->block_count - 1 - 1);
+  for (int b : blocks) {
+    ReleaseDataBlock(b);
+  }
+  int count = 0;
+  while (AllocDataBlock() > 0) {
+    ++count;
+  }
+  assert(count == (int)blocks.size());
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+
+  // 16GB 的稀疏镜像，实际只占用写过的块。
+  check(geometry{16LL << 30, 4096, 0, 0});
+  struct stat s;
+  assert(stat(root_path, &s) == 0 && s.st_size == 16LL << 30);
+  printf("镜像占用%lldMB\n", (long long)s.st_blocks * 512 >> 20);
+
+  check(geometry{8 << 20, 1024, 2048, 16});
+  check_alloc();
+
+  // 非法的块大小不能格式化
+  geometry bad_block{8 << 20, 3000, 0, 0};
+  geometry bad_journal{1 << 20, 4096, 0, 1024};
+  assert(FormatFileSystem(root_path, &bad_block) == false);
+  assert(FormatFileSystem(root_path, &bad_journal) == false);
+  printf("几何测试通过\n");
+  return 0;
+}
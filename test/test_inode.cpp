@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// inode 单独分配：空文件、目录不占数据块，写入内容才分配，链接连 inode 也不占；
+// 删除后 inode 和块都要还回去。
+int main() {
+  need_log = false;
+  SetAppendCache(0, 0);  // 按块计数，不要预分配
+  geometry geo{8 << 20, 1024, 20000, 0};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+  assert(super->inode_count == 20000);
+
+  CreateFile("x");  // 先让根目录有内容块
+  const int free_inodes = super->free_inodes;
+  const int free_blocks = super->free_blocks;
+
+  CreateFile("a");
+  CreateDir("d");
+  Link("a", "b");
+  assert(super->free_inodes == free_inodes - 2);
+  assert(super->free_blocks == free_blocks);
+
+  int a = Open("a");
+  assert(LookupBlock(GetInode(a), 0) == 0);
+  assert(Append(a, 5, "hello") == 5);
+  assert(LookupBlock(GetInode(a), 0) > 0);
+  assert(super->free_blocks == free_blocks - 1);
+
+  // 先后创建的文件 inode 编号相邻，链接和源文件是同一个 inode
+  assert(Open("d") == a + 1);
+  assert(Open("b") == a);
+
+  assert(DeleteFile("b"));
+  assert(DeleteFile("a"));
+  assert(DeleteDir("d"));
+  assert(super->free_inodes == free_inodes);
+  assert(super->free_blocks == free_blocks);
+
+  // inode 比块多得多，空文件数不受块数限制
+  int files = 0;
+  for (int d = 0; d < 10; ++d) {
+    std::string dir = "dir" + std::to_string(d);
+    assert(CreateDir(dir.c_str()));
+    NextDir(dir.c_str());
+    for (int i = 0; i < 1000 && CreateFile(std::to_string(i).c_str()); ++i) {
+      ++files;
+    }
+    LastDir();
+  }
+  printf("块数%d，建了%d个空文件\n", super->block_count, files);
+  assert(files > super->block_count);
+
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  assert(GetSuperBlock()->free_inodes == free_inodes - files - 10);
+  CloseFileSystem();
+  printf("inode测试通过\n");
+  return 0;
+}
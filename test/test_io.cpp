@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 三种写回后端写出来的镜像内容要一样：写大文件(缓冲池放不下，淘汰时异步写回)、
+// 反复改同一块(同一位置的写不能乱序)，关闭后重新打开校验。相邻块的写要合并。
+static void check(io_backend_type type) {
+  io_backend = type;
+  geometry geo{256 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  printf("后端 %s\n", IoBackendName());
+  LogIn("root", "root");
+  SetBufferSize(64);
+
+  CreateFile("big");
+  int index = Open("big");
+  std::vector<char> buf(32 << 20);
+  for (size_t i = 0; i < buf.size(); ++i) {
+    buf[i] = 'a' + (i / 4096 + i) % 26;
+  }
+  assert(Write(index, 0, buf.size(), buf.data()) == (int)buf.size());
+
+  // 同一块改很多次，中间穿插淘汰
+  CreateFile("hot");
+  int hot = Open("hot");
+  for (int i = 0; i < 1000; ++i) {
+    std::string s = std::to_string(i);
+    s.resize(16, ' ');
+    assert(Write(hot, 0, s.size(), s.data()) == (int)s.size());
+    assert(Write(index, (i * 7919 % 8192) * 4096, 4096, buf.data()) == 4096);
+    memcpy(buf.data() + (i * 7919 % 8192) * 4096, buf.data(), 4096);
+  }
+  SetBufferSize(DEFAULT_BUFFER_SIZE);
+  CloseFileSystem();
+
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  std::vector<char> out(buf.size());
+  assert(Read(Open("big"), 0, out.size(), out.data()) == (int)out.size());
+  assert(out == buf);
+  char s[16];
+  assert(Read(Open("hot"), 0, 16, s) == 16);
+  assert(std::string(s, 16) == "999             ");
+  CloseFileSystem();
+}
+
+// 顺序写的相邻块合并成大的向量写；一页上的多个 inode 一起写回，重新打开后都在。
+static void check_coalesce() {
+  io_backend = IO_BACKEND_AUTO;
+  geometry geo{256 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("seq");
+  std::vector<char> buf(16 << 20, 's');
+  const ioStat before = *GetIoStat();
+  assert(Write(Open("seq"), 0, buf.size(), buf.data()) == (int)buf.size());
+  FlushBuffer();
+  const ioStat *stat = GetIoStat();
+  long long requests = stat->requests - before.requests;
+  long long writes = stat->writes - before.writes;
+  printf("顺序写 %lld 次合并成 %lld 次\n", requests, writes);
+  assert(writes * 16 < requests);
+
+  for (int i = 0; i < 40; ++i) {
+    CreateFile(("f" + std::to_string(i)).c_str());
+  }
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  for (int i = 0; i < 40; ++i) {
+    assert(Open(("f" + std::to_string(i)).c_str()) > 0);
+  }
+  CloseFileSystem();
+}
+
+// 当前进程的常驻内存，字节
+static long long rss() {
+  long long size = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  assert(f != nullptr && fscanf(f, "%lld %lld", &size, &resident) == 2);
+  fclose(f);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 私有映射上写过的页写回落盘后丢掉，写得再多常驻内存也不跟着涨；丢掉后读回来的内容不变。
+static void check_rss() {
+  io_backend = IO_BACKEND_AUTO;
+  geometry geo{512 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("huge");
+  const int index = Open("huge");
+  std::vector<char> buf(1 << 20);
+  const long long before = rss();
+  const long long dropped = GetBufferStat()->bytes_dropped;
+  const int chunks = 256;
+  for (int i = 0; i < chunks; ++i) {
+    memset(buf.data(), 'A' + i % 26, buf.size());
+    assert(Write(index, (long long)i * buf.size(), buf.size(), buf.data()) == (int)buf.size());
+  }
+  const long long grown = rss() - before;
+  printf("写%dMB，常驻内存涨了%lldMB，丢掉%lldMB\n", chunks, grown >> 20,
+         (GetBufferStat()->bytes_dropped - dropped) >> 20);
+  assert(grown < (64 << 20) && GetBufferStat()->bytes_dropped > dropped);
+  for (int i = 0; i < chunks; i += 37) {
+    assert(Read(index, (long long)i * buf.size(), buf.size(), buf.data()) == (int)buf.size());
+    assert(buf[0] == 'A' + i % 26 && buf[buf.size() - 1] == 'A' + i % 26);
+  }
+  CloseFileSystem();
+}
+
+int main() {
+  need_log = false;
+  check_rss();
+  check_coalesce();
+  check(IO_BACKEND_SYNC);
+  check(IO_BACKEND_THREADS);
+  check(IO_BACKEND_URING);  // 不支持 io_uring 时退回线程池
+  check(IO_BACKEND_AUTO);
+  const ioStat *stat = GetIoStat();
+  printf("写%lld次 合并成%lld次 %lld批 系统调用%lld次 等待%lld次\n", stat->requests,
+         stat->writes, stat->batches, stat->syscalls, stat->waits);
+  printf("写回后端测试通过\n");
+  return 0;
+}
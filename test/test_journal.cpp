@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 删除大目录一个事务装不下日志区，中间的检查点提前组提交。删到一半崩溃，
+// 重新打开后目录里剩下的文件都还能打开，删掉的都不在了，文件系统可以接着用。
+static void check_checkpoint() {
+  constexpr int N = 3000;
+  pid_t pid = fork();
+  if (pid == 0) {
+    geometry geo{64 << 20, 1024, 8192, 0, ALLOC_BITMAP, false};
+    FormatFileSystem(root_path, &geo);
+    LogIn("root", "root");
+    CreateDir("d");
+    for (int i = 0; i < N; ++i) {
+      assert(CreateFile(("d/f" + std::to_string(i)).c_str()));
+    }
+    FlushBuffer();
+    const journalStat before = *GetJournalStat();
+    assert(DeleteDir("d"));
+    assert(GetJournalStat()->checkpoints > before.checkpoints);
+    assert(GetJournalStat()->overflows == before.overflows);
+    _exit(0);  // 最后一组还没提交
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  OpenFileSystem(root_path);
+  LogIn("root", "root");
+  assert(NextDir("d"));
+  int left = 0;
+  for (int i = 0; i < N; ++i) {
+    left += Open(("f" + std::to_string(i)).c_str()) > 0;
+  }
+  printf("删到一半崩溃，剩%d个文件\n", left);
+  assert(left < N && DirEntries(current_dir_index) >= left);
+  LastDir();
+  assert(DeleteDir("d") && Open("d") < 0);
+  assert(CreateFile("after"));
+  CloseFileSystem();
+}
+
+// 日志区连一个事务都放不下时组提交报错，照样写回，内容不丢。
+static void check_overflow() {
+  geometry geo{8 << 20, 1024, 0, 2, ALLOC_BITMAP, false};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  const long long overflows = GetJournalStat()->overflows;
+  assert(CreateFile("x"));
+  assert(FlushJournal() == false && GetJournalStat()->overflows == overflows + 1);
+  assert(FlushJournal());  // 已经直接写回了，没有要提交的
+  CloseFileSystem();
+
+  OpenFileSystem(root_path);
+  LogIn("root", "root");
+  assert(Open("x") > 0);
+  CloseFileSystem();
+}
+
+// 子进程做完一半操作直接退出，模拟崩溃。
+// 已经组提交的操作必须完整保留，还在组里没有提交的操作必须整体消失。
+int main() {
+  need_log = false;
+  io_mode = IO_PWRITE;
+  use_journal = true;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    FormatFileSystem(root_path);
+    LogIn("root", "root");
+    CreateFile("a");
+    assert(Append(Open("a"), 5, "hello") == 5);
+    FlushBuffer();  // a 已经落盘
+
+    CreateDir("d");
+    CreateFile("b");
+    assert(Append(Open("b"), 5, "world") == 5);
+    DeleteFile("a");
+    _exit(0);  // 崩溃，不关闭文件系统
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status));
+
+  OpenFileSystem(root_path);
+  LogIn("root", "root");
+  char buf[8] = {0};
+  int a = Open("a");
+  assert(a > 0);
+  assert(Read(a, 0, 5, buf) == 5 && strcmp(buf, "hello") == 0);
+  assert(Open("b") < 0);
+  assert(Open("d") < 0);
+
+  // 崩溃后文件系统仍然可用。
+  assert(CreateFile("b"));
+  assert(Append(Open("b"), 5, "world") == 5);
+  CloseFileSystem();
+
+  OpenFileSystem(root_path);
+  LogIn("root", "root");
+  assert(Read(Open("b"), 0, 5, buf) == 5 && strcmp(buf, "world") == 0);
+  CloseFileSystem();
+
+  check_checkpoint();
+  check_overflow();
+
+  printf("日志测试通过，组提交%lld次\n", GetJournalStat()->commits);
+  return 0;
+}
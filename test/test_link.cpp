@@ -13,7 +13,7 @@ int main() {
   need_log = false;
   CreateFile("a");
 
-  for (int i = 0; i < MAX_BLOCK_NUMBER; ++i) {
+  for (int i = 0; i < GetSuperBlock()->block_count; ++i) {
     Link("a", std::to_string(i).c_str());
     DeleteFile(std::to_string(i).c_str());
   }
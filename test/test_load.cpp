@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 流式导入：比栈大得多的本地文件也能整个导进来，内容一致，预分配让块基本连续；
+// 一条命令导入多个文件，不存在的跳过；老的索引方式超过上限时截断到上限；空间不足时预分配的块还回去；
+// read 命令分段输出大文件，不会因为整个文件放在栈上而崩。
+
+// 第 i 个字节的内容
+static char byte_at(long long i, int seed) { return (char)((i * 131 + (i >> 12) * 7 + seed) & 0xff); }
+
+static void make_file(const char *path, long long len, int seed) {
+  FILE *f = fopen(path, "wb");
+  assert(f != nullptr);
+  std::string buf(1 << 16, 0);
+  for (long long pos = 0; pos < len; pos += buf.size()) {
+    const int n = std::min<long long>(buf.size(), len - pos);
+    for (int i = 0; i < n; ++i) {
+      buf[i] = byte_at(pos + i, seed);
+    }
+    fwrite(buf.data(), 1, n, f);
+  }
+  fclose(f);
+}
+
+static void check_content(int index, long long len, int seed) {
+  assert(GetInode(index)->length == len);
+  std::string buf(1 << 20, 0);
+  for (long long pos = 0; pos < len; pos += buf.size()) {
+    const int n = std::min<long long>(buf.size(), len - pos);
+    assert(Read(index, pos, n, buf.data()) == n);
+    for (int i = 0; i < n; ++i) {
+      assert(buf[i] == byte_at(pos + i, seed));
+    }
+  }
+}
+
+int main() {
+  need_log = false;
+  constexpr long long BIG = 24 << 20;  // 默认栈 8MB，原来 alloca 整个文件会崩
+  make_file("load_big.bin", BIG, 0);
+  make_file("load_a.txt", 5000, 1);
+  make_file("load_b.txt", 300000, 2);
+
+  geometry geo{128 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+
+  assert(CreateFile("big"));
+  int big = Open("big");
+  assert(Load("load_big.bin", "big"));
+  check_content(big, BIG, 0);
+  int run = 0;
+  assert(LookupBlock(GetInode(big), 0, &run) > 0);
+  printf("导入 %lldMB，第一段连续 %d 块\n", BIG >> 20, run);
+  assert(run >= 1024);
+
+  // ReadFile 把整个文件写到屏幕，这里把 stdout 接到本地文件上比较
+  OpenFile("big");
+  fflush(stdout);
+  const int saved = dup(STDOUT_FILENO);
+  const int out = open("load_out.txt", O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  dup2(out, STDOUT_FILENO);
+  close(out);
+  ReadFile("big");
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  FILE *f = fopen("load_out.txt", "rb");
+  assert(f != nullptr);
+  std::string shown(5, 0);  // 前面是绿色的颜色码
+  assert(fread(shown.data(), 1, 5, f) == 5 && shown == "\033[32m");
+  std::string buf(1 << 20, 0);
+  for (long long pos = 0; pos < BIG; pos += buf.size()) {
+    assert(fread(buf.data(), 1, buf.size(), f) == buf.size());
+    for (size_t i = 0; i < buf.size(); ++i) {
+      assert(buf[i] == byte_at(pos + i, 0));
+    }
+  }
+  shown.assign(64, 0);
+  shown.resize(fread(shown.data(), 1, shown.size(), f));
+  assert(shown.find("共读取" + std::to_string(BIG) + "字节") != std::string::npos);
+  fclose(f);
+  remove("load_out.txt");
+
+  // 追加在原有内容后面
+  assert(CreateFile("a"));
+  assert(Load("load_a.txt", "a"));
+  assert(Load("load_a.txt", "a"));
+  std::string twice(10000, 0);
+  assert(Read(Open("a"), 0, 10000, twice.data()) == 10000);
+  for (int i = 0; i < 10000; ++i) {
+    assert(twice[i] == byte_at(i % 5000, 1));
+  }
+
+  assert(Load("load_none.txt", "a") == false);
+  assert(Load("load_a.txt", "none") == false);
+
+  // 一次导入多个，不存在的跳过
+  assert(CreateDir("d"));
+  NextDir("d");
+  const char *srcs[] = {"load_a.txt", "./load_none.txt", "./load_b.txt"};
+  assert(LoadFiles(3, srcs) == 2);
+  check_content(Open("load_a.txt"), 5000, 1);
+  check_content(Open("load_b.txt"), 300000, 2);
+  LastDir();
+
+  // 老的索引方式超过上限时截断
+  use_extents = false;
+  assert(CreateFile("old"));
+  use_extents = true;
+  assert(Load("load_big.bin", "old"));
+  assert(GetInode(Open("old"))->length == MaxFileSize());
+  check_content(Open("old"), MaxFileSize(), 0);
+  CloseFileSystem();
+
+  // 比剩下的空间大：预分配到一半失败，分到的块全部还回，原有内容不变
+  geometry small{16 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &small));
+  LogIn("root", "root");
+  const superBlock *super = GetSuperBlock();
+  assert(CreateFile("full"));
+  assert(Load("load_a.txt", "full"));
+  const int free_blocks = super->free_blocks;
+  assert(free_blocks * 4096LL < BIG);
+  assert(Load("load_big.bin", "full") == false);
+  printf("空间不足时导入失败，空闲块%d -> %d\n", free_blocks, super->free_blocks);
+  assert(super->free_blocks == free_blocks);
+  check_content(Open("full"), 5000, 1);
+  assert(Load("load_b.txt", "full"));  // 之后照常导入
+
+  CloseFileSystem();
+  remove("load_big.bin");
+  remove("load_a.txt");
+  remove("load_b.txt");
+  printf("导入测试通过\n");
+  return 0;
+}
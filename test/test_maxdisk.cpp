@@ -4,24 +4,22 @@
 #include <unistd.h>
 #include <cassert>
 #include <string>
+#include <vector>
 #include "head.h"
 
-char buf[MAX_FILE_SIZE];
+std::vector<char> buf;
 
 void create_maxfile(const char *file) {
   CreateFile(file);
 
-  assert(Append(Open(file), MAX_FILE_SIZE, buf) == MAX_FILE_SIZE);
+  assert(Append(Open(file), (int)buf.size(), buf.data()) == (int)buf.size());
 
   ReadFile(file);
 }
 
 int main() {
-  for (int i = 0; i < MAX_FILE_SIZE; ++i) {
-    buf[i] = 'a';
-  }
-
   FormatFileSystem(root_path);
+  buf.assign(MaxFileSize(), 'a');
   LogIn("root", "root");
   need_log = false;
 
@@ -13,7 +13,7 @@ int main() {
 
     printf("%d\n", len);
 
-    if (len >= MAX_FILE_SIZE) {
+    if (len >= MaxFileSize()) {
       break;
     }
   }
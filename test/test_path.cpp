@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 路径解析：绝对路径、多级相对路径、.、.. 和多余的 /；解析不改变当前目录；
+// 各个命令都接受路径；中间一段不是目录、名字过长、不存在时都返回 -1；
+// 不能删当前目录和它的上级；目标目录满了时移动、拷贝、链接都不改动原来的文件。
+
+int main() {
+  need_log = false;
+  geometry geo{16 << 20, 1024, 4096, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  const int root = GetSuperBlock()->root_dir_id;
+
+  // 不进目录直接按路径建
+  assert(CreateDir("a"));
+  assert(CreateDir("a/b"));
+  assert(CreateDir("/a/b/c"));
+  assert(CreateFile("a/b/c/f"));
+  assert(!CreateFile("a/nope/f"));
+  assert(!CreateFile("a/b/c/f"));
+  assert(!CreateDir("a/.."));
+  assert(current_dir_index == root);
+
+  const int a = ResolvePath("a");
+  const int b = ResolvePath("/a/b");
+  const int c = ResolvePath("a/b/c");
+  const int f = ResolvePath("/a/b/c/f");
+  assert(a > 0 && b > 0 && c > 0 && f > 0);
+  assert(GetInode(f)->type == FILE_TYPE && strcmp(GetInode(f)->file_name, "f") == 0);
+
+  // .、.. 和多余的 /
+  assert(ResolvePath("/") == root && ResolvePath(".") == root && ResolvePath("") == root);
+  assert(ResolvePath("..") == root && ResolvePath("/../..") == root);
+  assert(ResolvePath("a//b/./c/") == c && ResolvePath("a/b/../b/c/../../b") == b);
+  assert(ResolvePath("/a/b/c/f/") == f);
+
+  // 不存在、中间不是目录、名字过长
+  assert(ResolvePath("a/x") < 0 && ResolvePath("x/b") < 0);
+  assert(ResolvePath("a/b/c/f/g") < 0 && ResolvePath("a/b/c/f/..") < 0);
+  assert(ResolvePath(("a/" + std::string(MAX_NAME_LENGTH, 'n')).c_str()) < 0);
+  assert(current_dir_index == root);
+
+  // 相对路径从当前目录出发
+  assert(NextDir("a/b"));
+  assert(current_dir_index == b && GetPath() == "/a/b");
+  assert(ResolvePath("c/f") == f && ResolvePath("..") == a && ResolvePath("../b/c") == c);
+  assert(Open("c/f") == f && Open("/a") == a && Open("..") == a && Open(".") == b);
+  assert(Open("../x") < 0);
+  assert(NextDir("../../a/b/c") && current_dir_index == c);
+  assert(NextDir("/") && current_dir_index == root);
+  assert(!NextDir("a/b/c/f") && current_dir_index == root);
+
+  // 读写、打开关闭
+  assert(OpenFile("a/b/c/f") == f && IsOpen(f));
+  assert(Write(Open("/a/b/c/f"), 0, 5, "hello") == 5);
+  assert(CloseFile("a/b/c/f") && !IsOpen(f));
+
+  // 改名只改最后一段，不能换目录
+  assert(Rename("a/b/c/f", "g"));
+  assert(ResolvePath("a/b/c/g") == f && ResolvePath("a/b/c/f") < 0);
+  assert(Rename("/a/b/c/g", "/a/b/c/h"));
+  assert(!Rename("a/b/c/h", "a/h"));
+  assert(ResolvePath("a/b/c/h") == f);
+
+  // 拷贝、移动、链接
+  assert(Copy("a/b/c/h", "/a"));
+  const int copy = ResolvePath("a/h");
+  assert(copy > 0 && copy != f);
+  assert(!Copy("a/b/c/h", "a/h"));  // 目标不是目录
+  NextDir("a/b/c");
+  assert(Move("h", "../../.."));
+  assert(!Move("x", ".."));
+  assert(Link("../../../h", "/l"));
+  assert(current_dir_index == c);
+  NextDir("/");
+  assert(ResolvePath("a/b/c/h") < 0 && ResolvePath("a/h") == copy);
+  assert(ResolvePath("/l") == f && GetInode(f)->link_cnt == 2);
+  std::string s(5, 0);
+  assert(Read(ResolvePath("/l"), 0, 5, s.data()) == 5 && s == "hello");
+
+  // 不能删当前目录和它的上级，删别处的目录不用进去
+  NextDir("a/b");
+  assert(!DeleteDir("/a") && !DeleteDir("."));
+  assert(ResolvePath("/a") == a);
+  assert(DeleteFile("/l"));
+  assert(GetInode(f)->link_cnt == 1);
+  assert(CreateFile("/a/b/c/z"));
+  NextDir("/");
+  assert(DeleteDir("a/b/c") && current_dir_index == root);
+  assert(ResolvePath("a/b/c") < 0 && ResolvePath("a/b") == b);
+  assert(DeleteFile("a/h") && ResolvePath("a/h") < 0);
+  assert(DeleteDir("a"));
+  assert(ResolvePath("a") < 0 && ResolvePath("h") == f);
+
+  // 目标目录满了：移动时文件留在原处，拷贝和链接不留下多余的 inode 和块
+  use_extents = false;  // 老的索引方式，目录最多 MAX_FIRST_INDEX 块
+  assert(CreateDir("full"));
+  use_extents = true;
+  int entries = 0;
+  while (CreateFile(("full/e" + std::to_string(entries)).c_str())) {
+    ++entries;
+    assert(entries < 1000);
+  }
+  assert(entries == MAX_FIRST_INDEX * (1024 / (int)sizeof(namedEntry)));
+  const superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  const int free_inodes = super->free_inodes;
+  assert(!Move("h", "full"));
+  assert(ResolvePath("h") == f && ResolvePath("full/h") < 0);
+  assert(Read(f, 0, 5, s.data()) == 5 && s == "hello");
+  assert(!Copy("h", "full"));
+  assert(!Link("h", "full/l"));
+  assert(GetInode(f)->link_cnt == 1);
+  assert(super->free_blocks == free_blocks && super->free_inodes == free_inodes);
+  assert(DeleteDir("full"));
+
+  CloseFileSystem();
+  printf("路径测试通过\n");
+  return 0;
+}
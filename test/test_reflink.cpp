@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 写时复制的 Copy：拷贝只加共享计数不占空间，任一边写到的块才复制，
+// 另一边看不到修改；删掉一边另一边照常可读，两边都删掉后块全部还回。
+static std::string content(int len, int seed) {
+  std::string s(len, 0);
+  for (int i = 0; i < len; ++i) {
+    s[i] = 'a' + (i / 4096 + seed) % 26;
+  }
+  return s;
+}
+
+static std::string read_all(int index) {
+  std::string s(GetInode(index)->length, 0);
+  assert(Read(index, 0, s.size(), s.data()) == (int)s.size());
+  return s;
+}
+
+static void check(bool extents, int size) {
+  const superBlock *super = GetSuperBlock();  // 重新打开后要重新取
+  const int free_blocks = super->free_blocks;
+  use_extents = extents;
+  CreateFile("src");
+  use_extents = true;
+  int src = Open("src");
+  const std::string data = content(size, 0);
+  assert(Write(src, 0, data.size(), data.data()) == (int)data.size());
+
+  CreateDir("d");
+  const int before = super->free_blocks;
+  assert(Copy("src", "d"));
+  printf("%s: 拷贝 %dKB 用了 %d 块\n", extents ? "区段" : "索引", size >> 10,
+         before - super->free_blocks);
+  assert(before - super->free_blocks <= (extents ? 1 : 2));  // 目录内容块，老的方式还有二级索引块
+  assert(DataBlockRefs(LookupBlock(GetInode(src), 0)) == 2);
+
+  // 重新打开，共享计数还在
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  src = Open("src");
+  NextDir("d");
+  int copy = Open("src");
+  assert(read_all(copy) == data);
+
+  // 副本改一块的一部分：只复制这一块，源文件不变
+  int used = super->free_blocks;
+  assert(Write(copy, 10 * 4096 + 7, 5, "hello") == 5);
+  assert(used - super->free_blocks == 1);
+  std::string changed = data;
+  memcpy(changed.data() + 10 * 4096 + 7, "hello", 5);
+  assert(read_all(copy) == changed);
+  assert(read_all(src) == data);
+
+  // 源文件整块覆盖：副本不变
+  const std::string block = content(4096, 3);
+  assert(Write(src, 20 * 4096, 4096, block.data()) == 4096);
+  std::string changed_src = data;
+  memcpy(changed_src.data() + 20 * 4096, block.data(), 4096);
+  assert(read_all(src) == changed_src);
+  assert(read_all(copy) == changed);
+
+  // 删掉源文件，副本照常可读，共享的块只剩一个使用者
+  LastDir();
+  assert(DeleteFile("src"));
+  NextDir("d");
+  assert(read_all(copy) == changed);
+  assert(DataBlockRefs(LookupBlock(GetInode(copy), 0)) == 1);
+  assert(DeleteFile("src"));
+  LastDir();
+  assert(DeleteDir("d"));
+  assert(super->free_blocks == free_blocks);
+}
+
+int main() {
+  need_log = false;
+  geometry geo{256 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  check(true, 4 << 20);
+  check(false, 1 << 20);
+  CloseFileSystem();
+  printf("写时复制测试通过\n");
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <string>
+#include "head.h"
+
+// 快照：建快照不占块，之后的修改在快照里看不到，删掉和新建的文件在快照里保持原样；
+// 重新打开后快照还在，回滚把整个文件系统恢复到快照时的样子，之后的快照一起丢掉；
+// 只有 root 能建快照和回滚，别的用户改不了别人的文件。
+static std::string read_all(int index) {
+  std::string s(GetInode(index)->length, 0);
+  if (!s.empty()) {
+    assert(Read(index, 0, s.size(), s.data()) == (int)s.size());
+  }
+  return s;
+}
+
+static std::string snap_read(const char *name, const char *path) {
+  int index = SnapshotLookup(name, path);
+  assert(index > 0);
+  return read_all(index);
+}
+
+static void write_file(const char *name, const std::string &s) {
+  int index = Open(name);
+  assert(index > 0);
+  assert(Write(index, 0, s.size(), s.data()) == (int)s.size());
+}
+
+int main() {
+  need_log = false;
+  geometry geo{128 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+
+  const std::string big(1 << 20, 'a');
+  CreateFile("a");
+  write_file("a", big);
+  use_extents = false;
+  CreateFile("old");
+  use_extents = true;
+  write_file("old", "legacy");
+  CreateDir("d");
+  NextDir("d");
+  CreateFile("b");
+  write_file("b", "b1");
+  LastDir();
+
+  // 建快照只在快照表里加一项
+  superBlock *super = GetSuperBlock();
+  const int free_blocks = super->free_blocks;
+  const int free_inodes = super->free_inodes;
+  assert(CreateSnapshot("s1"));
+  assert(!CreateSnapshot("s1"));
+  assert(free_blocks - super->free_blocks <= 1);  // 快照表的第一块
+
+  // 改一块只复制这一块
+  int used = super->free_blocks;
+  assert(Write(Open("a"), 4096, 2, "v2") == 2);
+  printf("快照后改一块用了%d块\n", used - super->free_blocks);
+  assert(used - super->free_blocks <= 2);
+  write_file("old", "LEGACY");
+  NextDir("d");
+  assert(DeleteFile("b"));
+  LastDir();
+  CreateFile("c");
+  assert(Rename("x", "y"));
+
+  std::string changed = big;
+  memcpy(changed.data() + 4096, "v2", 2);
+  assert(read_all(Open("a")) == changed);
+  assert(snap_read("s1", "a") == big);
+  assert(snap_read("s1", "/old") == "legacy");
+  assert(snap_read("s1", "d/b") == "b1");
+  assert(SnapshotLookup("s1", "c") < 0);
+  assert(SnapshotLookup("s1", "x") > 0 && SnapshotLookup("s1", "y") < 0);
+  assert(SnapshotLookup("s1", "d/../a") == SnapshotLookup("s1", "a"));
+
+  // 第二个快照之后再改，两个快照各自看到自己的版本
+  used = super->free_blocks;
+  assert(CreateSnapshot("s2"));
+  assert(super->free_blocks == used);
+  write_file("a", "v3");
+  std::string v3 = changed;
+  memcpy(v3.data(), "v3", 2);
+  assert(snap_read("s2", "a") == changed);
+  assert(snap_read("s1", "a") == big);
+  assert(SnapshotLookup("s2", "c") > 0 && SnapshotLookup("s2", "d/b") < 0);
+
+  // 重新打开，快照还在
+  CloseFileSystem();
+  assert(OpenFileSystem(root_path));
+  LogIn("root", "root");
+  super = GetSuperBlock();
+  assert(read_all(Open("a")) == v3);
+  assert(snap_read("s2", "a") == changed);
+  assert(snap_read("s1", "a") == big);
+  assert(snap_read("s1", "d/b") == "b1");
+
+  // 回滚到第一个快照：之后的修改、新建的文件和第二个快照都没了
+  assert(RollbackSnapshot("s1"));
+  assert(read_all(Open("a")) == big);
+  assert(read_all(Open("old")) == "legacy");
+  assert(Open("c") < 0 && Open("y") < 0 && Open("x") > 0);
+  NextDir("d");
+  assert(read_all(Open("b")) == "b1");
+  LastDir();
+  assert(SnapshotInode("s2", super->root_dir_id) < 0);
+  assert(super->free_inodes == free_inodes - 2);  // 快照表和对照表
+  printf("回滚后比快照前多用%d块\n", free_blocks - super->free_blocks);
+  assert(free_blocks - super->free_blocks <= 4);
+
+  // 回滚之后打开的文件要重新打开。还能接着改，快照照样保留旧版本；再回滚一次
+  assert(OpenFile("a") > 0);
+  write_file("a", "v4");
+  assert(snap_read("s1", "a") == big);
+  assert(RollbackSnapshot("s1"));
+  assert(read_all(Open("a")) == big);
+
+  // 普通用户既不能建快照，也不能靠回滚改掉 root 的文件
+  assert(CreateFile("secret"));
+  write_file("secret", "hello");
+  assert(UserAdd("bob", "bob", "root"));
+  assert(LogIn("bob", "bob"));
+  const int secret = Open("secret");
+  assert(ValidateCurrent(secret) == false);
+  assert(!CreateSnapshot("bob"));
+  assert(!RollbackSnapshot("s1"));
+  assert(read_all(secret) == "hello");
+  assert(LogIn("root", "root"));
+  assert(CreateSnapshot("root"));
+  assert(RollbackSnapshot("s1"));
+  assert(Open("secret") < 0);
+
+  CloseFileSystem();
+  printf("快照测试通过\n");
+  return 0;
+}
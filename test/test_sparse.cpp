@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 稀疏文件：在很远的位置写不为中间的空洞分配块，读空洞得到全零且不分配、不写，
+// SeekData / SeekHole 找到数据段，拷贝出来的文件同样稀疏。
+static void check(bool extents) {
+  use_extents = extents;
+  const superBlock *super = GetSuperBlock();
+  const int block_size = super->block_size;
+  CreateFile("sparse");
+  use_extents = true;
+  const int free_blocks = super->free_blocks;
+  int index = Open("sparse");
+
+  // 老的索引方式最大只有 4MB 左右，两种方式都用得下的位置
+  const int far = extents ? 100 << 20 : MaxFileSize() - 3 * block_size;
+  assert(Write(index, 100, 5, "hello") == 5);
+  assert(Write(index, far, 5, "world") == 5);
+  const int used = free_blocks - super->free_blocks;
+  printf("%s: 长度%d，占用%d块\n", extents ? "区段" : "索引", GetInode(index)->length, used);
+  assert(used <= 3);  // 两个数据块，老的方式再加一个二级索引块
+
+  // 读空洞：全零，不分配块，也不产生写回
+  FlushBuffer();
+  const long long requests = GetIoStat()->requests;
+  std::vector<char> buf(1 << 20, 'x');
+  assert(Read(index, far - (int)buf.size(), buf.size(), buf.data()) == (int)buf.size());
+  assert(std::all_of(buf.begin(), buf.end(), [](char c) { return c == 0; }));
+  assert(Read(index, 0, buf.size(), buf.data()) == (int)buf.size());
+  assert(memcmp(buf.data() + 100, "hello", 5) == 0 && buf[99] == 0 && buf[105] == 0);
+  FlushBuffer();
+  assert(GetIoStat()->requests == requests);
+  assert(free_blocks - super->free_blocks == used);
+
+  // 数据段 [0, block_size) 和 [far 所在块, 文件末尾)
+  const int length = GetInode(index)->length;
+  assert(SeekData(index, 0) == 0);
+  assert(SeekHole(index, 0) == block_size);
+  assert(SeekData(index, block_size) == far / block_size * block_size);
+  assert(SeekHole(index, far) == length);
+  assert(SeekData(index, length) == -1 && SeekHole(index, length) == -1);
+
+  // 拷贝到子目录，副本同样只占数据块
+  CreateDir("d");
+  const int before = super->free_blocks;
+  assert(Copy("sparse", "d"));
+  NextDir("d");
+  int copy = Open("sparse");
+  assert(GetInode(copy)->length == length);
+  assert(before - super->free_blocks <= used + 1);  // 再加目录的内容块
+  char s[5];
+  assert(Read(copy, far, 5, s) == 5 && memcmp(s, "world", 5) == 0);
+  assert(DeleteFile("sparse"));
+  LastDir();
+  assert(DeleteDir("d"));
+  assert(DeleteFile("sparse"));
+  assert(super->free_blocks == free_blocks);
+}
+
+int main() {
+  need_log = false;
+  geometry geo{256 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  check(true);
+  check(false);
+  CloseFileSystem();
+  printf("稀疏测试通过\n");
+  return 0;
+}
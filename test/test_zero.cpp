@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+#include "head.h"
+
+// 惰性清零：分配和释放只改元数据，删除文件不写零，重建文件时数据只写一遍；
+// 旧内容不会从没写到的地方漏出来；预分配的块读出全零，写一次后才变成数据；
+// 打开 discard_blocks 后释放的块在镜像文件上打洞。
+static long long written() { return GetIoStat()->bytes; }
+
+static long long image_blocks() {
+  struct stat st;
+  assert(stat(root_path, &st) == 0);
+  return st.st_blocks * 512LL;
+}
+
+int main() {
+  need_log = false;
+  geometry geo{128 << 20, 4096, 0, 0, ALLOC_BITMAP};
+  assert(FormatFileSystem(root_path, &geo));
+  LogIn("root", "root");
+  CreateFile("x");  // 先让根目录有内容块
+  SyncBuffer();
+
+  // 删掉 4MB 的文件只写元数据，重建时数据只写一遍
+  const std::string data(4 << 20, 'o');
+  CreateFile("f");
+  assert(Write(Open("f"), 0, data.size(), data.data()) == (int)data.size());
+  SyncBuffer();
+  long long before = written();
+  assert(DeleteFile("f"));
+  SyncBuffer();
+  printf("删除写了%lld字节\n", written() - before);
+  assert(written() - before < 64 << 10);
+
+  before = written();
+  CreateFile("f");
+  assert(Write(Open("f"), 0, data.size(), data.data()) == (int)data.size());
+  SyncBuffer();
+  printf("重建写了%lld字节\n", written() - before);
+  assert(written() - before < (long long)data.size() + (256 << 10));
+  assert(DeleteFile("f"));
+
+  // 块里还是 'o'，新文件没写到的地方必须是零
+  CreateFile("g");
+  int g = Open("g");
+  assert(Write(g, 100, 5, "hello") == 5);
+  assert(Write(g, 3 * 4096 + 10, 5, "world") == 5);
+  std::vector<char> buf(4 * 4096);
+  assert(Read(g, 0, buf.size(), buf.data()) == (int)buf.size());
+  assert(std::count(buf.begin(), buf.end(), 'o') == 2);  // 只有 hello 和 world 里的
+  assert(memcmp(buf.data() + 100, "hello", 5) == 0);
+
+  // 预分配的块不写零，读出全零；写一块之后只有这一块变成数据
+  CreateFile("p");
+  int p = Open("p");
+  before = written();
+  assert(Fallocate(p, 0, 1 << 20));
+  SyncBuffer();
+  assert(written() - before < 64 << 10);
+  assert(Write(p, 5000, 10, "0123456789") == 10);
+  assert(ExtentCount(GetInode(p)) == 3);
+  buf.assign(3 * 4096, 'x');
+  assert(Read(p, 0, buf.size(), buf.data()) == (int)buf.size());
+  assert(std::count(buf.begin(), buf.end(), 0) == (int)buf.size() - 10);
+  assert(memcmp(buf.data() + 5000, "0123456789", 10) == 0);
+  assert(SeekData(p, 0) == 4096 && SeekHole(p, 4096) == GetInode(p)->length);
+  std::string big(8192, 'b');
+  assert(Write(p, 4096, big.size(), big.data()) == (int)big.size());
+  assert(ExtentCount(GetInode(p)) == 3);  // 第 2 块并进前面已写的一段
+  assert(DeleteFile("p"));
+  assert(DeleteFile("g"));
+
+  // 打洞：删掉 16MB 的文件后镜像占的空间变小
+  discard_blocks = true;
+  CreateFile("d");
+  const std::string large(16 << 20, 'd');
+  assert(Write(Open("d"), 0, large.size(), large.data()) == (int)large.size());
+  SyncBuffer();
+  const long long used = image_blocks();
+  assert(DeleteFile("d"));
+  SyncBuffer();
+  printf("打洞前占用%lldKB，打洞后%lldKB\n", used >> 10, image_blocks() >> 10);
+  assert(used - image_blocks() >= (long long)large.size() * 3 / 4);
+  discard_blocks = false;
+
+  CloseFileSystem();
+  printf("惰性清零测试通过\n");
+  return 0;
+}